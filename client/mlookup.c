@@ -95,6 +95,9 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  /* Recursing Servers Stop Once We Would Have Given Up */
+  Frame_setBudget(frame, DEFAULT_TIMEOUT * 1000);
+
   error = Frame_send(frame, socket, server, DEFAULT_PORT);
   if (error < 0) {
     fprintf(stderr, "%s: Frame_send: Error sending frame\n", programName);
@@ -0,0 +1,228 @@
+/**
+ * File: mupdate.c
+ * Author: Ethan Gordon
+ * Simple CLI MARP Record Update Client
+ * Usage: mupdate <privkey> set <handle@host> <protocol#> <value> <ttl> [<server>]
+ *        mupdate <privkey> del <handle@host> <protocol#> [<server>]
+ **/
+#define _GNU_SOURCE
+
+/* ECC Config */
+#define uECC_CURVE 3 /* P256 */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <oaes_base64.h>
+
+/* Local Files */
+#include "../network/socket.h"
+#include "../frame.h"
+#include "../object/update.h"
+#include "../micro-ecc/uECC.h"
+
+/* External Required Variables */
+char* programName;
+bool isRunning = true;
+
+/* Network Information */
+#define DEFAULT_PORT 5001
+#define LOCALHOST "127.0.0.1"
+#define DEFAULT_TIMEOUT 1
+
+/* Key Sizes */
+#define KEY_SIZE 32
+#define PUB_SIZE 2*KEY_SIZE+1
+#define PUB_BASE64 89
+
+static void printUsage(void) {
+  fprintf(stderr, "Usage: mupdate <privkey> set <handle@host> <protocol#> <value> <ttl> [<server>]\n");
+  fprintf(stderr, "       mupdate <privkey> del <handle@host> <protocol#> [<server>]\n");
+}
+
+/**
+ * int loadKey(const char*, uint8_t*)
+ * Reads a raw private key, generating a new keypair if @param file does not exist.
+ * The public key is written base64 encoded to <file>.pub, for the server's updatekey option.
+ * @return 0 on success, negative on failure
+ **/
+static int loadKey(const char* file, uint8_t privkey[KEY_SIZE]) {
+  uint8_t pubkey[PUB_SIZE];
+  char pubstr[PUB_BASE64 + 1];
+  char* pubFile;
+  size_t len;
+  int fd, pubfd, error;
+
+  fd = open(file, O_RDONLY);
+  if (fd >= 0) {
+    error = read(fd, privkey, KEY_SIZE);
+    close(fd);
+    if (error < KEY_SIZE) {
+      fprintf(stderr, "%s: Could not read private key %s\n", programName, file);
+      return -1;
+    }
+    return 0;
+  }
+  if (errno != ENOENT) {
+    fprintf(stderr, "%s: Could not open private key %s... %s\n", programName, file, strerror(errno));
+    return -1;
+  }
+
+  /* Create new ECC keypair */
+  pubkey[0] = 0x04;
+  if (uECC_make_key(&(pubkey[1]), privkey) == 0) {
+    fprintf(stderr, "%s: Could not make new key\n", programName);
+    return -1;
+  }
+
+  len = sizeof(pubstr);
+  if (oaes_base64_encode(pubkey, PUB_SIZE, pubstr, &len)) {
+    fprintf(stderr, "%s: Could not base64 encode public key\n", programName);
+    return -1;
+  }
+
+  pubFile = calloc(strlen(file) + strlen(".pub") + 1, sizeof(char));
+  if (pubFile == NULL) return -1;
+  strcat(pubFile, file);
+  strcat(pubFile, ".pub");
+
+  fd = creat(file, 0600);
+  pubfd = creat(pubFile, 0666);
+  if (fd < 0 || pubfd < 0 || write(fd, privkey, KEY_SIZE) < KEY_SIZE || write(pubfd, pubstr, PUB_BASE64) < PUB_BASE64) {
+    fprintf(stderr, "%s: Could not save new keypair... %s\n", programName, strerror(errno));
+    if (fd >= 0) close(fd);
+    if (pubfd >= 0) close(pubfd);
+    free(pubFile);
+    return -1;
+  }
+  close(fd);
+  close(pubfd);
+
+  printf("%s: Private Key saved to %s.\n", programName, file);
+  printf("%s: Public Key saved to %s, set it as the server's updatekey.\n", programName, pubFile);
+  free(pubFile);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  Update_T update;
+  Frame_T frame;
+  Socket_T socket;
+  struct timespec now;
+  uint8_t privkey[KEY_SIZE];
+  uint64_t sequence;
+  uint16_t protocol, ttl = 0;
+  int action, error, updateSize;
+  void* byteBuf;
+  const char *handleAtHost, *value = NULL, *server = LOCALHOST;
+
+  /* Parse Command Line Arguments */
+  programName = argv[0];
+
+  if (argc < 5) {
+    printUsage();
+    exit(EXIT_FAILURE);
+  }
+
+  if (strcmp(argv[2], "set") == 0 && (argc == 7 || argc == 8)) {
+    action = UPDATE_SET;
+    value = argv[5];
+    ttl = (uint16_t)atoi(argv[6]);
+    if (argc == 8) server = argv[7];
+  } else if (strcmp(argv[2], "del") == 0 && (argc == 5 || argc == 6)) {
+    action = UPDATE_DELETE;
+    if (argc == 6) server = argv[5];
+  } else {
+    printUsage();
+    exit(EXIT_FAILURE);
+  }
+  handleAtHost = argv[3];
+  protocol = (uint16_t)atoi(argv[4]);
+
+  if (loadKey(argv[1], privkey) < 0) return EXIT_FAILURE;
+
+  /* Microsecond Timestamps Keep Sequence Numbers Increasing Across Runs */
+  clock_gettime(CLOCK_REALTIME, &now);
+  sequence = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+  /* Construct and Sign Update */
+  update = Update_build(action, handleAtHost, protocol, value, ttl, sequence);
+  if (update == NULL) {
+    fprintf(stderr, "%s: Could not build update.\n", programName);
+    return EXIT_FAILURE;
+  }
+  if (Update_sign(update, privkey) < 0) {
+    fprintf(stderr, "%s: Could not sign update.\n", programName);
+    Update_free(update);
+    return EXIT_FAILURE;
+  }
+
+  updateSize = Update_size(update);
+  byteBuf = calloc(updateSize, sizeof(char));
+  if (byteBuf == NULL) {
+    fprintf(stderr, "%s: Out of Memory", programName);
+    Update_free(update);
+    return EXIT_FAILURE;
+  }
+  Update_serialize(update, byteBuf);
+  Update_free(update);
+
+  frame = Frame_buildUpdate(byteBuf, updateSize);
+  free(byteBuf);
+  if (frame == NULL) {
+    fprintf(stderr, "%s: Could not build update frame.\n", programName);
+    return EXIT_FAILURE;
+  }
+
+  socket = Socket_init(0); /* Unbound Socket */
+  if (socket == NULL) {
+    Frame_free(frame);
+    return EXIT_FAILURE;
+  }
+
+  error = Frame_send(frame, socket, server, DEFAULT_PORT);
+  Frame_free(frame);
+  if (error < 0) {
+    fprintf(stderr, "%s: Frame_send: Error sending frame\n", programName);
+    Socket_free(socket);
+    return EXIT_FAILURE;
+  }
+
+  /* Wait for Response */
+  frame = Frame_init();
+  if (frame == NULL) {
+    Socket_free(socket);
+    return EXIT_FAILURE;
+  }
+
+  error = Frame_listen(frame, socket, DEFAULT_TIMEOUT);
+  if (error < 0) {
+    fprintf(stderr, "%s: Frame_listen: Error receiving response, timeout reached.\n", programName);
+    Socket_free(socket);
+    Frame_free(frame);
+    return EXIT_FAILURE;
+  }
+
+  /* Print Response */
+  Frame_printInfo(frame);
+
+  /* Anything but an Acknowledgement Means the Server Rejected or Failed to Apply the Update */
+  if (!Frame_isApplied(frame)) {
+    fprintf(stderr, "%s: Update was not applied by %s\n", programName, server);
+    Socket_free(socket);
+    Frame_free(frame);
+    return EXIT_FAILURE;
+  }
+
+  Socket_free(socket);
+  Frame_free(frame);
+  return EXIT_SUCCESS;
+}
@@ -4,7 +4,10 @@
  * An in-memory cache of authoritative MARP records,
  * identified by the hash plus the 2-byte protocol.
  **/
+#define _GNU_SOURCE
+
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -13,6 +16,9 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
 
 #include "cache.h"
 #include "../uthash.h"
@@ -24,10 +30,49 @@ typedef struct cache {
   char* id;
   void* buf;
   size_t bufLen;
+  /* Unix time the record's TTL runs out, 0 for never */
+  int64_t expires;
+  /* Lookups served, to rank entries for peers warming up; bumped under the read lock */
+  unsigned long hits;
+  /* Already gossiped to siblings, or learned from a peer; only the gossip thread sets it under the read lock */
+  bool shared;
   UT_hash_handle hh;
 } cache;
 
 static cache* memCache = NULL;
+/* Query threads read, recursions that complete write */
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static time_t lastSweep = 0;
+
+/* IDs of the hottest entries, hottest first, so each chunk a warming peer asks for skips the sort */
+static struct {
+  char* ids;
+  size_t count;
+  time_t builtAt;
+  pthread_mutex_t lock;
+} hot = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+#define ID_SIZE (SHA256_SIZE + sizeof(uint16_t))
+/* Cache files start with this, older files without it are ignored */
+#define MAGIC "MARPCAC1"
+#define MAGIC_LEN 8
+/* Seconds between sweeps for expired entries */
+#define SWEEP_INTERVAL 60
+/* Most entries ranked for warming peers, and seconds a ranking is served before it is rebuilt */
+#define HOT_MAX 1024
+#define HOT_TTL 30
+/* Longest a record from a peer is kept, whatever TTL it came with */
+#define WARM_TTL_MAX 3600
+/* Warm-up entry on the wire: id, TTL left in seconds (0 for never), then the record's length, in network order */
+#define HOT_HEAD (ID_SIZE + sizeof(uint32_t) + sizeof(uint16_t))
+
+#define EXPIRED(c, now) ((c)->expires != 0 && (c)->expires <= (now))
+
+static void Cache_freeEntry(cache* entry) {
+  free(entry->buf);
+  free(entry->id);
+  free(entry);
+}
 
 /**
  * int Cache_dump(char*)
@@ -37,6 +82,7 @@ static cache* memCache = NULL;
 int Cache_dump(const char* cacheFile) {
   cache *current, *tmp;
   int fd, error, count;
+  time_t now = time(NULL);
   
   /* Open File */
   fd = creat(cacheFile, 0600);
@@ -44,29 +90,45 @@ int Cache_dump(const char* cacheFile) {
     fprintf(stderr, "%s: Cache_dump: %s\n", programName, strerror(errno));
     return fd;
   }
+  if (write(fd, MAGIC, MAGIC_LEN) < MAGIC_LEN) {
+    fprintf(stderr, "%s: Cache_dump: %s\n", programName, strerror(errno));
+    close(fd);
+    return -1;
+  }
 
-  /* Dump All Contents */
+  /* Dump All Live Contents */
   count = 0;
+  pthread_rwlock_rdlock(&lock);
   HASH_ITER(hh, memCache, current, tmp) {
-    uint8_t *copy = calloc(SHA256_SIZE + sizeof(uint16_t) + sizeof(size_t) + current->bufLen, sizeof(uint8_t));
+    uint8_t *copy;
+    size_t len = ID_SIZE + sizeof(size_t) + sizeof(int64_t) + current->bufLen;
+
+    if (EXPIRED(current, now)) continue;
+
+    copy = calloc(len, sizeof(uint8_t));
     if (copy == NULL) {
+      pthread_rwlock_unlock(&lock);
       close(fd);
       return -1;
     }
-    memcpy(copy, current->id, SHA256_SIZE + sizeof(uint16_t));
-    memcpy(&(copy[SHA256_SIZE + sizeof(uint16_t)]), &(current->bufLen), sizeof(size_t));
-    memcpy(&(copy[SHA256_SIZE + sizeof(uint16_t) + sizeof(size_t)]), current->buf, current->bufLen);
+    memcpy(copy, current->id, ID_SIZE);
+    memcpy(&(copy[ID_SIZE]), &(current->bufLen), sizeof(size_t));
+    memcpy(&(copy[ID_SIZE + sizeof(size_t)]), &(current->expires), sizeof(int64_t));
+    memcpy(&(copy[ID_SIZE + sizeof(size_t) + sizeof(int64_t)]), current->buf, current->bufLen);
 
-    error = write(fd, copy, SHA256_SIZE + sizeof(uint16_t) + sizeof(size_t) + current->bufLen);
+    error = write(fd, copy, len);
     free(copy);
     if (error < 0) {
       fprintf(stderr, "%s: Cache_dump: %s\n", programName, strerror(errno));
+      pthread_rwlock_unlock(&lock);
       close(fd);
       return error;
     }
     count++;
   }
+  pthread_rwlock_unlock(&lock);
 
+  close(fd);
   return count;
 }
 /**
@@ -78,6 +140,8 @@ int Cache_dump(const char* cacheFile) {
 int Cache_load(const char* cacheFile) {
   int fd, error, count;
   cache *newCache, *replaced;
+  char magic[MAGIC_LEN];
+  time_t now = time(NULL);
 
   /* Open File */
   fd = open(cacheFile, O_RDONLY);
@@ -86,66 +150,86 @@ int Cache_load(const char* cacheFile) {
     return 0;
   }
 
+  if (read(fd, magic, MAGIC_LEN) < MAGIC_LEN || memcmp(magic, MAGIC, MAGIC_LEN) != 0) {
+    fprintf(stderr, "%s: Cache_load: %s is not a cache file, ignoring it\n", programName, cacheFile);
+    close(fd);
+    return 0;
+  }
+
   count = 0;
 
+  pthread_rwlock_wrlock(&lock);
   while (1) {
     /* Make buffer for reading. */
     newCache = calloc(1, sizeof(cache));
     if (newCache == NULL) break;
-    newCache->id = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
+    newCache->id = calloc(ID_SIZE, sizeof(char));
     if (newCache->id == NULL) { free(newCache); break; }
 
-    /* Read id and bufLen */
-    error = read(fd, newCache->id, SHA256_SIZE + sizeof(uint16_t));
-    if (error < SHA256_SIZE + sizeof(uint16_t)) {
+    /* Read id, bufLen and expiry */
+    error = read(fd, newCache->id, ID_SIZE);
+    if (error < (int)ID_SIZE) {
       if (error < 0) fprintf(stderr, "%s: Cache_load: %s\n", programName, strerror(errno));
       free(newCache->id); free(newCache); break;
     }
     error = read(fd, &(newCache->bufLen), sizeof(size_t));
-    if (error < sizeof(size_t)) {
+    if (error < (int)sizeof(size_t)) {
+      if (error < 0) fprintf(stderr, "%s: Cache_load: %s\n", programName, strerror(errno));
+      free(newCache->id); free(newCache); break;
+    }
+    error = read(fd, &(newCache->expires), sizeof(int64_t));
+    if (error < (int)sizeof(int64_t)) {
       if (error < 0) fprintf(stderr, "%s: Cache_load: %s\n", programName, strerror(errno));
       free(newCache->id); free(newCache); break;
     }
 
     /* Create and fill buffer */
-    newCache->buf = calloc(newCache->bufLen, sizeof(char));
+    newCache->buf = calloc(newCache->bufLen ? newCache->bufLen : 1, sizeof(char));
     if (newCache->buf == NULL) {
       free(newCache->id); free(newCache); break;
     }
 
     error = read(fd, newCache->buf, newCache->bufLen);
-    if (error < newCache->bufLen) {
+    if (error < 0 || (size_t)error < newCache->bufLen) {
       if (error < 0) fprintf(stderr, "%s: Cache_load: %s\n", programName, strerror(errno));
-      free(newCache->buf); free(newCache->id); free(newCache); break;
+      Cache_freeEntry(newCache); break;
     }
 
-    /* Add to Hash Table */
-    HASH_REPLACE(hh, memCache, id[0], sizeof(cache), newCache, replaced);
-    if (replaced != NULL) {
-      free(replaced->buf); free(replaced->id); free(replaced);
+    /* Expired While We Were Down */
+    if (EXPIRED(newCache, now)) {
+      Cache_freeEntry(newCache);
+      continue;
     }
+
+    /* Add to Hash Table */
+    HASH_REPLACE(hh, memCache, id[0], ID_SIZE, newCache, replaced);
+    if (replaced != NULL) Cache_freeEntry(replaced);
+    else count++;
   }
+  pthread_rwlock_unlock(&lock);
 
   close(fd);
   return count;
 }
 
 /**
- * int Cache_addUpdate(char[32], uint16_t, void*, size_t)
+ * int Cache_addUpdate(char[32], uint16_t, void*, size_t, int64_t)
  * Note: A defensive copy is made of the entry buffer.
  * @param hash, protocol: used to identify the cache entry
  * @param record: Entry data buffer
  * @param recordLen: Size of entry data buffer
+ * @param expires: Unix time after which the entry is no longer served, 0 for never
  * @return 0 on success, negative on failure
  **/
-int Cache_addUpdate(char hash[SHA256_SIZE], uint16_t protocol, void* record, size_t recordLen) {
-  cache *add, *replaced;
+int Cache_addUpdate(char hash[SHA256_SIZE], uint16_t protocol, void* record, size_t recordLen, int64_t expires) {
+  cache *add, *replaced, *current, *tmp;
+  time_t now = time(NULL);
   replaced = NULL;
 
   add = calloc(1, sizeof(cache));
   if (add == NULL) return -1;
 
-  add->id = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
+  add->id = calloc(ID_SIZE, sizeof(char));
   if (add->id == NULL) {
     free(add); return -1;
   }
@@ -153,17 +237,30 @@ int Cache_addUpdate(char hash[SHA256_SIZE], uint16_t protocol, void* record, siz
   memcpy(add->id, hash, SHA256_SIZE);
   memcpy(&(add->id[SHA256_SIZE]), &protocol, sizeof(uint16_t));
 
-  add->buf = calloc(recordLen, sizeof(char));
+  add->buf = calloc(recordLen ? recordLen : 1, sizeof(char));
   if (add->buf == NULL) {
     free(add->id); free(add); return -1;
   }
 
   memcpy(add->buf, record, recordLen);
-
-  HASH_REPLACE(hh, memCache, id[0], sizeof(cache), add, replaced);
-  if (replaced != NULL) {
-    free(replaced->buf); free(replaced->id); free(replaced);
+  add->bufLen = recordLen;
+  add->expires = expires;
+
+  pthread_rwlock_wrlock(&lock);
+  HASH_REPLACE(hh, memCache, id[0], ID_SIZE, add, replaced);
+  if (replaced != NULL) Cache_freeEntry(replaced);
+
+  /* Drop Expired Entries Now and Then, Lookups Only Skip Them */
+  if (now - lastSweep >= SWEEP_INTERVAL) {
+    lastSweep = now;
+    HASH_ITER(hh, memCache, current, tmp) {
+      if (EXPIRED(current, now)) {
+        HASH_DEL(memCache, current);
+        Cache_freeEntry(current);
+      }
+    }
   }
+  pthread_rwlock_unlock(&lock);
   
   return EXIT_SUCCESS;
 } /* End Cache_addUpdate() */
@@ -173,30 +270,250 @@ int Cache_addUpdate(char hash[SHA256_SIZE], uint16_t protocol, void* record, siz
  * Note: The returned buffer is a freshly allocated copy and must be freed by the caller.
  * @param hash, protocol: used to identify the cache entry
  * @param recordLen: value-parameter, is filled with the size of the return value if not NULL
- * @return pointer to the cache entry buffer, DO NOT FREE!
+ * @return copy of the cache entry buffer, that MUST BE FREED, or NULL if missing or expired
  **/
 const void* Cache_get(char hash[SHA256_SIZE], uint16_t protocol, size_t* recordLen) {
-  char* getID;
+  char getID[ID_SIZE];
   cache *getCache;
-
-  getID = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
-  if (getID == NULL) return NULL;
+  void* ret = NULL;
 
   memcpy(getID, hash, SHA256_SIZE);
   memcpy(&(getID[SHA256_SIZE]), &protocol, sizeof(uint16_t));
 
-  HASH_FIND(hh, memCache, getID, SHA256_SIZE + sizeof(uint16_t), getCache);
+  pthread_rwlock_rdlock(&lock);
+  HASH_FIND(hh, memCache, getID, ID_SIZE, getCache);
+  if (getCache != NULL && !EXPIRED(getCache, time(NULL))) {
+    __atomic_fetch_add(&(getCache->hits), 1, __ATOMIC_RELAXED);
+    ret = malloc(getCache->bufLen ? getCache->bufLen : 1);
+    if (ret != NULL) {
+      memcpy(ret, getCache->buf, getCache->bufLen);
+      if (recordLen) *recordLen = getCache->bufLen;
+    }
+  }
+  pthread_rwlock_unlock(&lock);
 
-  free(getID);
+  return ret;
+}
 
-  if (getCache == NULL) {
-    return NULL;
+/**
+ * int Cache_ids(void (*)(void*, const char*), void*)
+ * Calls @param fn with the hash of every cached record, once per protocol.
+ * @param user: Passed through to @param fn
+ * @return Number of entries
+ **/
+int Cache_ids(void (*fn)(void* user, const char hash[SHA256_SIZE]), void* user) {
+  cache *current, *tmp;
+  time_t now = time(NULL);
+  int count = 0;
+
+  pthread_rwlock_rdlock(&lock);
+  HASH_ITER(hh, memCache, current, tmp) {
+    if (EXPIRED(current, now)) continue;
+    fn(user, current->id);
+    count++;
   }
+  pthread_rwlock_unlock(&lock);
+  return count;
+}
+
+/* An entry and its hits when ranked, read once so concurrent lookups can't reorder the sort */
+struct ranked {
+  cache* entry;
+  unsigned long hits;
+};
 
-  *recordLen = getCache->bufLen;
-  return getCache->buf;
+static int Cache_compareHits(const void* a, const void* b) {
+  unsigned long x = ((const struct ranked*)a)->hits;
+  unsigned long y = ((const struct ranked*)b)->hits;
+  return (x < y) - (x > y);
 }
 
+/* Writes @param entry to @param out as HOT_HEAD then its record, @return bytes written */
+static size_t Cache_pack(const cache* entry, uint8_t* out, time_t now) {
+  uint32_t ttl = htonl(entry->expires ? (uint32_t)(entry->expires - now) : 0);
+  uint16_t len = htons((uint16_t)entry->bufLen);
+
+  memcpy(out, entry->id, ID_SIZE);
+  memcpy(out + ID_SIZE, &ttl, sizeof(uint32_t));
+  memcpy(out + ID_SIZE + sizeof(uint32_t), &len, sizeof(uint16_t));
+  memcpy(out + HOT_HEAD, entry->buf, entry->bufLen);
+  return HOT_HEAD + entry->bufLen;
+}
+
+/* Rank the HOT_MAX most looked up live entries into hot. Read lock and hot.lock must be held. */
+static int Cache_rank(time_t now) {
+  struct ranked* ranks;
+  cache *current, *tmp;
+  char* ids;
+  size_t count = 0, i;
+
+  ranks = calloc(HASH_COUNT(memCache) + 1, sizeof(struct ranked));
+  if (ranks == NULL) return -1;
+
+  /* Only Entries Ever Looked Up are Worth Sending */
+  HASH_ITER(hh, memCache, current, tmp) {
+    unsigned long hits = __atomic_load_n(&(current->hits), __ATOMIC_RELAXED);
+
+    if (hits == 0 || EXPIRED(current, now)) continue;
+    ranks[count].entry = current;
+    ranks[count++].hits = hits;
+  }
+  qsort(ranks, count, sizeof(struct ranked), Cache_compareHits);
+  if (count > HOT_MAX) count = HOT_MAX;
+
+  ids = realloc(hot.ids, (count + 1) * ID_SIZE);
+  if (ids == NULL) {
+    free(ranks);
+    return -1;
+  }
+  for (i = 0; i < count; i++) memcpy(ids + i * ID_SIZE, ranks[i].entry->id, ID_SIZE);
+  free(ranks);
+
+  hot.ids = ids;
+  hot.count = count;
+  hot.builtAt = now;
+  return 0;
+}
+
+/**
+ * int Cache_hot(size_t, uint8_t*, size_t, size_t*)
+ * Serializes the most looked-up entries, best first, for a peer warming its cache.
+ * The ranking is rebuilt at most every HOT_TTL seconds, not for every chunk.
+ * @param rank: Position in the ranking to start from, 0 for the hottest
+ * @param buf: Overwritten with as many entries as fit
+ * @param bufLen: Size of @param buf
+ * @param next: Overwritten with the rank to ask for next, 0 once the top HOT_MAX are sent
+ * @return Bytes written to @param buf, negative on failure
+ **/
+int Cache_hot(size_t rank, uint8_t* buf, size_t bufLen, size_t* next) {
+  time_t now = time(NULL);
+  size_t used = 0, i;
+
+  *next = 0;
+
+  pthread_rwlock_rdlock(&lock);
+  pthread_mutex_lock(&(hot.lock));
+  if ((hot.ids == NULL || now - hot.builtAt >= HOT_TTL) && Cache_rank(now) < 0) {
+    pthread_mutex_unlock(&(hot.lock));
+    pthread_rwlock_unlock(&lock);
+    return -1;
+  }
+
+  for (i = rank; i < hot.count; i++) {
+    cache* entry;
+
+    /* Gone or Expired Since it was Ranked */
+    HASH_FIND(hh, memCache, hot.ids + i * ID_SIZE, ID_SIZE, entry);
+    if (entry == NULL || EXPIRED(entry, now) || entry->bufLen > UINT16_MAX) continue;
+    if (used + HOT_HEAD + entry->bufLen > bufLen) {
+      /* Too Big for Any Chunk, Skip Rather Than Stall */
+      if (used == 0) continue;
+      *next = i;
+      break;
+    }
+    used += Cache_pack(entry, buf + used, now);
+  }
+  pthread_mutex_unlock(&(hot.lock));
+  pthread_rwlock_unlock(&lock);
+
+  return (int)used;
+} /* End Cache_hot() */
+
+/**
+ * int Cache_fresh(uint8_t*, size_t, unsigned long)
+ * Serializes entries not yet shared that were looked up at least @param minHits
+ * times, in the Cache_hot() format, and marks them shared so each goes out once.
+ * Note: Only call from one thread.
+ * @param buf: Overwritten with as many entries as fit
+ * @param bufLen: Size of @param buf
+ * @return Bytes written to @param buf, 0 once nothing is left, negative on failure
+ **/
+int Cache_fresh(uint8_t* buf, size_t bufLen, unsigned long minHits) {
+  cache *current, *tmp;
+  time_t now = time(NULL);
+  size_t used = 0;
+
+  pthread_rwlock_rdlock(&lock);
+  HASH_ITER(hh, memCache, current, tmp) {
+    if (current->shared || EXPIRED(current, now)) continue;
+    if (__atomic_load_n(&(current->hits), __ATOMIC_RELAXED) < minHits) continue;
+
+    /* Too Big for Any Chunk, Never Worth Retrying */
+    if (current->bufLen > UINT16_MAX || HOT_HEAD + current->bufLen > bufLen) {
+      current->shared = true;
+      continue;
+    }
+    if (used + HOT_HEAD + current->bufLen > bufLen) break;
+
+    used += Cache_pack(current, buf + used, now);
+    current->shared = true;
+  }
+  pthread_rwlock_unlock(&lock);
+
+  return (int)used;
+} /* End Cache_fresh() */
+
+/**
+ * int Cache_warm(const uint8_t*, size_t, int (*)(void*, const char*), void*)
+ * Adds entries from a peer's Cache_hot() or Cache_fresh(), keeping any we already hold.
+ * Each is kept for its TTL, but never longer than WARM_TTL_MAX.
+ * @param keep: Called with each entry's hash, it is only added if nonzero. NULL keeps all.
+ * @param user: Passed through to @param keep
+ * @return Number of entries added, negative if malformed
+ **/
+int Cache_warm(const uint8_t* buf, size_t len, int (*keep)(void* user, const char hash[SHA256_SIZE]), void* user) {
+  cache *add, *found;
+  time_t now = time(NULL);
+  size_t used = 0;
+  int count = 0;
+
+  while (used < len) {
+    uint32_t ttl;
+    uint16_t recordLen;
+
+    if (len - used < HOT_HEAD) return -1;
+    memcpy(&ttl, buf + used + ID_SIZE, sizeof(uint32_t));
+    memcpy(&recordLen, buf + used + ID_SIZE + sizeof(uint32_t), sizeof(uint16_t));
+    ttl = ntohl(ttl);
+    recordLen = ntohs(recordLen);
+    if (len - used - HOT_HEAD < recordLen) return -1;
+
+    if (keep == NULL || keep(user, (const char*)buf + used)) {
+      add = calloc(1, sizeof(cache));
+      if (add == NULL) return count;
+      add->id = calloc(ID_SIZE, sizeof(char));
+      add->buf = calloc(recordLen ? recordLen : 1, sizeof(char));
+      if (add->id == NULL || add->buf == NULL) {
+        Cache_freeEntry(add);
+        return count;
+      }
+      memcpy(add->id, buf + used, ID_SIZE);
+      memcpy(add->buf, buf + used + HOT_HEAD, recordLen);
+      add->bufLen = recordLen;
+      /* Never Keep a Peer's Record Forever, However Long it Claims to Live */
+      if (ttl == 0 || ttl > WARM_TTL_MAX) ttl = WARM_TTL_MAX;
+      add->expires = now + ttl;
+      /* The Peer Already Shared it, Don't Echo it Back */
+      add->shared = true;
+
+      /* Never Replace What We Have, it is at Least as Fresh */
+      pthread_rwlock_wrlock(&lock);
+      HASH_FIND(hh, memCache, add->id, ID_SIZE, found);
+      if (found == NULL) {
+        HASH_ADD_KEYPTR(hh, memCache, add->id, ID_SIZE, add);
+        add = NULL;
+        count++;
+      }
+      pthread_rwlock_unlock(&lock);
+      if (add != NULL) Cache_freeEntry(add);
+    }
+
+    used += HOT_HEAD + recordLen;
+  }
+
+  return count;
+} /* End Cache_warm() */
+
 /**
  * void Cache_destroy(void)
  * De-allocates all resources associated with the in-memory cache.
@@ -204,11 +521,17 @@ const void* Cache_get(char hash[SHA256_SIZE], uint16_t protocol, size_t* recordL
 void Cache_destroy(void) {
   cache *current, *tmp;
 
+  pthread_rwlock_wrlock(&lock);
   HASH_ITER(hh, memCache, current, tmp) {
     HASH_DEL(memCache, current);
-    free(current->buf);
-    free(current->id);
-    free(current);
+    Cache_freeEntry(current);
   }
+  pthread_rwlock_unlock(&lock);
+
+  pthread_mutex_lock(&(hot.lock));
+  free(hot.ids);
+  hot.ids = NULL;
+  hot.count = 0;
+  pthread_mutex_unlock(&(hot.lock));
 }
 
@@ -9,6 +9,7 @@
 #define CACHE_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define SHA256_SIZE 32
 
@@ -28,24 +29,66 @@ int Cache_dump(const char* cacheFile);
 int Cache_load(const char* cacheFile);
 
 /**
- * int Cache_addUpdate(char[32], uint16_t, void*, size_t)
+ * int Cache_addUpdate(char[32], uint16_t, void*, size_t, int64_t)
  * Note: A defensive copy is made of the entry buffer.
  * @param hash, protocol: used to identify the cache entry
  * @param record: Entry data buffer
  * @param recordLen: Size of entry data buffer
+ * @param expires: Unix time after which the entry is no longer served, 0 for never
  * @return 0 on success, negative on failure
  **/
-int Cache_addUpdate(char hash[SHA256_SIZE], uint16_t protocol, void* record, size_t recordLen);
+int Cache_addUpdate(char hash[SHA256_SIZE], uint16_t protocol, void* record, size_t recordLen, int64_t expires);
 
 /**
  * void* Cache_get(char[32], uint16_t, size_t*)
  * Note: The returned buffer is a freshly allocated copy and must be freed by the caller.
  * @param hash, protocol: used to identify the cache entry
  * @param recordLen: value-parameter, is filled with the size of the return value if not NULL
- * @return pointer to the cache entry buffer, DO NOT FREE!
+ * @return copy of the cache entry buffer, that MUST BE FREED, or NULL if missing or expired
  **/
 const void* Cache_get(char hash[SHA256_SIZE], uint16_t protocol, size_t* recordLen);
 
+/**
+ * int Cache_ids(void (*)(void*, const char*), void*)
+ * Calls @param fn with the hash of every cached record, once per protocol.
+ * @param user: Passed through to @param fn
+ * @return Number of entries
+ **/
+int Cache_ids(void (*fn)(void* user, const char hash[SHA256_SIZE]), void* user);
+
+/**
+ * int Cache_hot(size_t, uint8_t*, size_t, size_t*)
+ * Serializes the most looked-up entries, best first, for a peer warming its cache.
+ * The ranking is rebuilt at most every HOT_TTL seconds, not for every chunk.
+ * @param rank: Position in the ranking to start from, 0 for the hottest
+ * @param buf: Overwritten with as many entries as fit
+ * @param bufLen: Size of @param buf
+ * @param next: Overwritten with the rank to ask for next, 0 once the top HOT_MAX are sent
+ * @return Bytes written to @param buf, negative on failure
+ **/
+int Cache_hot(size_t rank, uint8_t* buf, size_t bufLen, size_t* next);
+
+/**
+ * int Cache_fresh(uint8_t*, size_t, unsigned long)
+ * Serializes entries not yet shared that were looked up at least @param minHits
+ * times, in the Cache_hot() format, and marks them shared so each goes out once.
+ * Note: Only call from one thread.
+ * @param buf: Overwritten with as many entries as fit
+ * @param bufLen: Size of @param buf
+ * @return Bytes written to @param buf, 0 once nothing is left, negative on failure
+ **/
+int Cache_fresh(uint8_t* buf, size_t bufLen, unsigned long minHits);
+
+/**
+ * int Cache_warm(const uint8_t*, size_t, int (*)(void*, const char*), void*)
+ * Adds entries from a peer's Cache_hot() or Cache_fresh(), keeping any we already hold.
+ * Each is kept for its TTL, but never longer than WARM_TTL_MAX.
+ * @param keep: Called with each entry's hash, it is only added if nonzero. NULL keeps all.
+ * @param user: Passed through to @param keep
+ * @return Number of entries added, negative if malformed
+ **/
+int Cache_warm(const uint8_t* buf, size_t len, int (*keep)(void* user, const char hash[SHA256_SIZE]), void* user);
+
 /**
  * void Cache_destroy(void)
  * De-allocates all resources associated with the in-memory cache.
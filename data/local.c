@@ -18,11 +18,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <oaes_base64.h>
 #include <oaes_lib.h>
 
 #include "../uthash.h"
 #include "inih/ini.h"
+#include "zone.h"
 #include "../libsha2/sha256.h"
 #include "local.h"
 #include "../micro-ecc/uECC.h"
@@ -33,6 +39,8 @@
 #define PUB_BASE64 89
   
 
+struct sHost;
+
 /* Individual Local Entry, Placed in Hash Table */
 typedef struct entry {
   /* Concatonated SHA256('handle@host') + protocol */
@@ -45,27 +53,192 @@ typedef struct entry {
   /* TTL either from section or host */
   int ttl;
 
+  /* Host include file this entry was loaded from, and its other entries */
+  struct sHost* owner;
+  struct entry* prev;
+  struct entry* next;
+
   UT_hash_handle hh; 
 } entry;
 
+/* Approximate heap footprint of an entry */
+#define ENTRY_SIZE(e) (sizeof(entry) + SHA256_SIZE + sizeof(uint16_t) + (e)->encLen)
+
 /* Local Structure, the basis for the AO */
 struct local {
   /* Local HashTable Head, should be NULL */
   entry* localCache;
+  /* Guards localCache, readers are query threads, writers load and unload hosts */
+  pthread_rwlock_t lock;
   /* Private Key */
   char* privkey;
+  /* Number of worker threads used to load host files */
+  int threads;
+
+  /* Host index, keyed by host name */
+  struct sHost* index;
+  /* Load hosts on their first query rather than at startup */
+  bool lazy;
+  /* Guards loading, unloading and LRU state of lazy hosts */
+  pthread_mutex_t lazyLock;
+  /* Bytes held by loaded entries, and the cap (0 for none) */
+  size_t memory;
+  size_t memcap;
+  /* LRU clock, bumped on every lazy lookup */
+  unsigned long tick;
+
+  /* Raw public key that runtime updates must be signed with, NULL disables updates */
+  uint8_t* updateKey;
+  /* Append-only journal of applied updates, rewritten once it holds compactAt of them */
+  char* journalFile;
+  int journal;
+  size_t journaled;
+  size_t compactAt;
+  /* Last update applied to each record, guarded by lazyLock */
+  struct applied* applied;
+
+  /* Zone serial, bumped on every applied update, guarded by lock */
+  uint64_t serial;
+  /* Bumped under lock whenever a replicated record changes, read without it by Local_generation() */
+  uint64_t generation;
+  /* Serve zone transfers to the secondaries at these addresses */
+  bool allowTransfer;
+  struct in_addr* secondaries;
+  size_t secondaryCount;
+  /* Ring of the most recent changes, for incremental transfers */
+  struct change* changes;
+  size_t changeHead;
+  size_t changeCount;
+  /* Serialized copy of the table taken at xfrSerial, paged out by full transfers */
+  pthread_mutex_t xfrLock;
+  uint8_t* xfrSnapshot;
+  size_t* xfrOffsets;
+  size_t xfrCount;
+  uint64_t xfrSerial;
+
+  /* Most peers a recursive query is sent to, including hedges */
+  int fanout;
+  /* Microseconds peer traffic waits to share a datagram, 0 to send at once */
+  int batch;
+  /* This node's ip:port on the cluster ring, NULL outside cluster mode */
+  char* cluster;
+  /* Seconds between pushes of hot cache entries to siblings, 0 if gossip is off */
+  int gossip;
+  /* Check signed recursive answers against config/hostkeys.dat */
+  bool verify;
+  /* Sign local answers with privkey, on this many dedicated threads */
+  bool sign;
+  int signers;
+  /* Hash of the secret every node shares, keys the MAC on pushes between nodes */
+  uint8_t peerKey[SHA256_SIZE];
+  bool hasPeerKey;
+
+  /* Primary to replicate from, NULL if this server is not a secondary */
+  char* primary;
+  int refresh;
+  /* Secondary state, only touched by the transfer thread */
+  uint64_t transferSerial;
+  uint32_t transferCursor;
+  uint64_t snapshotSerial;
+  entry* staged;
 };
 
+/* Protocol Name, Placed in Hash Table keyed by name */
+typedef struct protoName {
+  char* name;
+  uint16_t protocol;
+  UT_hash_handle hh;
+} protoName;
+
+/* Last update applied to a record: older ones are refused, and compacting the journal keeps only these */
+typedef struct applied {
+  char id[SHA256_SIZE + sizeof(uint16_t)];
+  uint64_t sequence;
+  /* As journaled, length prefix included, NULL without a journal */
+  uint8_t* update;
+  size_t len;
+  UT_hash_handle hh;
+} applied;
+
+/* A change to the local table, kept for incremental zone transfers */
+typedef struct change {
+  uint64_t serial;
+  uint8_t action;
+  char id[SHA256_SIZE + sizeof(uint16_t)];
+  int ttl;
+  /* Copy of the encrypted address, NULL for a delete */
+  char* encrypted;
+  size_t encLen;
+} change;
+
+/* A parsed but not yet hashed or encrypted host record, strings point into the zone mapping */
+typedef struct pending {
+  /* Handle, the section name */
+  const char* handle;
+  size_t handleLen;
+  uint16_t protocol;
+  /* Plaintext Address */
+  const char* value;
+  size_t valueLen;
+  int ttl;
+  /* Filled in by a worker, NULL if the record could not be built */
+  entry* built;
+} pending;
+
 /* Persistent Structure to Pass Along the Host Handlers */
 struct sHost {
   /* Host name as a C-string */
-  const char* host;
+  char* host;
+  size_t hostLen;
+  /* Host include file to parse */
+  char* file;
+  /* Mapped include file, open until the records are built */
+  Zone_T zone;
   /* TTL for entire hostname, used if section has no TTL entry */
   int hostTTL;
-  /* Name of the current section (handle) */
-  char* currentSection;
+  /* Name of the current section (handle), points into the zone mapping */
+  const char* currentSection;
+  size_t currentLen;
   /* Name of the Section TTL (good until the next TTL or next Section */
   int sectionTTL;
+  /* Records parsed from the include file, in file order */
+  pending* records;
+  size_t count;
+  size_t cap;
+
+  /* Next include file for the same host */
+  struct sHost* next;
+  /* Entries currently in the local table, and their footprint */
+  entry* entries;
+  size_t memory;
+  bool loaded;
+  /* Has runtime updates, so it is never unloaded */
+  bool pinned;
+  /* LRU clock value of the last lookup, kept on the first include of a host */
+  unsigned long lastUsed;
+  /* Bumped under lock whenever an update changes one of the host's records, kept on the first include */
+  uint64_t generation;
+
+  UT_hash_handle hh;
+};
+
+/* A contiguous run of pending records, the unit of work for hashing and encryption */
+struct chunk {
+  struct sHost* host;
+  size_t start;
+  size_t end;
+  /* Set when the chunk could not be built */
+  bool failed;
+};
+
+/* Shared work queue for the loader threads */
+struct pool {
+  pthread_mutex_t lock;
+  /* Next work item to hand out */
+  size_t next;
+  size_t count;
+  void (*work)(size_t item, void* arg);
+  void* arg;
 };
 
 typedef struct local *Local_T;
@@ -73,9 +246,52 @@ typedef struct local *Local_T;
 /* AO Object */
 static Local_T config;
 
-/* Array of Protocols, Max 255 for now */
+/* Protocols by Name, Max 255 for now */
 #define PROTO_MAX 255
-static char** protocols;
+static protoName* protocols;
+
+/* Host include files queued by handler(), indexed by Local_init() */
+static struct sHost* hosts;
+static size_t hostCount;
+
+/* Records hashed and encrypted per unit of work */
+#define CHUNK_SIZE 256
+
+/* Fewest journaled updates worth compacting, the journal is rewritten once it is also twice the records it updates */
+#define JOURNAL_COMPACT 1024
+
+/* Changes kept for incremental transfers, older secondaries fall back to a snapshot */
+#define XFR_LOG 1024
+
+/* Transfer payloads: request is serial + cursor, response is serial + next + kind, then records */
+#define XFR_REQUEST (sizeof(uint64_t) + sizeof(uint32_t))
+#define XFR_HEADER (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t))
+#define XFR_RECORD (sizeof(uint8_t) + SHA256_SIZE + 3 * sizeof(uint16_t))
+#define XFR_REFRESH 10
+#define XFR_FULL 1
+#define XFR_INCR 2
+
+/* Peers a recursive query may be hedged to when fanout= is not set */
+#define DEFAULT_FANOUT 3
+/* Signing threads when signers= is not set */
+#define DEFAULT_SIGNERS 1
+/* SHA-256 block size, for the peerkey HMAC */
+#define MAC_BLOCK 64
+
+/* Longest "<handle>@<host>" hashed without a heap buffer */
+#define ID_BUF 256
+
+/* Compare a length-delimited string against a C-string */
+#define STR_EQ(s, len, lit) ((len) == strlen(lit) && memcmp((s), (lit), (len)) == 0)
+
+/* atoi() for strings that are not NUL-terminated */
+static int parseInt(const char* str, size_t len) {
+  char buf[16];
+  if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+  memcpy(buf, str, len);
+  buf[len] = '\0';
+  return atoi(buf);
+}
 
 /* argv[0] from main */
 extern char* programName;
@@ -170,136 +386,183 @@ static void Local_loadKey(const char* file) {
 }
 
 
+/* Load the base64 public key that runtime updates are verified against */
+static int Local_loadUpdateKey(const char* file) {
+  char pubstr[PUB_BASE64 + 1];
+  uint8_t pubkey[PUB_SIZE + 2];
+  size_t len;
+  int fd, error;
+
+  fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "%s: Local_loadUpdateKey: Could not open update key %s... %s\n", programName, file, strerror(errno));
+    return -1;
+  }
+  error = read(fd, pubstr, PUB_BASE64);
+  close(fd);
+  if (error < PUB_BASE64) {
+    fprintf(stderr, "%s: Local_loadUpdateKey: Update key %s is too short\n", programName, file);
+    return -1;
+  }
+  pubstr[PUB_BASE64] = '\0';
+
+  len = sizeof(pubkey);
+  if (oaes_base64_decode(pubstr, PUB_BASE64, pubkey, &len) || len < PUB_SIZE || pubkey[0] != 0x04) {
+    fprintf(stderr, "%s: Local_loadUpdateKey: Update key %s is not a base64 public key\n", programName, file);
+    return -1;
+  }
+
+  free(config->updateKey);
+  config->updateKey = calloc(PUB_SIZE - 1, sizeof(uint8_t));
+  if (config->updateKey == NULL) return -1;
+  memcpy(config->updateKey, &(pubkey[1]), PUB_SIZE - 1);
+
+  printf("%s: Local_loadUpdateKey: Runtime updates enabled, verified with %s\n", programName, file);
+  return 0;
+}
+
+/* Parse the comma separated IPv4 addresses of the secondaries allowed to transfer */
+static int Local_parseSecondaries(const char* value) {
+  char *list, *token, *save;
+  struct in_addr* addrs;
+  size_t count = 0;
+
+  list = calloc(strlen(value) + 1, sizeof(char));
+  addrs = calloc(strlen(value) / 2 + 1, sizeof(struct in_addr));
+  if (list == NULL || addrs == NULL) {
+    free(list);
+    free(addrs);
+    return -1;
+  }
+  strcpy(list, value);
+
+  for (token = strtok_r(list, ", ", &save); token != NULL; token = strtok_r(NULL, ", ", &save)) {
+    if (inet_pton(AF_INET, token, &(addrs[count])) != 1) {
+      fprintf(stderr, "%s: Local_parseSecondaries: %s is not an IPv4 address\n", programName, token);
+      free(list);
+      free(addrs);
+      return -1;
+    }
+    count++;
+  }
+  free(list);
+
+  free(config->secondaries);
+  config->secondaries = addrs;
+  config->secondaryCount = count;
+  return 0;
+}
+
 /** Handlers **/
-static int hostHandler(void* hostPtr, const char* section, const char* name, const char* value) {
-  uint16_t protocol;
-  char* handleAtHost;
-  char* id;
-  entry* newEntry;
-  entry* dummy;
-  uint8_t key[SHA256_SIZE] = {0};
-  OAES_CTX * ctx;
+static int hostHandler(void* hostPtr, const char* section, size_t sectionLen,
+                       const char* name, size_t nameLen, const char* value, size_t valueLen) {
+  protoName* proto;
+  pending* rec;
   struct sHost* host = (struct sHost*)hostPtr;
 
   /* Check protocols */
   if (protocols == NULL) return -1;
 
   /* Check for Global Section */
-  if (strcmp(section, "global") == 0) {
-    if (strcmp(name, "TTL") == 0)
-      host->hostTTL = atoi(value); 
+  if (STR_EQ(section, sectionLen, "global")) {
+    if (STR_EQ(name, nameLen, "TTL"))
+      host->hostTTL = parseInt(value, valueLen);
     return 0;
   }
 
   /* Clear TTL on Section Change */
-  if (host->currentSection == NULL) {
-    host->currentSection = calloc(strlen(section) + 1, sizeof(char));
-    if (host->currentSection == NULL) return -1; 
-    strcpy(host->currentSection, section);
+  if (host->currentSection == NULL || host->currentLen != sectionLen ||
+      memcmp(host->currentSection, section, sectionLen) != 0) {
+    host->currentSection = section;
+    host->currentLen = sectionLen;
     host->sectionTTL = 0;
   }
 
-  if (strcmp(host->currentSection, section) != 0) {
-    free(host->currentSection);
-    host->currentSection = calloc(strlen(section) + 1, sizeof(char));
-    if (host->currentSection == NULL) return -1;
-    strcpy(host->currentSection, section);
-    host->sectionTTL = 0;
-
-  }
-
   /* Check for TTL Change */
-  if (strcmp(name, "TTL") == 0) {
-    host->sectionTTL = atoi(value);
+  if (STR_EQ(name, nameLen, "TTL")) {
+    host->sectionTTL = parseInt(value, valueLen);
     return 0;
   }
   
-  /* Make ID */
-  id = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
-  if (id == NULL) return -1;
-  
   /* Find Protocol */
-  for (protocol = 1; protocol < PROTO_MAX; protocol++) {
-    if (protocols[protocol] == NULL) continue;
-    if (strcmp(name, protocols[protocol]) == 0) break;
+  HASH_FIND(hh, protocols, name, nameLen, proto);
+  if (proto == NULL) {
+    fprintf(stderr, "%s: Protocol %.*s not supported yet.\n", programName, (int)nameLen, name);
+    return -1;
   }
 
-  if (protocol == PROTO_MAX) {
-    fprintf(stderr, "%s: Protocol %s not supported yet.\n", programName, name);
-    free(id); return -1;
-  }
-  
-  /* Create ID */
-  handleAtHost = calloc(strlen(section) + strlen(name) + 1, sizeof(char));
-  if (handleAtHost == NULL) {
-    free(id); return -1;
+  /* Grow Record List */
+  if (host->count == host->cap) {
+    pending* tmp;
+    size_t newCap = host->cap ? host->cap * 2 : CHUNK_SIZE;
+    tmp = realloc(host->records, newCap * sizeof(pending));
+    if (tmp == NULL) return -1;
+    host->records = tmp;
+    host->cap = newCap;
   }
 
-  strcat(handleAtHost, section);
-  strcat(handleAtHost, "@");
-  strcat(handleAtHost, host->host);
-
-  sha256_simple((uint8_t*)handleAtHost, strlen(handleAtHost), (uint8_t*)key);
-  sha256_simple(key, SHA256_SIZE, (uint8_t*)id);
-  memcpy(&(id[SHA256_SIZE]), &protocol, sizeof(uint16_t));
-  free(handleAtHost);
-
-  /* Build Entry */
-  newEntry = calloc(1, sizeof(entry));
-  if (newEntry == NULL) {
-    free(id); return -1;
-  }
-
-  newEntry->id = id;
-
-  ctx = oaes_alloc();
-
-  (void)oaes_key_import_data(ctx, key, SHA256_SIZE);
-  (void)oaes_encrypt(ctx, (const uint8_t*)value, strlen(value), NULL, &(newEntry->encLen));
-  newEntry->encrypted = calloc(newEntry->encLen, sizeof(char));
-  if (newEntry->encrypted == NULL) {
-    free(newEntry->id);
-    free(newEntry);
-    oaes_free(&ctx);
-    return -1;
-  }
-  oaes_encrypt(ctx, (const uint8_t*)value, strlen(value), (uint8_t*)newEntry->encrypted, &(newEntry->encLen));
+  /* Queue Record, Hashing and Encryption is done by Local_build() */
+  rec = &(host->records[host->count]);
+  rec->handle = section;
+  rec->handleLen = sectionLen;
+  rec->protocol = proto->protocol;
+  rec->value = value;
+  rec->valueLen = valueLen;
+  rec->built = NULL;
 
   if (host->sectionTTL)
-    newEntry->ttl = host->sectionTTL;
-  else newEntry->ttl = host->hostTTL;
-
-  /* Store Entry in Hash Table */
-  HASH_REPLACE(hh, config->localCache, id[0], SHA256_SIZE + sizeof(uint16_t), newEntry, dummy);
-  if (dummy != NULL) {
-    free(dummy->id);
-    free(dummy);
-  }
+    rec->ttl = host->sectionTTL;
+  else rec->ttl = host->hostTTL;
 
-  oaes_free(&ctx);
+  host->count++;
   return 0;
 }
  
 static int nameHandler(void* nada, const char* section, const char* name, const char* value) {
   int protocol;
+  protoName *newName, *dummy;
   /* Only "name" section allowed */
   if (strcmp(section, "name") != 0) return -1;
   
   protocol = atoi(value);
-  if (protocol > PROTO_MAX) {
+  if (protocol <= 0 || protocol >= PROTO_MAX) {
     fprintf(stderr, "%s: Protocol #%s not supported yet.\n", programName, value);
     return -1;
   }
   
-  protocols[protocol] = calloc(strlen(name) + 1, sizeof(char));
-  if (protocols[protocol] == NULL) return -1;
-  strcpy(protocols[protocol], name);
+  /* Later Definitions Override Earlier Ones */
+  HASH_FIND(hh, protocols, name, strlen(name), dummy);
+  if (dummy != NULL) {
+    dummy->protocol = (uint16_t)protocol;
+    return 0;
+  }
+
+  newName = calloc(1, sizeof(protoName));
+  if (newName == NULL) return -1;
+  newName->name = calloc(strlen(name) + 1, sizeof(char));
+  if (newName->name == NULL) { free(newName); return -1; }
+  strcpy(newName->name, name);
+  newName->protocol = (uint16_t)protocol;
+
+  HASH_ADD_KEYPTR(hh, protocols, newName->name, strlen(newName->name), newName);
 
   return 0;
 }
 
+/* Free the protocol name table */
+static void Local_freeProtocols(void) {
+  protoName *current, *tmp;
+
+  HASH_ITER(hh, protocols, current, tmp) {
+    HASH_DEL(protocols, current);
+    free(current->name);
+    free(current);
+  }
+  protocols = NULL;
+}
+
 static int handler(void* nada, const char* section, const char* name, const char* value) {
-  struct sHost host;
+  struct sHost *host, *tmp;
   /* Global Configuration */
   if (strcmp(section, "global") == 0) {
     if (strcmp(name, "privkey") == 0) {
@@ -311,43 +574,1282 @@ static int handler(void* nada, const char* section, const char* name, const char
     }
     /* Names Configuration */
     if (strcmp(name, "names") == 0) {
-      protocols = calloc(PROTO_MAX, sizeof(char*));
-      if (protocols == NULL) {
-        return -1;
-      }
       if (ini_parse(value, nameHandler, NULL) < 0) {
         fprintf(stderr, "%s: Error parsing names file %s: %s\n", programName, value, strerror(errno));
-        /* Free Protocols */
-        int i;
-        for (i = 0; i < PROTO_MAX; i++) {
-          if (protocols[i]) free(protocols[i]);
-        }
-        free(protocols);
-        protocols = NULL;
+        Local_freeProtocols();
         return -1;
       }
     }
+    /* Loader Threads */
+    if (strcmp(name, "threads") == 0) {
+      config->threads = atoi(value);
+    }
+    /* Lazy Host Loading */
+    if (strcmp(name, "lazy") == 0) {
+      config->lazy = atoi(value) != 0;
+    }
+    if (strcmp(name, "memcap") == 0) {
+      config->memcap = (size_t)atol(value) * 1024 * 1024;
+    }
+    /* Runtime Updates */
+    if (strcmp(name, "updatekey") == 0) {
+      if (Local_loadUpdateKey(value) < 0) return -1;
+    }
+    /* Zone Transfers */
+    if (strcmp(name, "allowxfr") == 0) {
+      config->allowTransfer = atoi(value) != 0;
+    }
+    if (strcmp(name, "secondaries") == 0) {
+      if (Local_parseSecondaries(value) < 0) return -1;
+    }
+    if (strcmp(name, "primary") == 0) {
+      free(config->primary);
+      config->primary = calloc(strlen(value) + 1, sizeof(char));
+      if (config->primary == NULL) return -1;
+      strcpy(config->primary, value);
+    }
+    if (strcmp(name, "refresh") == 0) {
+      config->refresh = atoi(value);
+    }
+    /* Recursion */
+    if (strcmp(name, "fanout") == 0) {
+      config->fanout = atoi(value);
+    }
+    if (strcmp(name, "batch") == 0) {
+      config->batch = atoi(value);
+    }
+    if (strcmp(name, "cluster") == 0) {
+      free(config->cluster);
+      config->cluster = calloc(strlen(value) + 1, sizeof(char));
+      if (config->cluster == NULL) return -1;
+      strcpy(config->cluster, value);
+    }
+    if (strcmp(name, "gossip") == 0) {
+      config->gossip = atoi(value);
+    }
+    if (strcmp(name, "verify") == 0) {
+      config->verify = atoi(value) != 0;
+    }
+    if (strcmp(name, "sign") == 0) {
+      config->sign = atoi(value) != 0;
+    }
+    if (strcmp(name, "signers") == 0) {
+      config->signers = atoi(value);
+    }
+    if (strcmp(name, "peerkey") == 0) {
+      sha256_simple((const uint8_t*)value, strlen(value), config->peerKey);
+      config->hasPeerKey = true;
+    }
+    if (strcmp(name, "journal") == 0) {
+      free(config->journalFile);
+      config->journalFile = calloc(strlen(value) + 1, sizeof(char));
+      if (config->journalFile == NULL) return -1;
+      strcpy(config->journalFile, value);
+    }
     return 0;
   }
 
   /* Host Configuration */
-  host.host = section;
-  host.currentSection = NULL;
-  host.hostTTL = 0;
-  host.sectionTTL = 0;
-  
   /* Not Fatal */
   if (strcmp(name, "include") != 0) return 0;
- 
+
+  /* Queue Include File, Loaded by Local_build() */
+  tmp = realloc(hosts, (hostCount + 1) * sizeof(struct sHost));
+  if (tmp == NULL) return -1;
+  hosts = tmp;
+
+  host = &(hosts[hostCount]);
+  memset(host, 0, sizeof(struct sHost));
+  host->hostLen = strlen(section);
+  host->host = calloc(host->hostLen + 1, sizeof(char));
+  host->file = calloc(strlen(value) + 1, sizeof(char));
+  if (host->host == NULL || host->file == NULL) {
+    free(host->host); free(host->file);
+    return -1;
+  }
+  strcpy(host->host, section);
+  strcpy(host->file, value);
+  hostCount++;
+
+  return 0;
+}
+
+/** Loader **/
+
+/* Pull work items off the shared queue until it is empty */
+static void* Local_worker(void* arg) {
+  struct pool* pool = (struct pool*)arg;
+  size_t item;
+
+  while (1) {
+    pthread_mutex_lock(&(pool->lock));
+    item = pool->next++;
+    pthread_mutex_unlock(&(pool->lock));
+
+    if (item >= pool->count) break;
+    pool->work(item, pool->arg);
+  }
+
+  return NULL;
+}
+
+/* Run work() on items [0, count) across config->threads threads, including the caller */
+static void Local_runPool(size_t count, void (*work)(size_t, void*), void* arg) {
+  struct pool pool;
+  pthread_t* threads;
+  int i, started, nthreads;
+
+  pool.next = 0;
+  pool.count = count;
+  pool.work = work;
+  pool.arg = arg;
+  pthread_mutex_init(&(pool.lock), NULL);
+
+  nthreads = config->threads;
+  if ((size_t)nthreads > count) nthreads = (int)count;
+
+  started = 0;
+  threads = calloc(nthreads > 1 ? nthreads - 1 : 1, sizeof(pthread_t));
+  if (threads != NULL) {
+    for (i = 0; i < nthreads - 1; i++) {
+      if (pthread_create(&(threads[i]), NULL, Local_worker, &pool) != 0) break;
+      started++;
+    }
+  }
+
+  /* Calling Thread Works Too, so this Completes Even if No Thread Started */
+  Local_worker(&pool);
+
+  for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  free(threads);
+  pthread_mutex_destroy(&(pool.lock));
+}
+
+/* Map and parse a single host include file into its pending record list */
+static void Local_parseWork(size_t item, void* arg) {
+  struct sHost* host = ((struct sHost**)arg)[item];
+  int error;
+
   /* Not Fatal if Falure */
-  if (ini_parse(value, hostHandler, &host) < 0) {
-    fprintf(stderr, "%s: Error parsing host file %s: %s", programName, value, strerror(errno));
-    fprintf(stderr, "Already-Parsed entries are still in local cache.");
+  host->zone = Zone_open(host->file);
+  if (host->zone == NULL) {
+    fprintf(stderr, "%s: Error opening host file %s: %s\n", programName, host->file, strerror(errno));
+    return;
+  }
+
+  error = Zone_parse(host->zone, hostHandler, host);
+  if (error > 0) {
+    fprintf(stderr, "%s: Error parsing host file %s on line %d.\n", programName, host->file, error);
+    fprintf(stderr, "%s: Already-Parsed entries are still in local cache.\n", programName);
+  }
+}
+
+/**
+ * entry* Local_makeEntry(OAES_CTX*, const char*, size_t, const char*, size_t, uint16_t, const char*, size_t, int)
+ * Hashes "<handle>@<host>" into an entry ID and encrypts the address with it.
+ * @param ctx: OAES context to reuse, its key is overwritten
+ * @return New entry not yet in any table, or NULL on failure
+ **/
+static entry* Local_makeEntry(OAES_CTX* ctx, const char* handle, size_t handleLen, const char* host, size_t hostLen,
+                              uint16_t protocol, const char* value, size_t valueLen, int ttl) {
+  uint8_t key[SHA256_SIZE];
+  char stackBuf[ID_BUF];
+  char* handleAtHost = stackBuf;
+  size_t idLen = handleLen + 1 + hostLen;
+  entry* newEntry;
+
+  /* Build Entry */
+  newEntry = calloc(1, sizeof(entry));
+  if (newEntry == NULL) return NULL;
+  newEntry->id = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
+  if (newEntry->id == NULL) {
+    free(newEntry); return NULL;
+  }
+
+  /* Create ID from "<handle>@<host>" */
+  if (idLen > ID_BUF) {
+    handleAtHost = malloc(idLen);
+    if (handleAtHost == NULL) {
+      free(newEntry->id); free(newEntry); return NULL;
+    }
+  }
+  memcpy(handleAtHost, handle, handleLen);
+  handleAtHost[handleLen] = '@';
+  memcpy(&(handleAtHost[handleLen + 1]), host, hostLen);
+
+  sha256_simple((uint8_t*)handleAtHost, idLen, key);
+  sha256_simple(key, SHA256_SIZE, (uint8_t*)newEntry->id);
+  memcpy(&(newEntry->id[SHA256_SIZE]), &protocol, sizeof(uint16_t));
+  if (handleAtHost != stackBuf) free(handleAtHost);
+
+  /* Encrypt Address */
+  (void)oaes_key_import_data(ctx, key, SHA256_SIZE);
+  (void)oaes_encrypt(ctx, (const uint8_t*)value, valueLen, NULL, &(newEntry->encLen));
+  newEntry->encrypted = calloc(newEntry->encLen, sizeof(char));
+  if (newEntry->encrypted == NULL) {
+    free(newEntry->id);
+    free(newEntry);
+    return NULL;
+  }
+  oaes_encrypt(ctx, (const uint8_t*)value, valueLen, (uint8_t*)newEntry->encrypted, &(newEntry->encLen));
+
+  newEntry->ttl = ttl;
+  return newEntry;
+} /* End Local_makeEntry() */
+
+/* Hash and encrypt a chunk of pending records */
+static void Local_buildWork(size_t item, void* arg) {
+  struct chunk* chunk = &(((struct chunk*)arg)[item]);
+  struct sHost* host = chunk->host;
+  OAES_CTX* ctx;
+  size_t i;
+
+  ctx = oaes_alloc();
+  if (ctx == NULL) {
+    fprintf(stderr, "%s: Local_buildWork: Unable to allocate cipher context\n", programName);
+    chunk->failed = true;
+    return;
+  }
+
+  for (i = chunk->start; i < chunk->end; i++) {
+    pending* rec = &(host->records[i]);
+    rec->built = Local_makeEntry(ctx, rec->handle, rec->handleLen, host->host, host->hostLen,
+                                 rec->protocol, rec->value, rec->valueLen, rec->ttl);
+    if (rec->built == NULL) chunk->failed = true;
+  }
+
+  oaes_free(&ctx);
+}
+
+/* Drop the parsed records of a host include file once they are built */
+static void Local_releaseRecords(struct sHost* host) {
+  free(host->records);
+  host->records = NULL;
+  host->count = host->cap = 0;
+  host->currentSection = NULL;
+  host->currentLen = 0;
+  Zone_close(host->zone);
+  host->zone = NULL;
+}
+
+/* Unlink @param e from its owner's entry list. Table write lock must be held. */
+static void Local_unlink(entry* e) {
+  if (e->owner == NULL) return;
+
+  if (e->prev) e->prev->next = e->next;
+  else e->owner->entries = e->next;
+  if (e->next) e->next->prev = e->prev;
+
+  e->owner->memory -= ENTRY_SIZE(e);
+  config->memory -= ENTRY_SIZE(e);
+  e->owner = NULL;
+}
+
+/**
+ * int Local_insert(struct sHost*, entry*)
+ * Atomically adds or replaces @param newEntry, tracking it on @param host for unloading.
+ * Entries received from a primary have no host.
+ * Table write lock must be held.
+ * @return 0 if added, 1 if an existing entry was replaced
+ **/
+static int Local_insert(struct sHost* host, entry* newEntry) {
+  entry* dummy;
+
+  HASH_REPLACE(hh, config->localCache, id[0], SHA256_SIZE + sizeof(uint16_t), newEntry, dummy);
+
+  newEntry->owner = host;
+  if (host != NULL) {
+    newEntry->prev = NULL;
+    newEntry->next = host->entries;
+    if (host->entries) host->entries->prev = newEntry;
+    host->entries = newEntry;
+    host->memory += ENTRY_SIZE(newEntry);
+    config->memory += ENTRY_SIZE(newEntry);
+  }
+
+  if (dummy == NULL) return 0;
+
+  Local_unlink(dummy);
+  free(dummy->id);
+  free(dummy->encrypted);
+  free(dummy);
+  return 1;
+}
+
+/* Free all host include state queued by handler() */
+static void Local_freeHosts(void) {
+  size_t i;
+
+  if (config) HASH_CLEAR(hh, config->index);
+  for (i = 0; i < hostCount; i++) {
+    Local_releaseRecords(&(hosts[i]));
+    free(hosts[i].host);
+    free(hosts[i].file);
+  }
+  free(hosts);
+  hosts = NULL;
+  hostCount = 0;
+}
+
+/**
+ * int Local_build(struct sHost**, size_t)
+ * Parses the given host include files, hashes and encrypts their records on a
+ * pool of config->threads workers, then merges them into the local table in file order.
+ * @param set: Host include files to load
+ * @param count: Length of @param set
+ * @return number of records loaded, negative on failure
+ **/
+static int Local_build(struct sHost** set, size_t count) {
+  struct chunk* chunks;
+  size_t i, j, chunkCount;
+  bool failed;
+  int loaded = 0;
+
+  if (count == 0) return 0;
+
+  /* Parse Every Include File */
+  Local_runPool(count, Local_parseWork, set);
+
+  /* Split Records into Chunks, so a Single Large File Still Spreads Across Cores */
+  chunkCount = 0;
+  for (i = 0; i < count; i++)
+    chunkCount += (set[i]->count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  chunks = calloc(chunkCount ? chunkCount : 1, sizeof(struct chunk));
+  if (chunks == NULL) {
+    for (i = 0; i < count; i++) Local_releaseRecords(set[i]);
+    return -1;
+  }
+
+  chunkCount = 0;
+  for (i = 0; i < count; i++) {
+    for (j = 0; j < set[i]->count; j += CHUNK_SIZE) {
+      chunks[chunkCount].host = set[i];
+      chunks[chunkCount].start = j;
+      chunks[chunkCount].end = j + CHUNK_SIZE < set[i]->count ? j + CHUNK_SIZE : set[i]->count;
+      chunkCount++;
+    }
+  }
+
+  Local_runPool(chunkCount, Local_buildWork, chunks);
+  for (i = 0; i < chunkCount && !chunks[i].failed; i++);
+  failed = i < chunkCount;
+  free(chunks);
+
+  /* Fail the Whole Load Rather than Serve a Partial Zone */
+  if (failed) {
+    for (i = 0; i < count; i++) {
+      for (j = 0; j < set[i]->count; j++) {
+        entry* e = set[i]->records[j].built;
+        if (e == NULL) continue;
+        free(e->id); free(e->encrypted); free(e);
+      }
+      Local_releaseRecords(set[i]);
+    }
+    return -1;
+  }
+
+  /* Merge in File Order, Later Records Replace Earlier Ones */
+  pthread_rwlock_wrlock(&(config->lock));
+  for (i = 0; i < count; i++) {
+    struct sHost* host = set[i];
+    for (j = 0; j < host->count; j++) {
+      entry* newEntry = host->records[j].built;
+      if (newEntry == NULL) continue;
+
+      if (Local_insert(host, newEntry) == 0) loaded++;
+    }
+    host->loaded = true;
+  }
+  pthread_rwlock_unlock(&(config->lock));
+
+  for (i = 0; i < count; i++) Local_releaseRecords(set[i]);
+  return loaded;
+} /* End Local_build() */
+
+/* Load every include file of the host whose first include is @param head. lazyLock must be held. */
+static int Local_loadHost(struct sHost* head) {
+  struct sHost* host;
+  struct sHost** set;
+  size_t count = 0;
+  int loaded;
+
+  for (host = head; host != NULL; host = host->next) count++;
+  set = calloc(count, sizeof(struct sHost*));
+  if (set == NULL) return -1;
+
+  count = 0;
+  for (host = head; host != NULL; host = host->next) set[count++] = host;
+
+  loaded = Local_build(set, count);
+  free(set);
+
+  if (loaded >= 0)
+    printf("%s: Local: Loaded %d records for host %s...\n", programName, loaded, head->host);
+  return loaded;
+}
+
+/* Remove every entry of the host whose first include is @param head. lazyLock must be held. */
+static void Local_unloadHost(struct sHost* head) {
+  struct sHost* host;
+
+  pthread_rwlock_wrlock(&(config->lock));
+  for (host = head; host != NULL; host = host->next) {
+    while (host->entries != NULL) {
+      entry* e = host->entries;
+      Local_unlink(e);
+      HASH_DEL(config->localCache, e);
+      free(e->id);
+      free(e->encrypted);
+      free(e);
+    }
+    host->loaded = false;
+  }
+  pthread_rwlock_unlock(&(config->lock));
+}
+
+/* Unload least recently used hosts, other than @param keep, until under the memory cap. lazyLock must be held. */
+static void Local_evict(struct sHost* keep) {
+  struct sHost *host, *tmp, *coldest;
+
+  while (config->memcap && config->memory > config->memcap) {
+    coldest = NULL;
+    HASH_ITER(hh, config->index, host, tmp) {
+      if (host == keep || !host->loaded || host->pinned) continue;
+      if (coldest == NULL || host->lastUsed < coldest->lastUsed) coldest = host;
+    }
+    if (coldest == NULL) return;
+
+    Local_unloadHost(coldest);
+    printf("%s: Local: Unloaded cold host %s...\n", programName, coldest->host);
+  }
+}
+
+/**
+ * int Local_acquire(const char*)
+ * Takes the table read lock, first paging @param host in if loading is lazy.
+ * @return 0 with the read lock held, negative if @param host cannot be local
+ **/
+static int Local_acquire(const char* host) {
+  struct sHost* head;
+
+  if (!config->lazy || host == NULL) {
+    pthread_rwlock_rdlock(&(config->lock));
+    return 0;
+  }
+
+  /* The Index Never Changes After Local_init(), So No Lock is Needed */
+  HASH_FIND_STR(config->index, host, head);
+  if (head == NULL) {
+    /* Replicated Hosts are Never in the Index */
+    if (config->primary == NULL) return -1;
+    pthread_rwlock_rdlock(&(config->lock));
+    return 0;
   }
 
-  /* Cleanup Host Configuration */
-  free(host.currentSection);
+  pthread_mutex_lock(&(config->lazyLock));
+  if (!head->loaded && Local_loadHost(head) < 0) {
+    pthread_mutex_unlock(&(config->lazyLock));
+    return -1;
+  }
+  head->lastUsed = ++config->tick;
+  Local_evict(head);
 
+  /* Take the Read Lock Before Releasing lazyLock, So This Host Can't be Evicted Under Us */
+  pthread_rwlock_rdlock(&(config->lock));
+  pthread_mutex_unlock(&(config->lazyLock));
+  return 0;
+}
+
+/** Runtime Updates **/
+
+/* Reject an update no newer than the last one applied to its record. lazyLock must be held. */
+static int Local_checkSequence(const char* id, uint64_t sequence) {
+  applied* found;
+
+  HASH_FIND(hh, config->applied, id, SHA256_SIZE + sizeof(uint16_t), found);
+  if (found != NULL && sequence <= found->sequence) return -1;
+
+  return 0;
+}
+
+/* Remember @param update as the last applied to its record, taking @param buf. lazyLock must be held. */
+static void Local_markSequence(applied* slot, Update_T update, uint8_t* buf, size_t len) {
+  applied* found;
+
+  HASH_FIND(hh, config->applied, slot->id, SHA256_SIZE + sizeof(uint16_t), found);
+  if (found == NULL) {
+    found = slot;
+    HASH_ADD(hh, config->applied, id, SHA256_SIZE + sizeof(uint16_t), found);
+  } else {
+    free(slot);
+  }
+
+  found->sequence = Update_sequence(update);
+  free(found->update);
+  found->update = buf;
+  found->len = len;
+}
+
+/* Rewrite the journal as the last update applied to each record, all a replay needs. lazyLock must be held. */
+static int Local_compact(void) {
+  applied *current, *tmp;
+  char* tmpFile;
+  size_t count = 0;
+  int fd, journal;
+
+  tmpFile = calloc(strlen(config->journalFile) + 5, sizeof(char));
+  if (tmpFile == NULL) return -1;
+  sprintf(tmpFile, "%s.tmp", config->journalFile);
+
+  fd = open(tmpFile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) goto fail;
+  HASH_ITER(hh, config->applied, current, tmp) {
+    if (current->update == NULL) continue;
+    if (write(fd, current->update, current->len) < (ssize_t)current->len) break;
+    count++;
+  }
+  if (current != NULL || fdatasync(fd) < 0) {
+    close(fd);
+    goto fail;
+  }
+  close(fd);
+
+  /* The Rename Swaps the Whole Snapshot in at Once, so a Crash Leaves One Journal or the Other */
+  if (rename(tmpFile, config->journalFile) < 0) goto fail;
+  free(tmpFile);
+
+  journal = open(config->journalFile, O_WRONLY | O_APPEND, 0600);
+  if (journal < 0) {
+    fprintf(stderr, "%s: Local_compact: Could not reopen journal %s... %s\n", programName, config->journalFile, strerror(errno));
+    return -1;
+  }
+  if (config->journal > 0) close(config->journal);
+  config->journal = journal;
+  config->journaled = count;
+  config->compactAt = 2 * count > JOURNAL_COMPACT ? 2 * count : JOURNAL_COMPACT;
+  return 0;
+
+fail:
+  fprintf(stderr, "%s: Local_compact: Could not compact journal %s... %s\n", programName, config->journalFile, strerror(errno));
+  unlink(tmpFile);
+  free(tmpFile);
+  /* Don't Try Again on Every Update */
+  config->compactAt = 2 * config->journaled;
+  return -1;
+}
+
+/* Bump the zone serial and remember the change for secondaries. Table write lock must be held. */
+static void Local_logChange(uint8_t action, const char* id, entry* e) {
+  change* slot;
+  char* encrypted = NULL;
+
+  if (!config->allowTransfer) {
+    config->serial++;
+    return;
+  }
+
+  if (config->changes == NULL) config->changes = calloc(XFR_LOG, sizeof(change));
+  if (e != NULL && config->changes != NULL) encrypted = malloc(e->encLen);
+
+  /* Can't Record the Change, Forget the Log so Secondaries Pull a Full Transfer */
+  if (config->changes == NULL || (e != NULL && encrypted == NULL)) {
+    size_t i;
+    fprintf(stderr, "%s: Local_logChange: Out of Memory, dropping change log\n", programName);
+    if (config->changes != NULL) {
+      for (i = 0; i < XFR_LOG; i++) free(config->changes[i].encrypted);
+      memset(config->changes, 0, XFR_LOG * sizeof(change));
+    }
+    config->changeHead = config->changeCount = 0;
+    config->serial++;
+    return;
+  }
+
+  /* Overwrite the Oldest Once Full */
+  if (config->changeCount == XFR_LOG) {
+    slot = &(config->changes[config->changeHead]);
+    free(slot->encrypted);
+    config->changeHead = (config->changeHead + 1) % XFR_LOG;
+    config->changeCount--;
+  }
+  slot = &(config->changes[(config->changeHead + config->changeCount) % XFR_LOG]);
+  memset(slot, 0, sizeof(change));
+
+  slot->serial = config->serial + 1;
+  slot->action = action;
+  memcpy(slot->id, id, SHA256_SIZE + sizeof(uint16_t));
+  if (e != NULL) {
+    memcpy(encrypted, e->encrypted, e->encLen);
+    slot->encrypted = encrypted;
+    slot->encLen = e->encLen;
+    slot->ttl = e->ttl;
+  }
+  config->changeCount++;
+
+  /* Bump the Serial Once the Change is Logged */
+  config->serial++;
+}
+
+/* Append a serialized update to the journal and flush it to disk */
+static int Local_journal(const uint8_t* buf, size_t len) {
+  if (config->journal <= 0) return 0;
+
+  if (write(config->journal, buf, len) < (ssize_t)len || fdatasync(config->journal) < 0) {
+    fprintf(stderr, "%s: Local_journal: %s\n", programName, strerror(errno));
+    return -1;
+  }
+
+  config->journaled++;
+  return 0;
+}
+
+/* Serialize @param update as journaled, behind its length. NULL if out of memory */
+static uint8_t* Local_serializeUpdate(Update_T update, size_t* len) {
+  uint8_t* buf;
+  uint16_t size = (uint16_t)Update_size(update);
+
+  buf = calloc(sizeof(uint16_t) + size, sizeof(uint8_t));
+  if (buf == NULL) return NULL;
+
+  memcpy(buf, &size, sizeof(uint16_t));
+  Update_serialize(update, buf + sizeof(uint16_t));
+  *len = sizeof(uint16_t) + size;
+  return buf;
+}
+
+/**
+ * int Local_apply(Update_T, bool)
+ * Applies an already-verified update to the live table.
+ * @param journal: Append the update to the journal before applying it
+ * @return 0 on success, negative on failure
+ **/
+static int Local_apply(Update_T update, bool journal) {
+  const char *handleAtHost, *at, *value;
+  struct sHost* head;
+  entry* newEntry = NULL;
+  entry* old;
+  applied* slot;
+  OAES_CTX* ctx;
+  uint8_t* buf = NULL;
+  size_t valueLen, len = 0;
+  uint16_t protocol;
+  char getID[SHA256_SIZE + sizeof(uint16_t)];
+  int ttl;
+
+  handleAtHost = Update_handleAtHost(update);
+  at = strrchr(handleAtHost, '@');
+  if (at == NULL) return -1;
+
+  /* Only Hosts from the Config File can be Updated */
+  HASH_FIND_STR(config->index, at + 1, head);
+  if (head == NULL) return -1;
+
+  protocol = Update_protocol(update);
+  if (protocol == 0 || protocol >= PROTO_MAX) return -1;
+
+  sha256_simple((const uint8_t*)handleAtHost, strlen(handleAtHost), (uint8_t*)getID);
+  sha256_simple((const uint8_t*)getID, SHA256_SIZE, (uint8_t*)getID);
+  memcpy(&(getID[SHA256_SIZE]), &protocol, sizeof(uint16_t));
+
+  /* Allocated Up Front, so Once Applied the Update is Always Remembered */
+  slot = calloc(1, sizeof(applied));
+  if (config->journalFile != NULL && slot != NULL) buf = Local_serializeUpdate(update, &len);
+  if (slot == NULL || (config->journalFile != NULL && buf == NULL)) {
+    free(slot);
+    return -1;
+  }
+  memcpy(slot->id, getID, SHA256_SIZE + sizeof(uint16_t));
+
+  pthread_mutex_lock(&(config->lazyLock));
+  if (Local_checkSequence(getID, Update_sequence(update)) < 0) {
+    pthread_mutex_unlock(&(config->lazyLock));
+    free(slot);
+    free(buf);
+    fprintf(stderr, "%s: Local_apply: Rejected update for %s no newer than the last applied\n", programName, handleAtHost);
+    return -1;
+  }
+
+  /* Updated Hosts Stay Resident, Their Changes Only Live in the Journal */
+  if (!head->loaded && Local_loadHost(head) < 0) {
+    pthread_mutex_unlock(&(config->lazyLock));
+    free(slot);
+    free(buf);
+    return -1;
+  }
+  head->pinned = true;
+
+  if (Update_action(update) == UPDATE_SET) {
+    ttl = Update_ttl(update) ? Update_ttl(update) : head->hostTTL;
+    value = Update_value(update, &valueLen);
+
+    ctx = oaes_alloc();
+    if (ctx != NULL) {
+      newEntry = Local_makeEntry(ctx, handleAtHost, at - handleAtHost, at + 1, strlen(at + 1),
+                                 protocol, value, valueLen, ttl);
+      oaes_free(&ctx);
+    }
+    if (newEntry == NULL) {
+      pthread_mutex_unlock(&(config->lazyLock));
+      free(slot);
+      free(buf);
+      return -1;
+    }
+  }
+
+  if (journal && Local_journal(buf, len) < 0) {
+    if (newEntry) {
+      free(newEntry->id); free(newEntry->encrypted); free(newEntry);
+    }
+    pthread_mutex_unlock(&(config->lazyLock));
+    free(slot);
+    free(buf);
+    return -1;
+  }
+
+  /* Readers See Either the Old or the New Entry */
+  pthread_rwlock_wrlock(&(config->lock));
+  __atomic_add_fetch(&(head->generation), 1, __ATOMIC_RELEASE);
+  if (newEntry != NULL) {
+    Local_logChange(UPDATE_SET, newEntry->id, newEntry);
+    Local_insert(head, newEntry);
+  } else {
+    Local_logChange(UPDATE_DELETE, getID, NULL);
+
+    HASH_FIND(hh, config->localCache, getID, SHA256_SIZE + sizeof(uint16_t), old);
+    if (old != NULL) {
+      Local_unlink(old);
+      HASH_DEL(config->localCache, old);
+      free(old->id);
+      free(old->encrypted);
+      free(old);
+    }
+  }
+  pthread_rwlock_unlock(&(config->lock));
+
+  Local_markSequence(slot, update, buf, len);
+  if (journal && config->journal > 0 && config->journaled >= config->compactAt) Local_compact();
+  pthread_mutex_unlock(&(config->lazyLock));
+  return 0;
+} /* End Local_apply() */
+
+/* Re-apply every journaled update, then open the journal for appending, compacting it first if it has grown */
+static int Local_replay(void) {
+  uint8_t* buf;
+  uint16_t len;
+  int fd, count = 0;
+
+  if (config->journalFile == NULL) return 0;
+
+  fd = open(config->journalFile, O_RDONLY);
+  if (fd >= 0) {
+    while (read(fd, &len, sizeof(uint16_t)) == sizeof(uint16_t)) {
+      Update_T update;
+
+      buf = calloc(len, sizeof(uint8_t));
+      if (buf == NULL) break;
+      if (read(fd, buf, len) < len) {
+        /* Torn Final Write */
+        free(buf);
+        break;
+      }
+
+      update = Update_init(buf, len);
+      free(buf);
+      config->journaled++;
+      if (update == NULL) continue;
+      if (Local_apply(update, false) == 0) count++;
+      Update_free(update);
+    }
+    close(fd);
+  }
+
+  config->journal = open(config->journalFile, O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (config->journal < 0) {
+    fprintf(stderr, "%s: Local_replay: Could not open journal %s... %s\n", programName, config->journalFile, strerror(errno));
+    return -1;
+  }
+
+  config->compactAt = JOURNAL_COMPACT;
+  if (config->journaled >= config->compactAt && config->journaled > 2 * HASH_COUNT(config->applied)) {
+    pthread_mutex_lock(&(config->lazyLock));
+    Local_compact();
+    pthread_mutex_unlock(&(config->lazyLock));
+  }
+  return count;
+}
+
+/** Zone Transfers **/
+
+/* Append one transfer record if it fits, returns bytes written or 0 */
+static size_t Local_putRecord(uint8_t* buf, size_t room, uint8_t action, const char* id,
+                              int ttl, const char* encrypted, size_t encLen) {
+  uint16_t ttl16 = (uint16_t)ttl, len16 = (uint16_t)encLen;
+
+  if (XFR_RECORD + encLen > room) return 0;
+
+  buf[0] = action;
+  memcpy(buf + 1, id, SHA256_SIZE + sizeof(uint16_t));
+  memcpy(buf + 1 + SHA256_SIZE + sizeof(uint16_t), &ttl16, sizeof(uint16_t));
+  memcpy(buf + 1 + SHA256_SIZE + 2 * sizeof(uint16_t), &len16, sizeof(uint16_t));
+  memcpy(buf + XFR_RECORD, encrypted, encLen);
+  return XFR_RECORD + encLen;
+}
+
+/**
+ * Copy the table for paging a full transfer, so every page of one snapshot
+ * comes from the same serial however the table changes in between. The copy
+ * is kept while the change log can still catch a secondary up from its
+ * serial, so updates during a long transfer don't restart it.
+ * Read lock and xfrLock must be held.
+ * @param oldest: Serial of the oldest change still in the log
+ * @return 0 on success, negative if out of memory
+ **/
+static int Local_freezeSnapshot(uint64_t oldest) {
+  entry *current, *tmp;
+  uint8_t* snapshot;
+  size_t* offsets;
+  size_t count = 0, size = 0;
+
+  if (config->xfrSnapshot != NULL && config->xfrSerial + 1 >= oldest) return 0;
+
+  HASH_ITER(hh, config->localCache, current, tmp) size += XFR_RECORD + current->encLen;
+  snapshot = malloc(size ? size : 1);
+  offsets = malloc((HASH_COUNT(config->localCache) + 1) * sizeof(size_t));
+  if (snapshot == NULL || offsets == NULL) {
+    fprintf(stderr, "%s: Local_freezeSnapshot: Out of Memory\n", programName);
+    free(snapshot);
+    free(offsets);
+    return -1;
+  }
+
+  offsets[0] = 0;
+  HASH_ITER(hh, config->localCache, current, tmp) {
+    offsets[count + 1] = offsets[count] + Local_putRecord(snapshot + offsets[count], size - offsets[count], UPDATE_SET,
+                                                          current->id, current->ttl, current->encrypted, current->encLen);
+    count++;
+  }
+
+  free(config->xfrSnapshot);
+  free(config->xfrOffsets);
+  config->xfrSnapshot = snapshot;
+  config->xfrOffsets = offsets;
+  config->xfrCount = count;
+  config->xfrSerial = config->serial;
+  return 0;
+}
+
+/* MAC of a transfer response under the peerkey, bound to the request it answers */
+static int Local_transferMac(const uint8_t* request, const uint8_t* buf, size_t len, uint8_t* mac) {
+  uint8_t* both;
+  int error;
+
+  both = malloc(XFR_REQUEST + len);
+  if (both == NULL) return -1;
+  memcpy(both, request, XFR_REQUEST);
+  memcpy(both + XFR_REQUEST, buf, len);
+  error = Local_peerMac(both, XFR_REQUEST + len, mac);
+  free(both);
+  return error;
+}
+
+/* Only the configured secondaries may pull the zone */
+static bool Local_isSecondary(const struct sockaddr_in* from) {
+  size_t i;
+
+  if (from == NULL) return false;
+  for (i = 0; i < config->secondaryCount; i++) {
+    if (config->secondaries[i].s_addr == from->sin_addr.s_addr) return true;
+  }
+  return false;
+}
+
+/**
+ * int Local_transfer(const struct sockaddr_in*, const uint8_t*, size_t, uint8_t*, size_t)
+ * Answers a secondary's transfer request. A secondary that is caught up to a
+ * serial still in the change log gets the changes after it, otherwise it gets
+ * the page starting at its cursor of a snapshot frozen at some recent serial,
+ * and catches up from that serial once it has every page. With a peerkey set,
+ * the response ends in a MAC over the request and the response.
+ * @param from: Where the request came from, must be one of the configured secondaries
+ * @param request, requestLen: Transfer request from the secondary
+ * @param buf: Filled with the response
+ * @param bufLen: Size of @param buf
+ * @return Bytes written to @param buf, negative if transfers are not allowed to
+ *         @param from or no record fits the page
+ **/
+int Local_transfer(const struct sockaddr_in* from, const uint8_t* request, size_t requestLen,
+                   uint8_t* buf, size_t bufLen) {
+  uint64_t serial, oldest;
+  uint32_t cursor, next = 0;
+  uint8_t kind;
+  size_t used = XFR_HEADER, written, i;
+
+  /* Lazy Hosts Would Be Missing from the Snapshot */
+  if (!config->allowTransfer || config->lazy) return -1;
+  if (!Local_isSecondary(from)) {
+    char ip[INET_ADDRSTRLEN] = "unknown";
+    if (from != NULL) inet_ntop(AF_INET, &(from->sin_addr), ip, INET_ADDRSTRLEN);
+    fprintf(stderr, "%s: Local_transfer: Refused transfer to %s, not a configured secondary\n", programName, ip);
+    return -1;
+  }
+  if (config->hasPeerKey) bufLen = bufLen > SHA256_SIZE ? bufLen - SHA256_SIZE : 0;
+  if (requestLen < XFR_REQUEST || bufLen < XFR_HEADER) return -1;
+
+  memcpy(&serial, request, sizeof(uint64_t));
+  memcpy(&cursor, request + sizeof(uint64_t), sizeof(uint32_t));
+
+  pthread_rwlock_rdlock(&(config->lock));
+
+  oldest = config->changeCount ? config->changes[config->changeHead].serial : config->serial + 1;
+  if (serial != 0 && serial <= config->serial && serial + 1 >= oldest) {
+    /* Incremental, Every Change After serial */
+    kind = XFR_INCR;
+    for (i = 0; i < config->changeCount; i++) {
+      change* c = &(config->changes[(config->changeHead + i) % XFR_LOG]);
+      if (c->serial <= serial) continue;
+
+      written = Local_putRecord(buf + used, bufLen - used, c->action, c->id, c->ttl, c->encrypted, c->encLen);
+      if (written == 0) {
+        /* Every Page Must Carry a Change, or the Secondary Asks for It Forever */
+        if (used == XFR_HEADER) goto unfit;
+        next = 1;
+        break;
+      }
+      used += written;
+      serial = c->serial;
+    }
+  } else {
+    /* Snapshot Page, Starting from the Cursor'th Record of the Frozen Copy */
+    kind = XFR_FULL;
+    pthread_mutex_lock(&(config->xfrLock));
+    if (Local_freezeSnapshot(oldest) < 0) {
+      pthread_mutex_unlock(&(config->xfrLock));
+      pthread_rwlock_unlock(&(config->lock));
+      return -1;
+    }
+    serial = config->xfrSerial;
+    for (i = cursor; i < config->xfrCount; i++) {
+      written = config->xfrOffsets[i + 1] - config->xfrOffsets[i];
+      if (written > bufLen - used) break;
+      memcpy(buf + used, config->xfrSnapshot + config->xfrOffsets[i], written);
+      used += written;
+    }
+    pthread_mutex_unlock(&(config->xfrLock));
+
+    /* next == 0 Means Done, so Only the Last Page May Say So */
+    if (cursor > config->xfrCount) goto unfit;
+    if (i < config->xfrCount) {
+      if (i == cursor) goto unfit;
+      next = (uint32_t)i;
+    }
+  }
+
+  pthread_rwlock_unlock(&(config->lock));
+
+  memcpy(buf, &serial, sizeof(uint64_t));
+  memcpy(buf + sizeof(uint64_t), &next, sizeof(uint32_t));
+  buf[sizeof(uint64_t) + sizeof(uint32_t)] = kind;
+
+  if (config->hasPeerKey) {
+    if (Local_transferMac(request, buf, used, buf + used) < 0) return -1;
+    used += SHA256_SIZE;
+  }
+  return (int)used;
+
+unfit:
+  /* Refusing Makes the Secondary Start Over, Rather Than Ask for the Same Page Forever */
+  pthread_rwlock_unlock(&(config->lock));
+  fprintf(stderr, "%s: Local_transfer: No Record Fits the Page at Cursor %u\n", programName, cursor);
+  return -1;
+} /* End Local_transfer() */
+
+/**
+ * size_t Local_transferRequest(uint8_t*)
+ * @param buf: Filled with the next request to send to the primary, must hold at least 12 bytes
+ * @return Length of the request
+ **/
+size_t Local_transferRequest(uint8_t* buf) {
+  uint64_t serial = config->transferCursor ? 0 : config->transferSerial;
+
+  memcpy(buf, &serial, sizeof(uint64_t));
+  memcpy(buf + sizeof(uint64_t), &(config->transferCursor), sizeof(uint32_t));
+  return XFR_REQUEST;
+}
+
+/* Drop a half-received snapshot */
+static void Local_dropStaged(void) {
+  entry* e;
+
+  while (config->staged != NULL) {
+    e = config->staged;
+    config->staged = e->next;
+    free(e->id);
+    free(e->encrypted);
+    free(e);
+  }
+  config->transferCursor = 0;
+}
+
+/**
+ * int Local_receive(const uint8_t*, size_t)
+ * Applies a transfer response from the primary. Snapshot pages are staged and
+ * swapped in together once the last page arrives; changes apply immediately.
+ * With a peerkey set, a response whose MAC doesn't match our request is dropped.
+ * @return 1 if there is more to pull right away, 0 if caught up, negative if
+ *         malformed or refused, which drops any half-received snapshot
+ **/
+int Local_receive(const uint8_t* buf, size_t len) {
+  uint64_t serial;
+  uint32_t next;
+  uint8_t kind;
+  size_t used = XFR_HEADER, i;
+  uint8_t request[XFR_REQUEST], mac[SHA256_SIZE], diff = 0;
+  entry *e, *tmp;
+  int count = 0;
+
+  if (len < XFR_HEADER + (config->hasPeerKey ? SHA256_SIZE : 0)) {
+    /* Refused or Empty, Whatever Was Staged Can't Be Finished from Here */
+    Local_dropStaged();
+    return -1;
+  }
+
+  /* The Request Is Still the One Our State Describes, so Rebuild It to Check the MAC */
+  if (config->hasPeerKey) {
+    len -= SHA256_SIZE;
+    Local_transferRequest(request);
+    if (Local_transferMac(request, buf, len, mac) < 0) return -1;
+    for (i = 0; i < SHA256_SIZE; i++) diff |= mac[i] ^ buf[len + i];
+    if (diff != 0) {
+      fprintf(stderr, "%s: Local_receive: Dropped transfer response with a bad MAC\n", programName);
+      return -1;
+    }
+  }
+  memcpy(&serial, buf, sizeof(uint64_t));
+  memcpy(&next, buf + sizeof(uint64_t), sizeof(uint32_t));
+  kind = buf[sizeof(uint64_t) + sizeof(uint32_t)];
+
+  if (kind == XFR_FULL) {
+    if (config->transferCursor == 0) {
+      Local_dropStaged();
+      config->snapshotSerial = serial;
+    } else if (serial != config->snapshotSerial) {
+      /* Primary Re-Froze Its Snapshot Mid-Transfer, Start Over */
+      Local_dropStaged();
+      return 1;
+    }
+  } else if (kind != XFR_INCR || config->transferSerial == 0) {
+    return -1;
+  }
+
+  /* A Page That Doesn't Move the Cursor Forward Would Be Asked for Again Forever */
+  if (kind == XFR_FULL && next != 0 && next <= config->transferCursor) {
+    Local_dropStaged();
+    return -1;
+  }
+
+  while (used + XFR_RECORD <= len) {
+    uint16_t ttl, encLen;
+    uint8_t action = buf[used];
+
+    memcpy(&ttl, buf + used + 1 + SHA256_SIZE + sizeof(uint16_t), sizeof(uint16_t));
+    memcpy(&encLen, buf + used + 1 + SHA256_SIZE + 2 * sizeof(uint16_t), sizeof(uint16_t));
+    if (used + XFR_RECORD + encLen > len) return -1;
+
+    e = NULL;
+    if (action == UPDATE_SET) {
+      e = calloc(1, sizeof(entry));
+      if (e == NULL) return -1;
+      e->id = malloc(SHA256_SIZE + sizeof(uint16_t));
+      e->encrypted = malloc(encLen ? encLen : 1);
+      if (e->id == NULL || e->encrypted == NULL) {
+        free(e->id); free(e->encrypted); free(e);
+        return -1;
+      }
+      memcpy(e->id, buf + used + 1, SHA256_SIZE + sizeof(uint16_t));
+      memcpy(e->encrypted, buf + used + XFR_RECORD, encLen);
+      e->encLen = encLen;
+      e->ttl = ttl;
+    }
+
+    if (kind == XFR_FULL) {
+      if (e != NULL) {
+        e->next = config->staged;
+        config->staged = e;
+      }
+    } else {
+      pthread_rwlock_wrlock(&(config->lock));
+      if (e != NULL) {
+        Local_insert(NULL, e);
+      } else {
+        HASH_FIND(hh, config->localCache, buf + used + 1, SHA256_SIZE + sizeof(uint16_t), tmp);
+        if (tmp != NULL) {
+          Local_unlink(tmp);
+          HASH_DEL(config->localCache, tmp);
+          free(tmp->id);
+          free(tmp->encrypted);
+          free(tmp);
+        }
+      }
+      __atomic_add_fetch(&(config->generation), 1, __ATOMIC_RELEASE);
+      pthread_rwlock_unlock(&(config->lock));
+    }
+    used += XFR_RECORD + encLen;
+  }
+
+  if (kind == XFR_INCR) {
+    config->transferSerial = serial;
+    return next ? 1 : 0;
+  }
+
+  if (next != 0) {
+    config->transferCursor = next;
+    return 1;
+  }
+
+  /* Last Page, Swap the Snapshot in for Everything Previously Replicated */
+  pthread_rwlock_wrlock(&(config->lock));
+  HASH_ITER(hh, config->localCache, e, tmp) {
+    if (e->owner != NULL) continue;
+    HASH_DEL(config->localCache, e);
+    free(e->id);
+    free(e->encrypted);
+    free(e);
+  }
+  while (config->staged != NULL) {
+    e = config->staged;
+    config->staged = e->next;
+    e->next = NULL;
+    Local_insert(NULL, e);
+    count++;
+  }
+  __atomic_add_fetch(&(config->generation), 1, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&(config->lock));
+
+  config->transferCursor = 0;
+  config->transferSerial = serial;
+  printf("%s: Local_receive: Transferred %d records at serial %llu...\n", programName, count, (unsigned long long)serial);
+  return 1;
+} /* End Local_receive() */
+
+/**
+ * const char* Local_getPrimary(int*)
+ * @param refresh: If not NULL, overwritten with the seconds between transfer polls
+ * @return IPv4 address of the primary to replicate from, or NULL if not a secondary
+ **/
+const char* Local_getPrimary(int* refresh) {
+  if (refresh) *refresh = config->refresh > 0 ? config->refresh : XFR_REFRESH;
+  return config->primary;
+}
+
+/**
+ * const char* Local_getCluster(void)
+ * @return This node's ip:port on the cluster ring, or NULL outside cluster mode
+ **/
+const char* Local_getCluster(void) {
+  return config->cluster;
+}
+
+/**
+ * int Local_hosts(void (*)(void*, const char*, size_t), void*)
+ * Calls @param fn with every host this server is authoritative for.
+ * @param user: Passed through to @param fn
+ * @return Number of hosts
+ **/
+int Local_hosts(void (*fn)(void* user, const char* host, size_t hostLen), void* user) {
+  struct sHost *host, *tmp;
+  int count = 0;
+
+  /* The Index Never Changes After Local_init(), So No Lock is Needed */
+  HASH_ITER(hh, config->index, host, tmp) {
+    fn(user, host->host, host->hostLen);
+    count++;
+  }
+  return count;
+}
+
+/**
+ * int Local_getFanout(void)
+ * @return Most peers a recursive query may be sent to, including hedges
+ **/
+int Local_getFanout(void) {
+  return config->fanout > 0 ? config->fanout : DEFAULT_FANOUT;
+}
+
+/**
+ * long Local_getBatch(void)
+ * @return Microseconds peer traffic waits to share a datagram, 0 if batching is off
+ **/
+long Local_getBatch(void) {
+  return config->batch > 0 ? config->batch : 0;
+}
+
+/**
+ * int Local_getGossip(void)
+ * @return Seconds between pushes of hot cache entries to siblings, 0 if gossip is off
+ **/
+int Local_getGossip(void) {
+  return config->gossip > 0 ? config->gossip : 0;
+}
+
+/**
+ * int Local_getVerify(void)
+ * @return 1 if signed recursive answers are checked against host keys, 0 otherwise
+ **/
+int Local_getVerify(void) {
+  return config->verify ? 1 : 0;
+}
+
+/**
+ * int Local_getSign(void)
+ * @return 1 if local answers are signed with this server's private key, 0 otherwise
+ **/
+int Local_getSign(void) {
+  return config->sign ? 1 : 0;
+}
+
+/**
+ * int Local_getSigners(void)
+ * @return Threads dedicated to signing local answers
+ **/
+int Local_getSigners(void) {
+  return config->signers > 0 ? config->signers : DEFAULT_SIGNERS;
+}
+
+/**
+ * int Local_hasPeerKey(void)
+ * @return 1 if pushes between nodes are authenticated with the shared peerkey, 0 otherwise
+ **/
+int Local_hasPeerKey(void) {
+  return config->hasPeerKey ? 1 : 0;
+}
+
+/**
+ * int Local_peerMac(const uint8_t*, size_t, uint8_t*)
+ * HMAC-SHA256 of @param buf under the peerkey.
+ * @param mac: Overwritten with the SHA256_SIZE byte MAC
+ * @return 0 on success, negative if no peerkey is set or out of memory
+ **/
+int Local_peerMac(const uint8_t* buf, size_t len, uint8_t* mac) {
+  uint8_t outer[MAC_BLOCK + SHA256_SIZE];
+  uint8_t* inner;
+  size_t i;
+
+  if (!config->hasPeerKey) return -1;
+  inner = malloc(MAC_BLOCK + len);
+  if (inner == NULL) return -1;
+
+  /* H((K ^ opad) || H((K ^ ipad) || buf)), K Already Hashed Down to Fit a Block */
+  memset(inner, 0x36, MAC_BLOCK);
+  memset(outer, 0x5c, MAC_BLOCK);
+  for (i = 0; i < SHA256_SIZE; i++) {
+    inner[i] ^= config->peerKey[i];
+    outer[i] ^= config->peerKey[i];
+  }
+  memcpy(inner + MAC_BLOCK, buf, len);
+  sha256_simple(inner, MAC_BLOCK + len, outer + MAC_BLOCK);
+  free(inner);
+
+  sha256_simple(outer, MAC_BLOCK + SHA256_SIZE, mac);
   return 0;
 }
 
@@ -358,11 +1860,22 @@ static int handler(void* nada, const char* section, const char* name, const char
  * @return 0 on success, negative on failure
  **/
 int Local_init(const char* configFile) {
+  struct sHost** set;
+  struct sHost* head;
+  size_t i;
+  int count;
+
   /* Make a new AO */
   config = calloc(1, sizeof(struct local));
   if (config == NULL) return -1;
   
   config->localCache = NULL;
+  pthread_rwlock_init(&(config->lock), NULL);
+  pthread_mutex_init(&(config->lazyLock), NULL);
+  pthread_mutex_init(&(config->xfrLock), NULL);
+
+  /* Serials from Different Runs Never Collide, so Secondaries Notice a Restart */
+  config->serial = (uint64_t)time(NULL) << 32;
   
   /* Parse File */
   if (ini_parse(configFile, handler, NULL) < 0) {
@@ -371,70 +1884,130 @@ int Local_init(const char* configFile) {
     return -1;
   }
 
+  if (config->threads <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    config->threads = cores > 0 ? (int)cores : 1;
+  }
+
+  /* Index Hosts, Chaining Multiple Includes of the Same Host */
+  for (i = 0; i < hostCount; i++) {
+    HASH_FIND(hh, config->index, hosts[i].host, hosts[i].hostLen, head);
+    if (head == NULL) {
+      HASH_ADD_KEYPTR(hh, config->index, hosts[i].host, hosts[i].hostLen, &(hosts[i]));
+    } else {
+      while (head->next != NULL) head = head->next;
+      head->next = &(hosts[i]);
+    }
+  }
+
+  if (config->lazy) {
+    printf("%s: Local_init: Indexed %d hosts for lazy loading...\n", programName, HASH_COUNT(config->index));
+  } else {
+    /* Load Every Host File Now */
+    set = calloc(hostCount ? hostCount : 1, sizeof(struct sHost*));
+    if (set == NULL) {
+      Local_destroy();
+      return -1;
+    }
+    for (i = 0; i < hostCount; i++) set[i] = &(hosts[i]);
+
+    count = Local_build(set, hostCount);
+    free(set);
+    if (count < 0) {
+      Local_destroy();
+      return -1;
+    }
+    printf("%s: Local_init: Loaded %d records using %d threads...\n", programName, count, config->threads);
+  }
+
+  /* Runtime Updates Survive Restarts Through the Journal */
+  count = Local_replay();
+  if (count < 0) {
+    Local_destroy();
+    return -1;
+  }
+  if (count > 0) printf("%s: Local_init: Replayed %d journaled updates...\n", programName, count);
+
   return EXIT_SUCCESS;
 } /* End Local_init() */
 
 /**
- * char* Local-get(char[32], uint16_t)
+ * char* Local_get(const char*, char[32], uint16_t, size_t*, int*)
+ * @param host: The <host> the hash belongs to, used to page in lazily loaded hosts. May be NULL.
  * @param hash, protocol: Used as record identification.
- * @return Case 1: If the hash is a <handle>@<host> combination, return the plaintext address
- * @return Case 2: If the hash is an address, return the plaintext <handle>@<host>
- * @return NULL on miss
+ * @param encLen: Overwritten with the length of the returned buffer
+ * @param ttl: If not NULL, overwritten with the TTL of the record in seconds
+ * @return Case 1: If the hash is a <handle>@<host> combination, return the encrypted address
+ * @return Case 2: If the hash is an address, return the encrypted <handle>@<host>
+ * @return A copy of the record that MUST BE FREED, or NULL on miss
  **/
-const char* Local_get(char hash[SHA256_SIZE], uint16_t protocol, size_t* encLen) {
+char* Local_get(const char* host, char hash[SHA256_SIZE], uint16_t protocol, size_t* encLen, int* ttl) {
   entry* record;
-  char* getID;
-
-  getID = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
-  if (getID == NULL) return NULL;
+  char getID[SHA256_SIZE + sizeof(uint16_t)];
+  char* ret = NULL;
 
   memcpy(getID, hash, SHA256_SIZE);
   memcpy(&(getID[SHA256_SIZE]), &protocol, sizeof(uint16_t));
 
-  HASH_FIND(hh, config->localCache, getID, SHA256_SIZE + sizeof(uint16_t), record);
-
-  free(getID);
+  if (Local_acquire(host) < 0) return NULL;
 
-  if (record == NULL) {
-    return NULL;
+  HASH_FIND(hh, config->localCache, getID, SHA256_SIZE + sizeof(uint16_t), record);
+  if (record != NULL) {
+    ret = malloc(record->encLen);
+    if (ret != NULL) {
+      memcpy(ret, record->encrypted, record->encLen);
+      *encLen = record->encLen;
+      if (ttl) *ttl = record->ttl;
+    }
   }
 
-  *encLen = record->encLen;
-  return record->encrypted;
-}
+  pthread_rwlock_unlock(&(config->lock));
+  return ret;
+} /* End Local_get() */
 
 /**
- * char* Local_getPrivkey(void)
- * @return Plaintext, base64-encoded ECC private key for this server.
+ * uint64_t Local_generation(const char*)
+ * Note: Read it before looking records up, so answers built from them are never newer than it says.
+ * @param host: The <host> the records belong to, may be NULL
+ * @return A counter that changes whenever a record of @param host is added, changed
+ *         or removed, or any replicated record changes
  **/
-const char* Local_getPrivkey(void) {
-  return config->privkey;
+uint64_t Local_generation(const char* host) {
+  struct sHost* head = NULL;
+  uint64_t ret;
+
+  ret = __atomic_load_n(&(config->generation), __ATOMIC_ACQUIRE);
+
+  /* The Index Never Changes After Local_init(), So No Lock is Needed */
+  if (host != NULL) HASH_FIND_STR(config->index, host, head);
+  if (head != NULL) ret += __atomic_load_n(&(head->generation), __ATOMIC_ACQUIRE);
+  return ret;
 }
 
 /**
- * int Local_getTTL(char[32])
- * @param hash: The <handle>@<host> entry associated with the TTL
- * @return The TTL of all records at this hash in seconds.
+ * int Local_update(Update_T)
+ * Verifies a runtime record update against the configured update key, then
+ * journals and applies it. In-flight lookups see either the old or new record.
+ * @param update: Parsed update from a client
+ * @return 0 on success, negative if updates are disabled, the update is
+ *         forged or no newer than the last applied to its record, or the host is not local
  **/
-int Local_getTTL(char hash[SHA256_SIZE], uint16_t protocol) {
-  entry* record; 
-  char* getID;
-
-  getID = calloc(SHA256_SIZE + sizeof(uint16_t), sizeof(char));
-  if (getID == NULL) return 0;
-
-  memcpy(getID, hash, SHA256_SIZE);
-  memcpy(&(getID[SHA256_SIZE]), &protocol, sizeof(uint16_t));
-
-  HASH_FIND(hh, config->localCache, getID, SHA256_SIZE + sizeof(uint16_t), record);
-
-  free(getID);
-
-  if (record == NULL) {
-    return 0;
+int Local_update(Update_T update) {
+  if (config->updateKey == NULL) return -1;
+  if (Update_verify(update, config->updateKey) < 0) {
+    fprintf(stderr, "%s: Local_update: Bad signature on update for %s\n", programName, Update_handleAtHost(update));
+    return -1;
   }
 
-  return record->ttl;
+  return Local_apply(update, true);
+} /* End Local_update() */
+
+/**
+ * char* Local_getPrivkey(void)
+ * @return Plaintext, base64-encoded ECC private key for this server.
+ **/
+const char* Local_getPrivkey(void) {
+  return config->privkey;
 }
 
 /**
@@ -442,15 +2015,10 @@ int Local_getTTL(char hash[SHA256_SIZE], uint16_t protocol) {
  * De-allocte all resources associated with the local config.
  **/
 void Local_destroy(void) {
-  int i;
   entry *current, *tmp;
+  applied *appliedCurrent, *appliedTmp;
   /* Free Protocols */
-  if (protocols) {
-    for(i = 0; i < PROTO_MAX; i++) {
-      if (protocols[i]) free(protocols[i]);
-    }
-    free(protocols);
-  }
+  Local_freeProtocols();
 
   /* Free Config */
   if (config) {
@@ -463,6 +2031,32 @@ void Local_destroy(void) {
       free(current);
     }
 
+    HASH_ITER(hh, config->applied, appliedCurrent, appliedTmp) {
+      HASH_DEL(config->applied, appliedCurrent);
+      free(appliedCurrent->update);
+      free(appliedCurrent);
+    }
+    if (config->journal > 0) close(config->journal);
+    if (config->journalFile) free(config->journalFile);
+    if (config->updateKey) free(config->updateKey);
+
+    if (config->changes) {
+      size_t i;
+      for (i = 0; i < XFR_LOG; i++) free(config->changes[i].encrypted);
+      free(config->changes);
+    }
+    free(config->xfrSnapshot);
+    free(config->xfrOffsets);
+    Local_dropStaged();
+    if (config->primary) free(config->primary);
+    free(config->secondaries);
+    if (config->cluster) free(config->cluster);
+
+    Local_freeHosts();
+    pthread_rwlock_destroy(&(config->lock));
+    pthread_mutex_destroy(&(config->lazyLock));
+    pthread_mutex_destroy(&(config->xfrLock));
     free(config);
+    config = NULL;
   }
 }
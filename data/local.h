@@ -9,6 +9,12 @@
 
 #define SHA256_SIZE 32
 
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "../object/update.h"
+
 /**
  * int Local_init(const char*)
  * Loads the contents of a config file to memory.
@@ -18,26 +24,146 @@
 int Local_init(const char* configFile);
 
 /**
- * char* Local-get(char[32], uint16_t)
+ * char* Local_get(const char*, char[32], uint16_t, size_t*, int*)
+ * @param host: The <host> the hash belongs to, used to page in lazily loaded hosts. May be NULL.
  * @param hash, protocol: Used as record identification.
+ * @param encLen: Overwritten with the length of the returned buffer
+ * @param ttl: If not NULL, overwritten with the TTL of the record in seconds
  * @return Case 1: If the hash is a <handle>@<host> combination, return the encrypted address
  * @return Case 2: If the hash is an address, return the encrypted <handle>@<host>
- * @return NULL on miss
+ * @return A copy of the record that MUST BE FREED, or NULL on miss
  **/
-const char* Local_get(char hash[SHA256_SIZE], uint16_t protocol, size_t* encLen);
+char* Local_get(const char* host, char hash[SHA256_SIZE], uint16_t protocol, size_t* encLen, int* ttl);
 
 /**
- * char* Local_getPrivkey(void)
- * @return Plaintext, base64-encoded ECC private key for this server.
+ * uint64_t Local_generation(const char*)
+ * Note: Read it before looking records up, so answers built from them are never newer than it says.
+ * @param host: The <host> the records belong to, may be NULL
+ * @return A counter that changes whenever a record of @param host is added, changed
+ *         or removed, or any replicated record changes
  **/
-const char* Local_getPrivkey(void);
+uint64_t Local_generation(const char* host);
+
+/**
+ * int Local_update(Update_T)
+ * Verifies a runtime record update against the configured update key, then
+ * journals and applies it. In-flight lookups see either the old or new record.
+ * @param update: Parsed update from a client
+ * @return 0 on success, negative if updates are disabled, the update is
+ *         forged or no newer than the last applied to its record, or the host is not local
+ **/
+int Local_update(Update_T update);
+
+/**
+ * int Local_transfer(const struct sockaddr_in*, const uint8_t*, size_t, uint8_t*, size_t)
+ * Answers a secondary's transfer request. A secondary that is caught up to a
+ * serial still in the change log gets the changes after it, otherwise it gets
+ * the page starting at its cursor of a snapshot frozen at some recent serial,
+ * and catches up from that serial once it has every page. With a peerkey set,
+ * the response ends in a MAC over the request and the response.
+ * @param from: Where the request came from, must be one of the configured secondaries
+ * @param request, requestLen: Transfer request from the secondary
+ * @param buf: Filled with the response
+ * @param bufLen: Size of @param buf
+ * @return Bytes written to @param buf, negative if transfers are not allowed to
+ *         @param from or no record fits the page
+ **/
+int Local_transfer(const struct sockaddr_in* from, const uint8_t* request, size_t requestLen,
+                   uint8_t* buf, size_t bufLen);
+
+/**
+ * size_t Local_transferRequest(uint8_t*)
+ * @param buf: Filled with the next request to send to the primary, must hold at least 12 bytes
+ * @return Length of the request
+ **/
+size_t Local_transferRequest(uint8_t* buf);
 
 /**
- * int Local_getTTL(char[32], uint16_t)
- * @param hash: The <handle>@<host> entry associated with the TTL
- * @return The TTL of all records at this hash in seconds.
+ * int Local_receive(const uint8_t*, size_t)
+ * Applies a transfer response from the primary. Snapshot pages are staged and
+ * swapped in together once the last page arrives; changes apply immediately.
+ * With a peerkey set, a response whose MAC doesn't match our request is dropped.
+ * @return 1 if there is more to pull right away, 0 if caught up, negative if
+ *         malformed or refused, which drops any half-received snapshot
  **/
-int Local_getTTL(char hash[SHA256_SIZE], uint16_t protocol);
+int Local_receive(const uint8_t* buf, size_t len);
+
+/**
+ * const char* Local_getPrimary(int*)
+ * @param refresh: If not NULL, overwritten with the seconds between transfer polls
+ * @return IPv4 address of the primary to replicate from, or NULL if not a secondary
+ **/
+const char* Local_getPrimary(int* refresh);
+
+/**
+ * const char* Local_getCluster(void)
+ * @return This node's ip:port on the cluster ring, or NULL outside cluster mode
+ **/
+const char* Local_getCluster(void);
+
+/**
+ * int Local_hosts(void (*)(void*, const char*, size_t), void*)
+ * Calls @param fn with every host this server is authoritative for.
+ * @param user: Passed through to @param fn
+ * @return Number of hosts
+ **/
+int Local_hosts(void (*fn)(void* user, const char* host, size_t hostLen), void* user);
+
+/**
+ * int Local_getFanout(void)
+ * @return Most peers a recursive query may be sent to, including hedges
+ **/
+int Local_getFanout(void);
+
+/**
+ * long Local_getBatch(void)
+ * @return Microseconds peer traffic waits to share a datagram, 0 if batching is off
+ **/
+long Local_getBatch(void);
+
+/**
+ * int Local_getGossip(void)
+ * @return Seconds between pushes of hot cache entries to siblings, 0 if gossip is off
+ **/
+int Local_getGossip(void);
+
+/**
+ * int Local_getVerify(void)
+ * @return 1 if signed recursive answers are checked against host keys, 0 otherwise
+ **/
+int Local_getVerify(void);
+
+/**
+ * int Local_getSign(void)
+ * @return 1 if local answers are signed with this server's private key, 0 otherwise
+ **/
+int Local_getSign(void);
+
+/**
+ * int Local_getSigners(void)
+ * @return Threads dedicated to signing local answers
+ **/
+int Local_getSigners(void);
+
+/**
+ * int Local_hasPeerKey(void)
+ * @return 1 if pushes between nodes are authenticated with the shared peerkey, 0 otherwise
+ **/
+int Local_hasPeerKey(void);
+
+/**
+ * int Local_peerMac(const uint8_t*, size_t, uint8_t*)
+ * HMAC-SHA256 of @param buf under the peerkey.
+ * @param mac: Overwritten with the SHA256_SIZE byte MAC
+ * @return 0 on success, negative if no peerkey is set or out of memory
+ **/
+int Local_peerMac(const uint8_t* buf, size_t len, uint8_t* mac);
+
+/**
+ * char* Local_getPrivkey(void)
+ * @return Plaintext, base64-encoded ECC private key for this server.
+ **/
+const char* Local_getPrivkey(void);
 
 /**
  * void Local_destory(void)
@@ -0,0 +1,156 @@
+/**
+ * File: memo.c
+ * Author: Ethan Gordon
+ * Serialized (and signed) local answers, memoized per <hash, protocol list>
+ * until a record of their host changes or their timestamps grow too old.
+ *
+ * Each answer remembers its host's generation when it was built, so a change
+ * to any of the host's records makes its older answers miss and be rebuilt,
+ * while answers for other hosts stay memoized. Records
+ * are stamped when the answer is built and expire TTL seconds later, so an
+ * answer is only reused for a fraction of its shortest TTL.
+ **/
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "memo.h"
+#include "../uthash.h"
+
+/* Longest protocol list memoized, longer ones are rare enough to build each time */
+#define MEMO_PROTOCOLS 8
+/* Answers held, the oldest is dropped first */
+#define MEMO_MAX 8192
+/* An answer is reused for 1/MEMO_AGE of its shortest TTL */
+#define MEMO_AGE 8
+
+#define ID_SIZE (SHA256_SIZE + MEMO_PROTOCOLS * sizeof(uint16_t))
+
+typedef struct memo {
+  /* Hash, then the protocol list zero-padded to MEMO_PROTOCOLS */
+  char id[ID_SIZE];
+  uint64_t generation;
+  time_t stale;
+  void* answer;
+  size_t len;
+  UT_hash_handle hh;
+} memo;
+
+/* Insertion ordered, so the head is the oldest */
+static memo* memos = NULL;
+static size_t count = 0;
+/* Query threads read, local answers that miss write */
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Fill @param id from the query, @return 0 on success, negative if the list is too long */
+static int Memo_id(char id[ID_SIZE], const char hash[SHA256_SIZE], const uint16_t* protocols) {
+  int i;
+
+  memset(id, 0, ID_SIZE);
+  memcpy(id, hash, SHA256_SIZE);
+  for (i = 0; protocols[i] != 0; i++) {
+    if (i == MEMO_PROTOCOLS) return -1;
+    memcpy(id + SHA256_SIZE + i * sizeof(uint16_t), &(protocols[i]), sizeof(uint16_t));
+  }
+  return 0;
+}
+
+static void Memo_free(memo* entry) {
+  free(entry->answer);
+  free(entry);
+}
+
+/**
+ * void* Memo_get(const char[32], const uint16_t*, uint64_t, size_t*)
+ * Note: Safe to call from any thread.
+ * @param hash: Query_id() of the query
+ * @param protocols: 0-terminated protocol list of the query
+ * @param generation: Local_generation() read before the records were looked up
+ * @param len: Overwritten with the length of the answer
+ * @return A copy of the serialized answer that MUST BE FREED, or NULL on miss
+ **/
+void* Memo_get(const char hash[SHA256_SIZE], const uint16_t* protocols, uint64_t generation, size_t* len) {
+  char id[ID_SIZE];
+  memo* found;
+  void* ret = NULL;
+
+  if (Memo_id(id, hash, protocols) < 0) return NULL;
+
+  pthread_rwlock_rdlock(&lock);
+  HASH_FIND(hh, memos, id, ID_SIZE, found);
+  if (found != NULL && found->generation == generation && found->stale > time(NULL)) {
+    ret = malloc(found->len);
+    if (ret != NULL) {
+      memcpy(ret, found->answer, found->len);
+      *len = found->len;
+    }
+  }
+  pthread_rwlock_unlock(&lock);
+
+  return ret;
+} /* End Memo_get() */
+
+/**
+ * int Memo_put(const char[32], const uint16_t*, uint64_t, const void*, size_t, int)
+ * Remembers a serialized local answer, a copy is made.
+ * @param generation: Local_generation() read before the records were looked up
+ * @param ttl: Shortest TTL among the answer's records, in seconds
+ * @return 0 on success, 1 if the answer is not worth keeping, negative on failure
+ **/
+int Memo_put(const char hash[SHA256_SIZE], const uint16_t* protocols, uint64_t generation,
+             const void* answer, size_t len, int ttl) {
+  memo *add, *replaced;
+
+  if (ttl < MEMO_AGE) return 1;
+
+  add = calloc(1, sizeof(memo));
+  if (add == NULL) return -1;
+  if (Memo_id(add->id, hash, protocols) < 0) {
+    free(add);
+    return 1;
+  }
+  add->answer = malloc(len);
+  if (add->answer == NULL) {
+    free(add);
+    return -1;
+  }
+  memcpy(add->answer, answer, len);
+  add->len = len;
+  add->generation = generation;
+  add->stale = time(NULL) + ttl / MEMO_AGE;
+
+  pthread_rwlock_wrlock(&lock);
+  HASH_REPLACE(hh, memos, id, ID_SIZE, add, replaced);
+  if (replaced != NULL) {
+    Memo_free(replaced);
+  } else if (++count > MEMO_MAX) {
+    /* Full, Drop the Oldest */
+    memo* oldest = memos;
+    HASH_DEL(memos, oldest);
+    Memo_free(oldest);
+    count--;
+  }
+  pthread_rwlock_unlock(&lock);
+
+  return 0;
+} /* End Memo_put() */
+
+/**
+ * void Memo_destroy(void)
+ * De-allocates every memoized answer.
+ **/
+void Memo_destroy(void) {
+  memo *current, *tmp;
+
+  pthread_rwlock_wrlock(&lock);
+  HASH_ITER(hh, memos, current, tmp) {
+    HASH_DEL(memos, current);
+    Memo_free(current);
+  }
+  count = 0;
+  pthread_rwlock_unlock(&lock);
+}
@@ -0,0 +1,43 @@
+/**
+ * File: memo.h
+ * Author: Ethan Gordon
+ * Serialized (and signed) local answers, memoized per <hash, protocol list>
+ * until a record of their host changes or their timestamps grow too old.
+ **/
+
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_SIZE 32
+
+/**
+ * void* Memo_get(const char[32], const uint16_t*, uint64_t, size_t*)
+ * Note: Safe to call from any thread.
+ * @param hash: Query_id() of the query
+ * @param protocols: 0-terminated protocol list of the query
+ * @param generation: Local_generation() read before the records were looked up
+ * @param len: Overwritten with the length of the answer
+ * @return A copy of the serialized answer that MUST BE FREED, or NULL on miss
+ **/
+void* Memo_get(const char hash[SHA256_SIZE], const uint16_t* protocols, uint64_t generation, size_t* len);
+
+/**
+ * int Memo_put(const char[32], const uint16_t*, uint64_t, const void*, size_t, int)
+ * Remembers a serialized local answer, a copy is made.
+ * @param generation: Local_generation() read before the records were looked up
+ * @param ttl: Shortest TTL among the answer's records, in seconds
+ * @return 0 on success, 1 if the answer is not worth keeping, negative on failure
+ **/
+int Memo_put(const char hash[SHA256_SIZE], const uint16_t* protocols, uint64_t generation,
+             const void* answer, size_t len, int ttl);
+
+/**
+ * void Memo_destroy(void)
+ * De-allocates every memoized answer.
+ **/
+void Memo_destroy(void);
+
+#endif
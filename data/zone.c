@@ -0,0 +1,181 @@
+/**
+ * File: zone.c
+ * Author: Ethan Gordon
+ * Zero-copy reader for MARP host (zone) files. The file is mapped into
+ * memory and every section, name and value handed to the handler points
+ * straight into the mapping.
+ **/
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "zone.h"
+
+/* Memory-mapped host file */
+struct zone {
+  const char* map;
+  size_t size;
+};
+
+/* UTF-8 Byte Order Mark */
+#define BOM "\xEF\xBB\xBF"
+#define BOM_LEN 3
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\f' || (c) == '\v')
+
+/* Shrink [*start, *stop) until neither end is whitespace */
+static void trim(const char** start, const char** stop) {
+  while (*start < *stop && IS_SPACE(**start)) (*start)++;
+  while (*stop > *start && IS_SPACE(*(*stop - 1))) (*stop)--;
+}
+
+/**
+ * Zone_T Zone_open(const char*)
+ * Maps a host file into memory, read only.
+ * @param file: absolute or relative path to the host file
+ * @return New Zone, or NULL on failure with errno set
+ **/
+Zone_T Zone_open(const char* file) {
+  Zone_T ret;
+  struct stat st;
+  int fd;
+
+  assert(file != NULL);
+
+  ret = calloc(1, sizeof(struct zone));
+  if (ret == NULL) return NULL;
+
+  fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    free(ret);
+    return NULL;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    close(fd); free(ret);
+    return NULL;
+  }
+
+  /* An Empty File Has Nothing to Map */
+  ret->size = (size_t)st.st_size;
+  if (ret->size > 0) {
+    void* map = mmap(NULL, ret->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd); free(ret);
+      return NULL;
+    }
+    (void)madvise(map, ret->size, MADV_SEQUENTIAL);
+    ret->map = map;
+  }
+
+  /* The Mapping Outlives the Descriptor */
+  close(fd);
+  return ret;
+} /* End Zone_open() */
+
+/**
+ * int Zone_parse(Zone_T, Zone_handler, void*)
+ * Scans the INI-style zone: [section]s, name=value (or name:value) pairs,
+ * and comments starting with ';' or '#'. Whitespace around names and values is stripped.
+ * Line ends and separators are found with memchr(), which libc vectorizes.
+ * @param zone: Zone from Zone_open(), cannot be NULL
+ * @param handler: Called for each name=value pair
+ * @param user: Passed through to @param handler
+ * @return 0 on success, or the line number of the first error
+ **/
+int Zone_parse(Zone_T zone, Zone_handler handler, void* user) {
+  const char *cursor, *end;
+  const char* section = "";
+  size_t sectionLen = 0;
+  int lineno = 0;
+  int error = 0;
+
+  assert(zone != NULL);
+  assert(handler != NULL);
+
+  if (zone->map == NULL) return 0;
+
+  cursor = zone->map;
+  end = zone->map + zone->size;
+
+  if (zone->size >= BOM_LEN && memcmp(cursor, BOM, BOM_LEN) == 0)
+    cursor += BOM_LEN;
+
+  while (cursor < end) {
+    const char *start, *stop, *sep;
+    const char *name, *nameEnd, *value, *valueEnd;
+
+    /* Split off the Next Line */
+    lineno++;
+    stop = memchr(cursor, '\n', end - cursor);
+    if (stop == NULL) stop = end;
+    start = cursor;
+    cursor = stop + 1;
+
+    trim(&start, &stop);
+    if (start == stop) continue;
+
+    /* Comment */
+    if (*start == ';' || *start == '#') continue;
+
+    /* Section Header */
+    if (*start == '[') {
+      sep = memchr(start + 1, ']', stop - start - 1);
+      if (sep == NULL) {
+        if (!error) error = lineno;
+        continue;
+      }
+      section = start + 1;
+      sectionLen = sep - section;
+      continue;
+    }
+
+    /* name=value or name:value */
+    sep = memchr(start, '=', stop - start);
+    if (sep == NULL) sep = memchr(start, ':', stop - start);
+    if (sep == NULL) {
+      if (!error) error = lineno;
+      continue;
+    }
+
+    name = start;
+    nameEnd = sep;
+    trim(&name, &nameEnd);
+
+    /* Strip Inline Comment, which Must Follow Whitespace */
+    value = sep + 1;
+    valueEnd = stop;
+    for (sep = memchr(value, ';', valueEnd - value); sep != NULL;
+         sep = memchr(sep + 1, ';', valueEnd - sep - 1)) {
+      if (sep > value && IS_SPACE(*(sep - 1))) {
+        valueEnd = sep;
+        break;
+      }
+    }
+    trim(&value, &valueEnd);
+
+    if (handler(user, section, sectionLen, name, nameEnd - name, value, valueEnd - value) < 0) {
+      if (!error) error = lineno;
+    }
+  }
+
+  return error;
+} /* End Zone_parse() */
+
+/**
+ * void Zone_close(Zone_T)
+ * Unmaps the file. All strings handed out by Zone_parse() become invalid.
+ **/
+void Zone_close(Zone_T zone) {
+  if (zone == NULL) return;
+
+  if (zone->map) munmap((void*)zone->map, zone->size);
+  free(zone);
+} /* End Zone_close() */
@@ -0,0 +1,53 @@
+/**
+ * File: zone.h
+ * Author: Ethan Gordon
+ * Zero-copy reader for MARP host (zone) files. The file is mapped into
+ * memory and every section, name and value handed to the handler points
+ * straight into the mapping.
+ **/
+
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <stddef.h>
+
+/* Memory-mapped host file */
+typedef struct zone *Zone_T;
+
+/**
+ * Zone_handler
+ * Called once for every name=value pair, in file order.
+ * Note: None of the strings are NUL-terminated, always use the lengths.
+ * Strings stay valid until Zone_close() is called on the zone.
+ * @return 0 on success, negative on error (parsing continues)
+ **/
+typedef int (*Zone_handler)(void* user, const char* section, size_t sectionLen,
+                            const char* name, size_t nameLen,
+                            const char* value, size_t valueLen);
+
+/**
+ * Zone_T Zone_open(const char*)
+ * Maps a host file into memory, read only.
+ * @param file: absolute or relative path to the host file
+ * @return New Zone, or NULL on failure with errno set
+ **/
+Zone_T Zone_open(const char* file);
+
+/**
+ * int Zone_parse(Zone_T, Zone_handler, void*)
+ * Scans the INI-style zone: [section]s, name=value (or name:value) pairs,
+ * and comments starting with ';' or '#'. Whitespace around names and values is stripped.
+ * @param zone: Zone from Zone_open(), cannot be NULL
+ * @param handler: Called for each name=value pair
+ * @param user: Passed through to @param handler
+ * @return 0 on success, or the line number of the first error
+ **/
+int Zone_parse(Zone_T zone, Zone_handler handler, void* user);
+
+/**
+ * void Zone_close(Zone_T)
+ * Unmaps the file. All strings handed out by Zone_parse() become invalid.
+ **/
+void Zone_close(Zone_T zone);
+
+#endif
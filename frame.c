@@ -12,15 +12,20 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <time.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 
 /* Local Files */
 #include "frame.h"
+#include "uthash.h"
 #include "network/socket.h"
+#include "network/peers.h"
 
-#define FRAME_MAX 512
+/* Largest UDP payload that is not fragmented on Ethernet */
+#define FRAME_MAX 1472
 #define LOCAL_VERSION 1
-#define PEER_MAX 10
-#define HEADER 9
+#define HEADER sizeof(struct header)
 
 extern char* programName;
 
@@ -37,11 +42,77 @@ struct header {
   uint16_t length;
 };
 
+/* Optional, follows the header when the Z_EXT bit is set */
+struct extension {
+  /* Bytes of extension on the wire, fields newer than this server are skipped */
+  uint16_t length;
+  /* Milliseconds the client will still wait for an answer, 0 if unknown */
+  uint16_t budget;
+  /* EXT_* flags, in what used to be padding */
+  uint8_t flags;
+  /* Responses: percent of the responder's response threads in use */
+  uint8_t load;
+  /* Bloom filter of the nodes a recursive query has been sent to */
+  uint64_t visited;
+};
+
+/* Reserved header bits */
+#define Z_EXT 0x1
+#define Z_BUSY 0x2 /* Response: too loaded to answer, ask another node */
+
+/* Payload room in a response, leaving space for the extension if the query carried it */
+#define RESPONSE_ROOM (FRAME_MAX - HEADER - sizeof(struct extension))
+
+/* Extension flags */
+#define EXT_CLUSTER 0x1 /* Forwarded to the record's owner, recurse rather than forward again */
+
 struct frame {
   struct header sHeader;
+  struct extension ext;
   uint8_t* payload;
+  /* When Frame_listen() received it, to charge queueing delay against the budget */
+  struct timespec arrived;
+  /* Where Frame_listen() received it from, family 0 if unknown */
+  struct sockaddr_in from;
+  /* Responses: a local answer still to be signed by the signing threads, NULL if none */
+  struct pending* pending;
 };
 
+/* A local answer left to the signing threads, sent and memoized once signed */
+struct pending {
+  char hash[SHA256_SIZE];
+  uint16_t* protocols;
+  uint64_t generation;
+  int ttl;
+  /* Filled in by Frame_thread(): the whole serialized response and where its payload starts */
+  Socket_T socket;
+  uint8_t* buf;
+  size_t len;
+  size_t offset;
+};
+
+/* Recently recursed (qid, hash) pair */
+typedef struct seen {
+  struct {
+    uint32_t qid;
+    char hash[SHA256_SIZE];
+  } key;
+  time_t when;
+  UT_hash_handle hh;
+} seen;
+
+/* Recursive queries seen again within this many seconds are not recursed again */
+#define SEEN_TTL 10
+
+/* Milliseconds kept back for our own reply when passing the budget on */
+#define BUDGET_REPLY 2
+/* Don't recurse with less than this many milliseconds left, no peer answers that fast */
+#define BUDGET_MIN 5
+
+static seen* seenTable = NULL;
+static time_t seenPruned = 0;
+static pthread_mutex_t seenLock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Frame_T Frame_init(void)
  * Allocates a new Frame in the heap. 
@@ -63,16 +134,17 @@ Frame_T Frame_init(void) {
  * @return a new Frame, or NULL on failure
  **/
 Frame_T Frame_buildQuery(int authoritative, int recurseDepth, const void* payload, size_t payLen) {
+  static bool seeded = false;
   Frame_T ret = Frame_init();
   if (ret == NULL) return NULL;
 
-  ret->payload = calloc(payLen, sizeof(uint8_t));
+  ret->payload = calloc(payLen ? payLen : 1, sizeof(uint8_t));
   if (ret->payload == NULL) {
     free(ret); return NULL;
   }
 
   ret->sHeader.length = payLen;
-  memcpy(ret->payload, payload, ret->sHeader.length);
+  if (payLen) memcpy(ret->payload, payload, ret->sHeader.length);
 
   ret->sHeader.version = 1;
   if (authoritative) ret->sHeader.aa = 1;
@@ -83,14 +155,183 @@ Frame_T Frame_buildQuery(int authoritative, int recurseDepth, const void* payloa
   ret->sHeader.op = 0; /* Standard Query */
   ret->sHeader.version = 1;
 
-  /* Randomly Generate QID */
-  srand(time(NULL));
+  /* Randomly Generate QID, Seeding Once so Back-to-Back Frames Differ */
+  if (!seeded) {
+    srand(time(NULL) ^ getpid());
+    seeded = true;
+  }
 
   ret->sHeader.qid = rand();
 
   return ret;
 }
 
+/* Operation Codes */
+enum {
+  kSTD,
+  kREV,
+  kPER,
+  kMAL,
+  kNTF,
+  kPNG,
+  kUPD,
+  kXFR
+};
+
+/**
+ * Frame_T Frame_buildUpdate(const void*, size_t)
+ * @param payload: A serialized, signed Update
+ * @param payLen: Length of @param payload
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildUpdate(const void* payload, size_t payLen) {
+  Frame_T ret = Frame_buildQuery(0, 0, payload, payLen);
+  if (ret == NULL) return NULL;
+
+  ret->sHeader.op = kUPD;
+  return ret;
+}
+
+/* Copy @param payload with its MAC under the peerkey after it, NULL on failure */
+static uint8_t* Frame_seal(const void* payload, size_t payLen) {
+  uint8_t* sealed = malloc(payLen + PEER_MAC);
+  if (sealed == NULL) return NULL;
+
+  memcpy(sealed, payload, payLen);
+  if (Local_peerMac(sealed, payLen, sealed + payLen) < 0) {
+    free(sealed);
+    return NULL;
+  }
+  return sealed;
+}
+
+/**
+ * Frame_T Frame_buildTransfer(const void*, size_t)
+ * With a peerkey set, @param payload is followed by its MAC, as on a push.
+ * @param payload: A zone transfer request from Local_transferRequest()
+ * @param payLen: Length of @param payload
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildTransfer(const void* payload, size_t payLen) {
+  uint8_t* sealed = NULL;
+  Frame_T ret;
+
+  if (Local_hasPeerKey()) {
+    sealed = Frame_seal(payload, payLen);
+    if (sealed == NULL) return NULL;
+    payload = sealed;
+    payLen += PEER_MAC;
+  }
+
+  ret = Frame_buildQuery(0, 0, payload, payLen);
+  free(sealed);
+  if (ret == NULL) return NULL;
+
+  ret->sHeader.op = kXFR;
+  return ret;
+}
+
+/**
+ * Frame_T Frame_buildPeer(const void*, size_t)
+ * @param payload: A peer exchange message, starting with its PER_ subtype
+ * @param payLen: Length of @param payload
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildPeer(const void* payload, size_t payLen) {
+  Frame_T ret = Frame_buildQuery(0, 0, payload, payLen);
+  if (ret == NULL) return NULL;
+
+  ret->sHeader.op = kPER;
+  return ret;
+}
+
+/**
+ * Frame_T Frame_buildPush(const void*, size_t)
+ * Like Frame_buildPeer(), for pushes that change what the receiver believes
+ * about us. With a peerkey set, @param payload is followed by its MAC.
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildPush(const void* payload, size_t payLen) {
+  uint8_t* sealed;
+  Frame_T ret;
+
+  if (!Local_hasPeerKey()) return Frame_buildPeer(payload, payLen);
+
+  sealed = Frame_seal(payload, payLen);
+  if (sealed == NULL) return NULL;
+
+  ret = Frame_buildPeer(sealed, payLen + PEER_MAC);
+  free(sealed);
+  return ret;
+}
+
+/**
+ * int Frame_unseal(Frame_T, size_t*)
+ * Checks the MAC Frame_buildPush() or Frame_buildTransfer() put on a frame,
+ * when a peerkey is set.
+ * @param len: Overwritten with the length of the payload without its MAC
+ * @return 0 if the push may be applied, negative if its MAC is missing or wrong
+ **/
+static int Frame_unseal(Frame_T frame, size_t* len) {
+  uint8_t mac[PEER_MAC], diff = 0;
+  size_t i;
+
+  *len = frame->sHeader.length;
+  if (!Local_hasPeerKey()) return 0;
+  if (*len < 1 + PEER_MAC) return -1;
+
+  *len -= PEER_MAC;
+  if (Local_peerMac(frame->payload, *len, mac) < 0) return -1;
+
+  /* Compare Every Byte, so Timing Doesn't Reveal How Much of a Forgery Matched */
+  for (i = 0; i < PEER_MAC; i++) diff |= mac[i] ^ frame->payload[*len + i];
+  return diff == 0 ? 0 : -1;
+}
+
+/**
+ * Frame_T Frame_buildPing(void)
+ * @return a new, empty kPNG Frame, or NULL on failure
+ **/
+Frame_T Frame_buildPing(void) {
+  Frame_T ret = Frame_buildQuery(0, 0, NULL, 0);
+  if (ret == NULL) return NULL;
+
+  ret->sHeader.op = kPNG;
+  return ret;
+}
+
+/**
+ * void Frame_setBudget(Frame_T, uint16_t)
+ * @param budget: Milliseconds the sender will wait for the answer, recursing
+ *                nodes give up once it is spent
+ * @return None
+ **/
+void Frame_setBudget(Frame_T frame, uint16_t budget) {
+  assert(frame != NULL);
+
+  frame->sHeader.z |= Z_EXT;
+  frame->ext.budget = budget;
+}
+
+/**
+ * uint32_t Frame_getQID(Frame_T)
+ * @return Query ID shared by a query and its response
+ **/
+uint32_t Frame_getQID(Frame_T frame) {
+  assert(frame != NULL);
+  return frame->sHeader.qid;
+}
+
+/**
+ * bool Frame_isApplied(Frame_T)
+ * @return true when the frame acknowledges an update: a kUPD response the server marked
+ *         authoritative. kNTF, kMAL and anything else mean the update was not applied.
+ **/
+bool Frame_isApplied(Frame_T frame) {
+  assert(frame != NULL);
+  return !frame->sHeader.qr && frame->sHeader.op == kUPD && frame->sHeader.aa;
+}
+
 /**
  * const uint8_t Frame_getPayload(Frame_T, uint16_t*)
  * @param frame: To get the payload, can't be NULL
@@ -104,6 +345,77 @@ const uint8_t* Frame_getPayload(Frame_T frame, uint16_t* len) {
   return frame->payload;
 }
 
+/* MAC under the peerkey of a response payload, bound to the request payload it answers */
+static int Frame_replyMac(const void* request, size_t requestLen, const uint8_t* payload, size_t len, uint8_t* mac) {
+  uint8_t* both;
+  int error;
+
+  both = malloc(requestLen + len);
+  if (both == NULL) return -1;
+  memcpy(both, request, requestLen);
+  memcpy(both + requestLen, payload, len);
+  error = Local_peerMac(both, requestLen + len, mac);
+  free(both);
+  return error;
+}
+
+/**
+ * const uint8_t* Frame_getSealedPayload(Frame_T, const void*, size_t, uint16_t*)
+ * Like Frame_getPayload(), for a response a peer sealed against the request it
+ * answers. Without a peerkey, the payload is returned as is.
+ * @param request, requestLen: Payload of the request @param frame answers, without its MAC
+ * @param len: Value Parameter, overwritten with length of payload without its MAC
+ * @return pointer to the payload buffer, NULL if its MAC is missing or wrong
+ **/
+const uint8_t* Frame_getSealedPayload(Frame_T frame, const void* request, size_t requestLen, uint16_t* len) {
+  uint8_t mac[PEER_MAC], diff = 0;
+  size_t i;
+
+  assert(frame != NULL);
+
+  *len = frame->sHeader.length;
+  if (!Local_hasPeerKey()) return frame->payload;
+  if (*len < PEER_MAC) return NULL;
+
+  *len -= PEER_MAC;
+  if (Frame_replyMac(request, requestLen, frame->payload, *len, mac) < 0) return NULL;
+  for (i = 0; i < PEER_MAC; i++) diff |= mac[i] ^ frame->payload[*len + i];
+  return diff == 0 ? frame->payload : NULL;
+}
+
+/**
+ * int Frame_parse(Frame_T, const uint8_t*, size_t)
+ * Fills @param dest from a datagram: the header, the extension if Z_EXT is set, then the payload.
+ * @return 0 on success, negative if malformed
+ **/
+static int Frame_parse(Frame_T dest, const uint8_t* buf, size_t len) {
+  const uint8_t* payload;
+
+  if (len < HEADER) return -1;
+
+  memcpy(&(dest->sHeader), buf, HEADER);
+  payload = buf + HEADER;
+  memset(&(dest->ext), 0, sizeof(struct extension));
+  if (dest->sHeader.z & Z_EXT) {
+    uint16_t extLen;
+
+    if (len < HEADER + sizeof(uint16_t)) return -1;
+    memcpy(&extLen, payload, sizeof(uint16_t));
+    if (extLen < sizeof(uint16_t) || extLen > len - HEADER) return -1;
+    memcpy(&(dest->ext), payload, extLen < sizeof(struct extension) ? extLen : sizeof(struct extension));
+    payload += extLen;
+  }
+
+  /* Never Trust the Length Field Past What Arrived */
+  if (dest->sHeader.length > len - (payload - buf)) dest->sHeader.length = len - (payload - buf);
+
+  dest->payload = calloc(dest->sHeader.length ? dest->sHeader.length : 1, sizeof(uint8_t));
+  if (dest->payload == NULL) return -1;
+  memcpy(dest->payload, payload, dest->sHeader.length);
+
+  return 0;
+} /* End Frame_parse() */
+
 /**
  * int Frame_listen(Frame_T, Socket_T)
  * Block until a new frame is received via the socket over the network (or timeout is reached).
@@ -114,7 +426,7 @@ const uint8_t* Frame_getPayload(Frame_T frame, uint16_t* len) {
  **/
 int Frame_listen(Frame_T dest, Socket_T socket, int timeout) {
   int error;
-  uint8_t *buf, *payload;
+  uint8_t *buf;
 
   assert(dest != NULL);
   assert(socket != NULL);
@@ -122,6 +434,7 @@ int Frame_listen(Frame_T dest, Socket_T socket, int timeout) {
   if (timeout < 0) return timeout;
 
   if (dest->payload) free(dest->payload);
+  dest->payload = NULL;
   buf = calloc(FRAME_MAX, sizeof(uint8_t));
   if (buf == NULL) {
     return -1;
@@ -131,20 +444,21 @@ int Frame_listen(Frame_T dest, Socket_T socket, int timeout) {
   if (error < 0) {
     free(buf);
     return error;
-  } else if (error < HEADER) {
-    fprintf(stderr, "%s: Received too small frame from socket.", programName);
   }
-
-  dest->payload = calloc(error - HEADER, sizeof(uint8_t));
-  if (dest->payload == NULL) {
+  clock_gettime(CLOCK_MONOTONIC, &(dest->arrived));
+  memset(&(dest->from), 0, sizeof(struct sockaddr_in));
+  if (error < (int)HEADER) {
+    fprintf(stderr, "%s: Received too small frame from socket.\n", programName);
     free(buf);
     return -1;
   }
-  
+
   /* Fill Frame */
-  memcpy(&(dest->sHeader), buf, HEADER);
-  payload = buf + HEADER;
-  memcpy(dest->payload, payload, error - HEADER);
+  if (Frame_parse(dest, buf, error) < 0) {
+    free(buf);
+    return -1;
+  }
+  (void)Socket_source(socket, dest->sHeader.qid, &(dest->from));
 
   free(buf);
 
@@ -152,6 +466,58 @@ int Frame_listen(Frame_T dest, Socket_T socket, int timeout) {
 } /* End Frame_listen() */
 
 static void* Frame_thread(void* arg);
+static size_t Frame_serialize(Frame_T frame, uint8_t* buf, size_t bufLen);
+
+/* Response threads running, and how many the daemon runs at most; their ratio is the load hint */
+static struct {
+  pthread_mutex_t lock;
+  int inflight;
+  int capacity;
+} load = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+
+/* Percent of capacity in use, 0 if unknown */
+static uint8_t Frame_loadHint(void) {
+  int percent = 0;
+
+  pthread_mutex_lock(&(load.lock));
+  if (load.capacity > 0) percent = load.inflight * 100 / load.capacity;
+  pthread_mutex_unlock(&(load.lock));
+
+  return (uint8_t)(percent < 100 ? percent : 100);
+}
+
+/* Takes a response slot if one is free, true if taken; Frame_release() gives it back */
+static bool Frame_admit(void) {
+  bool admitted;
+
+  pthread_mutex_lock(&(load.lock));
+  admitted = load.capacity == 0 || load.inflight < load.capacity;
+  if (admitted) load.inflight++;
+  pthread_mutex_unlock(&(load.lock));
+
+  return admitted;
+}
+
+static void Frame_release(void) {
+  pthread_mutex_lock(&(load.lock));
+  load.inflight--;
+  pthread_mutex_unlock(&(load.lock));
+}
+
+/* Serializes a busy answer to the query with header @param query into @param buf, 0 if it doesn't fit */
+static size_t Frame_busy(const struct header* query, uint8_t* buf, size_t bufLen) {
+  struct frame busy;
+
+  memset(&busy, 0, sizeof(struct frame));
+  busy.sHeader = *query;
+  busy.sHeader.qr = 0;
+  busy.sHeader.aa = 0;
+  busy.sHeader.z = (query->z & Z_EXT) | Z_BUSY;
+  busy.sHeader.length = 0;
+  busy.ext.load = 100;
+
+  return Frame_serialize(&busy, buf, bufLen);
+}
 
 struct threadarg {
   Socket_T socket;
@@ -191,12 +557,106 @@ pthread_t* Frame_respond(Frame_T frame, Socket_T socket) {
   thread = calloc(1, sizeof(pthread_t));
   if (thread == NULL) { free(arg); return NULL; }
 
+  pthread_mutex_lock(&(load.lock));
+  load.inflight++;
+  pthread_mutex_unlock(&(load.lock));
+
   error = pthread_create(thread, NULL, Frame_thread, arg);
-  if (error < 0) { free(thread); free(arg); return NULL; }
+  if (error != 0) {
+    Frame_release();
+    free(thread); free(arg); return NULL;
+  }
   
   return thread;
 } /* End Frame_respond() */
 
+/**
+ * int Frame_shed(Frame_T, Socket_T, int)
+ * Answers a standard query with a busy response instead of queueing it when
+ * every response thread is taken, so the sender asks another node at once.
+ * @param capacity: Most response threads the daemon runs, the load hint's 100%
+ * @return 1 if @param frame was answered busy and should be freed, 0 to respond as usual
+ **/
+int Frame_shed(Frame_T frame, Socket_T socket, int capacity) {
+  uint8_t buf[HEADER + sizeof(struct extension)];
+  bool full;
+  size_t len;
+
+  assert(frame != NULL);
+  assert(socket != NULL);
+
+  pthread_mutex_lock(&(load.lock));
+  load.capacity = capacity;
+  full = load.inflight >= capacity;
+  pthread_mutex_unlock(&(load.lock));
+
+  /* Only Queries are Worth Turning Away, Anything Else is Cheap or Must Not be Lost */
+  if (!full || !frame->sHeader.qr || frame->sHeader.op != kSTD) return 0;
+
+  len = Frame_busy(&(frame->sHeader), buf, sizeof(buf));
+  if (len == 0 || Socket_respond(socket, buf, len) < 0) return 0;
+  return 1;
+} /* End Frame_shed() */
+
+/**
+ * int Frame_load(const void*, size_t, bool*)
+ * Reads the load a responder reported, without parsing the whole datagram.
+ * @param buf: A received response
+ * @param busy: Overwritten with whether the responder turned the query away
+ * @return Percent of the responder's capacity in use, negative if it did not say
+ **/
+int Frame_load(const void* buf, size_t len, bool* busy) {
+  struct header head;
+  struct extension ext;
+
+  assert(busy != NULL);
+  *busy = false;
+  if (len < HEADER) return -1;
+
+  memcpy(&head, buf, HEADER);
+  if (head.qr) return -1;
+  *busy = (head.z & Z_BUSY) != 0;
+  if (!(head.z & Z_EXT) || len < HEADER + offsetof(struct extension, load) + sizeof(uint8_t)) return -1;
+
+  memcpy(&ext, (const uint8_t*)buf + HEADER, offsetof(struct extension, load) + sizeof(uint8_t));
+  if (ext.length < offsetof(struct extension, load) + sizeof(uint8_t)) return -1;
+  return ext.load;
+} /* End Frame_load() */
+
+/**
+ * bool Frame_isAnswer(const void*, size_t)
+ * @param buf: A received response
+ * @return true if @param buf is a standard answer, false for kNTF, busy and other non-answers
+ **/
+bool Frame_isAnswer(const void* buf, size_t len) {
+  struct header head;
+
+  if (len < HEADER) return false;
+  memcpy(&head, buf, HEADER);
+  return !head.qr && head.op == kSTD && !(head.z & Z_BUSY);
+}
+
+/**
+ * size_t Frame_serialize(Frame_T, uint8_t*, size_t)
+ * Writes the header, the extension if Z_EXT is set, then the payload.
+ * @return Bytes written, or 0 if @param bufLen is too small
+ **/
+static size_t Frame_serialize(Frame_T frame, uint8_t* buf, size_t bufLen) {
+  size_t len = HEADER;
+
+  if (frame->sHeader.z & Z_EXT) {
+    frame->ext.length = sizeof(struct extension);
+    len += sizeof(struct extension);
+  }
+  if (len + frame->sHeader.length > bufLen) return 0;
+
+  memcpy(buf, &(frame->sHeader), HEADER);
+  if (frame->sHeader.z & Z_EXT) memcpy(buf + HEADER, &(frame->ext), sizeof(struct extension));
+  memcpy(buf + len, frame->payload, frame->sHeader.length);
+
+  return len + frame->sHeader.length;
+}
+
 /**
  * int Frame_send(Frame_T, Socket_T, const char* uint16_t)
  * @param frame: To serialize and Send
@@ -206,16 +666,142 @@ pthread_t* Frame_respond(Frame_T frame, Socket_T socket) {
  **/
 int Frame_send(Frame_T frame, Socket_T socket, const char* ip, uint16_t port) {
   uint8_t* buf;
+  size_t len;
+  int ret;
   assert(frame != NULL);
   assert(socket != NULL);
 
-  buf = calloc(HEADER + frame->sHeader.length, sizeof(char));
+  buf = calloc(FRAME_MAX, sizeof(char));
   if (buf == NULL) return -1;
 
-  memcpy(buf, &(frame->sHeader), HEADER);
-  memcpy(buf + HEADER, frame->payload, frame->sHeader.length);
+  len = Frame_serialize(frame, buf, FRAME_MAX);
+  if (len == 0) {
+    free(buf);
+    return -1;
+  }
 
-  return Socket_write(socket, ip, port, buf, HEADER + frame->sHeader.length);
+  ret = Socket_write(socket, ip, port, buf, len);
+  free(buf);
+  return ret;
+}
+
+/**
+ * size_t Frame_batch(void*, size_t, const void* const*, const size_t*, int, int)
+ * Packs datagrams bound for the same node into one PER_BATCH frame.
+ * @param buf: Overwritten with the batch datagram
+ * @param bufLen: Size of @param buf
+ * @param items: Serialized frames, @param lens long
+ * @param count: Number of @param items, at most BATCH_MAX
+ * @param query: Nonzero for a batch of queries, 0 for a batch of answers
+ * @return Bytes written to @param buf, 0 if they do not fit
+ **/
+size_t Frame_batch(void* buf, size_t bufLen, const void* const* items, const size_t* lens, int count, int query) {
+  struct header head;
+  uint8_t* out = buf;
+  size_t len = 1;
+  uint16_t itemLen;
+  int i;
+
+  assert(buf != NULL);
+  if (count <= 0 || count > BATCH_MAX) return 0;
+
+  for (i = 0; i < count; i++) len += sizeof(uint16_t) + lens[i];
+  if (len - 1 > BATCH_ROOM || HEADER + len > bufLen) return 0;
+
+  /* Each Datagram Keeps its Own QID, the Batch's is Only for the Acknowledgement */
+  memset(&head, 0, HEADER);
+  head.version = LOCAL_VERSION;
+  head.qr = query ? 1 : 0;
+  head.op = kPER;
+  head.qid = rand();
+  head.length = (uint16_t)len;
+  memcpy(out, &head, HEADER);
+  out += HEADER;
+
+  *out++ = PER_BATCH;
+  for (i = 0; i < count; i++) {
+    itemLen = htons((uint16_t)lens[i]);
+    memcpy(out, &itemLen, sizeof(uint16_t));
+    memcpy(out + sizeof(uint16_t), items[i], lens[i]);
+    out += sizeof(uint16_t) + lens[i];
+  }
+
+  return HEADER + len;
+} /* End Frame_batch() */
+
+/* Calls @param fn with every length-prefixed datagram of a PER_BATCH payload, after the subtype */
+static int Frame_items(const uint8_t* payload, size_t len, void (*fn)(void*, const void*, size_t), void* user) {
+  uint16_t itemLen;
+  int count = 0;
+
+  while (len >= sizeof(uint16_t) && count < BATCH_MAX) {
+    memcpy(&itemLen, payload, sizeof(uint16_t));
+    itemLen = ntohs(itemLen);
+    if (itemLen > len - sizeof(uint16_t)) break;
+
+    fn(user, payload + sizeof(uint16_t), itemLen);
+    payload += sizeof(uint16_t) + itemLen;
+    len -= sizeof(uint16_t) + itemLen;
+    count++;
+  }
+  return count;
+}
+
+/**
+ * int Frame_unbatch(const void*, size_t, void (*)(void*, const void*, size_t), void*)
+ * Calls @param fn with every datagram packed in a PER_BATCH frame.
+ * @param buf: A received datagram
+ * @param user: Passed through to @param fn
+ * @return Number of datagrams, 0 if @param buf is not a batch
+ **/
+int Frame_unbatch(const void* buf, size_t len, void (*fn)(void* user, const void* item, size_t itemLen), void* user) {
+  const uint8_t* in = buf;
+  struct header head;
+  size_t offset = HEADER;
+  uint16_t extLen;
+
+  if (len < HEADER) return 0;
+  memcpy(&head, in, HEADER);
+  if (head.op != kPER) return 0;
+
+  if (head.z & Z_EXT) {
+    if (len < HEADER + sizeof(uint16_t)) return 0;
+    memcpy(&extLen, in + HEADER, sizeof(uint16_t));
+    if (extLen < sizeof(uint16_t) || extLen > len - HEADER) return 0;
+    offset += extLen;
+  }
+  if (head.length > len - offset) head.length = len - offset;
+  if (head.length < 1 || in[offset] != PER_BATCH) return 0;
+
+  return Frame_items(in + offset + 1, head.length - 1, fn, user);
+} /* End Frame_unbatch() */
+
+/* Memo key of a local answer whose signature is left for later, NULL if out of memory */
+static struct pending* Frame_pending(const char hash[SHA256_SIZE], const uint16_t* protocols,
+                                     uint64_t generation, int ttl) {
+  struct pending* ret;
+  size_t count;
+
+  for (count = 0; protocols[count] != 0; count++);
+
+  ret = calloc(1, sizeof(struct pending));
+  if (ret == NULL) return NULL;
+  ret->protocols = calloc(count + 1, sizeof(uint16_t));
+  if (ret->protocols == NULL) {
+    free(ret);
+    return NULL;
+  }
+  memcpy(ret->hash, hash, SHA256_SIZE);
+  memcpy(ret->protocols, protocols, count * sizeof(uint16_t));
+  ret->generation = generation;
+  ret->ttl = ttl;
+  return ret;
+}
+
+static void Frame_freePending(struct pending* pending) {
+  free(pending->protocols);
+  free(pending->buf);
+  free(pending);
 }
 
 /**
@@ -227,6 +813,7 @@ void Frame_free(Frame_T frame) {
   if (frame == NULL) return;
 
   if (frame->payload) free(frame->payload);
+  if (frame->pending) Frame_freePending(frame->pending);
   free(frame);
 } /* End Frame_free() */
 
@@ -234,23 +821,188 @@ void Frame_free(Frame_T frame) {
  **************** The Meat of the Program *************
  ******************************************************/
 
-/* Operation Codes */
-enum {
-  kSTD,
-  kREV,
-  kPER,
-  kMAL,
-  kNTF,
-  kPNG
-};
+/**
+ * bool Frame_seen(uint32_t, const char*)
+ * Records a recursive query, expiring those older than SEEN_TTL.
+ * @param hash: SHA256 of the query, so unrelated queries sharing a QID aren't confused
+ * @return true if the same query was already recursed recently
+ **/
+static bool Frame_seen(uint32_t qid, const char* hash) {
+  seen *found, *current, *tmp;
+  time_t now = time(NULL);
+  bool ret = false;
+  seen key;
+
+  memset(&key, 0, sizeof(seen));
+  key.key.qid = qid;
+  memcpy(key.key.hash, hash, SHA256_SIZE);
+
+  pthread_mutex_lock(&seenLock);
+
+  /* Prune Expired Entries Once a Second */
+  if (now != seenPruned) {
+    seenPruned = now;
+    HASH_ITER(hh, seenTable, current, tmp) {
+      if (now - current->when >= SEEN_TTL) {
+        HASH_DEL(seenTable, current);
+        free(current);
+      }
+    }
+  }
+
+  HASH_FIND(hh, seenTable, &(key.key), sizeof(key.key), found);
+  if (found != NULL) {
+    ret = true;
+  } else {
+    found = calloc(1, sizeof(seen));
+    if (found != NULL) {
+      found->key = key.key;
+      found->when = now;
+      HASH_ADD(hh, seenTable, key, sizeof(key.key), found);
+    }
+  }
+
+  pthread_mutex_unlock(&seenLock);
+  return ret;
+} /* End Frame_seen() */
+
+/**
+ * long Frame_budgetLeft(Frame_T)
+ * Charges the time since @param frame arrived, queueing included, against its budget.
+ * Frames without one get the old allowance of a second per recursion level.
+ * @return Milliseconds left to pass on to the next hop, after keeping back BUDGET_REPLY
+ **/
+static long Frame_budgetLeft(Frame_T frame) {
+  struct timespec now;
+  long budget, elapsed;
+
+  if ((frame->sHeader.z & Z_EXT) && frame->ext.budget)
+    budget = frame->ext.budget;
+  else
+    budget = (frame->sHeader.recurse + 1) * 1000L;
+  if (budget > UINT16_MAX) budget = UINT16_MAX;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - frame->arrived.tv_sec) * 1000L + (now.tv_nsec - frame->arrived.tv_nsec) / 1000000L;
+
+  return budget - elapsed - BUDGET_REPLY;
+}
+
+/**
+ * int Frame_recurse(Frame_T, Query_T, Response_T, long, int, const struct sockaddr_in*, const struct probe*)
+ * Forwards @param query to peers and merges their answers into @param resp.
+ * @param frame: The query's frame, its header and extension are sent as-is
+ * @param budget: Milliseconds to wait for answers
+ * @param fanout: Most servers to ask
+ * @param first: Server to ask first, NULL to pick the best peer
+ * @param probe: Summary bits of the query, may be NULL
+ * @return number of answers merged, negative on failure
+ **/
+static int Frame_recurse(Frame_T frame, Query_T query, Response_T resp, long budget, int fanout,
+                         const struct sockaddr_in* first, const struct probe* probe) {
+  uint8_t* recBuf;
+  size_t newRespLen, recLen = 0;
+  Recursor_T recursor;
+  struct sockaddr_in from;
+  const uint16_t* proto;
+  bool final, firstAnswered = false;
+  int answers = 0, verified;
+
+  /* Serialize and Recurse, Carrying the Visited Filter so Peers Skip Nodes Already Asked */
+  frame->sHeader.length = Query_size(query);
+  frame->sHeader.z |= Z_EXT;
+  frame->ext.budget = (uint16_t)budget;
+  recBuf = calloc(FRAME_MAX, sizeof(uint8_t));
+  if (recBuf == NULL) return -1;
+  free(frame->payload);
+  frame->payload = calloc(frame->sHeader.length, sizeof(uint8_t));
+  if (frame->payload != NULL) {
+    Query_serialize(query, frame->payload);
+    recLen = Frame_serialize(frame, recBuf, FRAME_MAX);
+  }
+  if (frame->payload == NULL || recLen == 0) {
+    free(recBuf);
+    return -1;
+  }
+
+  recursor = Recursor_init(recBuf, recLen, fanout, budget,
+                           HEADER + offsetof(struct extension, visited), first, probe);
+  free(recBuf);
+  if (recursor == NULL) return -1;
+
+  while((recBuf = (uint8_t*)Recursor_poll(recursor, &newRespLen, &from)) != NULL) {
+    struct frame answer;
+    struct header head;
+    Response_T src;
+
+    memset(&answer, 0, sizeof(struct frame));
+    if (Frame_parse(&answer, recBuf, newRespLen) < 0) {
+      free(answer.payload);
+      continue;
+    }
+    head = answer.sHeader;
+    if (head.op != kSTD || (head.z & Z_BUSY) || head.qid != frame->sHeader.qid) {
+      free(answer.payload);
+      continue;
+    }
+
+    src = Response_init(answer.payload, head.length);
+    free(answer.payload);
+    if (src == NULL) continue;
+
+    /* An Answer to Some Other Query Reusing Our QID Would Merge Foreign Records */
+    if (memcmp(Response_id(src), Query_id(query), SHA256_SIZE) != 0) {
+      Response_free(src);
+      continue;
+    }
+
+    /* Drop Answers Unsigned or Signed With Anything but the Host's Key, Before They Can Overwrite Ours */
+    verified = Verify_response(Query_host(query), src);
+    if (verified < 0) {
+      fprintf(stderr, "%s: Frame_recurse: Dropped an answer for %s with a missing or bad signature\n",
+              programName, Query_host(query));
+      Response_free(src);
+      continue;
+    }
+
+    Response_merge(resp, src);
+    final = head.aa || Response_isSigned(src);
+    Response_free(src);
+    answers++;
+
+    /* Relays Clear aa, so the Sender is the Host's Own Server, Proven by its Key */
+    if (head.aa && verified > 0) Directory_learn(Query_host(query), &from);
+    if (first != NULL && from.sin_addr.s_addr == first->sin_addr.s_addr && from.sin_port == first->sin_port)
+      firstAnswered = true;
+
+    /* Done Once an Answer is Final or Every Protocol is Covered, Stop Waiting on Slower Peers */
+    if (!final) {
+      final = true;
+      for (proto = Query_protocols(query); *proto != 0; proto++) {
+        if (!Response_hasProtocol(resp, *proto)) final = false;
+      }
+    }
+    if (final) {
+      Recursor_Timeout(recursor);
+      break;
+    }
+  }
+  Recursor_free(recursor);
+
+  /* The Server We Asked First Timed Out or Had No Answer, Stop Sending Straight to It */
+  if (first != NULL && !firstAnswered) Directory_forget(Query_host(query), first);
+
+  return answers;
+} /* End Frame_recurse() */
 
 /**
- * void Frame_responseSTD(Frame_T, Frame_T)
+ * void Frame_responseSTD(Frame_T, Frame_T, bool)
  * @param frame: A standard query to parse
  * @param response: filled with the standard response
+ * @param signLater: Leave signing a local answer to the signing threads, see Frame_thread()
  * @return None
  **/
-static void Frame_responseSTD(Frame_T frame, Frame_T response) {
+static void Frame_responseSTD(Frame_T frame, Frame_T response, bool signLater) {
   Query_T query;
   Response_T resp;
   const uint16_t* protocols;
@@ -258,7 +1010,10 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
   const uint16_t* proto;
   bool found = false;
   uint8_t respHead[SHA256_SIZE + sizeof(uint16_t)];
-  int error, count;
+  uint64_t generation;
+  size_t memoLen;
+  int error, count, minTTL = 0;
+  long budget;
 
   count = error = 0;
 
@@ -281,29 +1036,49 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
     return;
   }
 
-  /* First, Check Local Database for Results */
+  /* First, Reuse the Serialized Answer if None of the Host's Records Changed Since it was Built */
+  generation = Local_generation(Query_host(query));
+  response->payload = Memo_get(Query_id(query), protocols, generation, &memoLen);
+  if (response->payload != NULL) {
+    response->sHeader.length = memoLen;
+    response->sHeader.aa = 1;
+    Response_free(resp);
+    Query_free(query);
+    return;
+  }
+
+  /* Then Check Local Database for Results */
   for (proto = protocols; *proto != 0; proto++) {
     size_t len;
-    const char* encrypted;
+    int ttl = 0;
+    char* encrypted;
     
-    encrypted = Local_get((char*)respHead, *proto, &len);
+    encrypted = Local_get(Query_host(query), (char*)respHead, *proto, &len, &ttl);
     if (encrypted != NULL) {
-      error = Response_buildRecord(resp, *proto, encrypted, (uint16_t)len, Local_getTTL((char*)respHead, *proto));
+      error = Response_buildRecord(resp, *proto, encrypted, (uint16_t)len, (uint16_t)ttl);
+      free(encrypted);
       if (error < 0) {
         Response_free(resp);
         Query_free(query);
         response->sHeader.op = kNTF;
         return;
       }
+      if (!found || ttl < minTTL) minTTL = ttl;
       found = true;
     }
     count++;
   }
 
   if (found) {
-    /* Found in Local Database! Sign and Return */
+    /* Found in Local Database! Sign, Remember, and Return */
     response->sHeader.length = Response_size(resp);
-    /*error = Response_sign(resp, Local_getPrivkey()); */
+    if (Local_getSign() && signLater) {
+      /* Signed and Remembered Off This Thread, Once Serialized */
+      response->pending = Frame_pending(Query_id(query), protocols, generation, minTTL);
+      if (response->pending == NULL) error = -1;
+    } else if (Local_getSign()) {
+      error = Response_sign(resp, (const uint8_t*)Local_getPrivkey());
+    }
     response->payload = calloc(response->sHeader.length, sizeof(uint8_t));
     if (response->payload == NULL || error < 0) {
       if (response->payload) free(response->payload);
@@ -313,6 +1088,8 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
     } else {
       response->sHeader.aa = 1;
       Response_serialize(resp, response->payload);
+      if (response->pending == NULL)
+        Memo_put(Query_id(query), protocols, generation, response->payload, response->sHeader.length, minTTL);
     }
 
     Response_free(resp);
@@ -324,8 +1101,14 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
 
   if (!response->sHeader.aa) {
     
-    /* Make a Defensive Copy of Protocol List */
-    protocolCopy = calloc(count, sizeof(uint16_t));
+    /* Make a Defensive Copy of Protocol List, Keeping its 0 Terminator */
+    protocolCopy = calloc(count + 1, sizeof(uint16_t));
+    if (protocolCopy == NULL) {
+      Response_free(resp);
+      Query_free(query);
+      response->sHeader.op = kNTF;
+      return;
+    }
     memcpy(protocolCopy, protocols, count * sizeof(uint16_t));
     
     /* Check Cache */
@@ -336,8 +1119,10 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
       if (record != NULL) {
         Response_addRecord(resp, *proto, record);
         Query_rmProtocol(query, *proto);
+        free((void*)record);
       }
     }
+    free(protocolCopy);
 
     /* If we covered all the protocols, return! */
     protocols = Query_protocols(query);
@@ -359,52 +1144,62 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
     }
   }
 
-  /* If not in the Local File or the Cache, recurse the request if requested */
-  if (frame->sHeader.rd && frame->sHeader.recurse) {
-    uint8_t* recBuf;
-    size_t newRespLen;
-    Recursor_T recursor;
-
-    frame->sHeader.recurse--;
-    frame->sHeader.length = Query_size(query);
-    
-    
-    /* Serialize and Recurse */
-    recBuf = calloc(sizeof(struct header) + frame->sHeader.length, sizeof(uint8_t));
-    if (recBuf == NULL) {
-      Response_free(resp);
-      Query_free(query);
-      response->sHeader.op = kNTF;
-      return;
+  /* If not in the Local File or the Cache, recurse the request if requested, the client
+   * is still waiting, and the query didn't already reach us by another path */
+  budget = Frame_budgetLeft(frame);
+  if (frame->sHeader.rd && frame->sHeader.recurse && budget >= BUDGET_MIN &&
+      !Frame_seen(frame->sHeader.qid, Query_id(query))) {
+    struct sockaddr_in authority;
+    struct probe probe;
+    bool owner = true, direct;
+    int answers = 0;
+
+    /* Only Local Answers are Authoritative */
+    response->sHeader.aa = 0;
+
+    /* In a Cluster, Hand the Miss to the Record's Owner so it is Recursed and Cached Once */
+    if (!(frame->ext.flags & EXT_CLUSTER) && Cluster_owner(Query_id(query), &authority) == 1) {
+      uint8_t z = frame->sHeader.z;
+      uint16_t original = frame->ext.budget;
+      long forward;
+
+      /* Wait About as Long as the Owner Usually Takes, Keeping Half the Budget to Recurse Ourselves */
+      forward = (long)Peers_hedgeDelay(&authority);
+      if (forward > budget / 2) forward = budget / 2;
+      if (forward < BUDGET_MIN) forward = BUDGET_MIN;
+
+      owner = false;
+      frame->ext.flags |= EXT_CLUSTER;
+      answers = Frame_recurse(frame, query, resp, forward, 1, &authority, NULL);
+      frame->ext.flags &= ~EXT_CLUSTER;
+
+      /* Frame_recurse() Sent the Already Charged Budget, Charge Time Against What the Client Gave */
+      frame->sHeader.z = z;
+      frame->ext.budget = original;
+      budget = Frame_budgetLeft(frame);
     }
-    memcpy(recBuf, &(frame->sHeader), sizeof(struct header));
-    Query_serialize(query, recBuf + sizeof(struct header));
 
-    recursor = Recursor_init(recBuf, sizeof(struct header) + frame->sHeader.length, PEER_MAX, frame->sHeader.recurse + 1);
-    free(recBuf);
-    if (recursor == NULL) {
-      Response_free(resp);
-      Query_free(query);
-      response->sHeader.op = kNTF;
-      return;
-    }
-    while((recBuf = (uint8_t*)Recursor_poll(recursor, &newRespLen)) != NULL) {
-      Frame_T f;
-      Response_T src;
-      f = calloc(1, sizeof(struct frame));
-      if (f == NULL) continue;
-      memcpy(recBuf, &(f->sHeader), sizeof(struct header));
-      f->payload = recBuf + sizeof(struct header);
-      if (f->sHeader.op != kSTD || f->sHeader.z || f->sHeader.qid != frame->sHeader.qid) {
-        free(f); continue;
-      }
-      
-      src = Response_init(f->payload, f->sHeader.length);
-      if (src == NULL) {
-        free(f); continue;
-      }
+    /* Recurse Ourselves if We Own the Record, or its Owner had Nothing and the Client Still Waits */
+    if (answers == 0 && budget >= BUDGET_MIN) {
+      const uint16_t* missing = Query_protocols(query);
+
+      frame->sHeader.recurse--;
+
+      /* Ask the Host's Authoritative Server Directly When Known, Peers Only if it is Slow */
+      /* Otherwise Only Peers Whose Content Summary Matches */
+      direct = Directory_lookup(Query_host(query), &authority) == 0;
+      Summary_probe(Query_host(query), Query_id(query), &probe);
+      answers = Frame_recurse(frame, query, resp, budget, Local_getFanout(), direct ? &authority : NULL, &probe);
 
-      Response_merge(resp, src);
+      /* Cache What Recursion Found Until its TTL Runs Out */
+      for (proto = missing; owner && answers > 0 && *proto != 0; proto++) {
+        size_t len;
+        const void* record = Response_getRecord(resp, *proto, &len);
+
+        if (record == NULL) continue;
+        Cache_addUpdate(Query_id(query), *proto, (void*)record, len, Response_expires(resp, *proto));
+        free((void*)record);
+      }
     }
   }
 
@@ -434,76 +1229,510 @@ static void Frame_responseSTD(Frame_T frame, Frame_T response) {
 }
 
 /**
- * void* Frame_thread(void*)
- * @param arg: Socket and Frame to respond to
- * @return a pointer to the integer return value. MUST BE FREED!
+ * void Frame_responseUPD(Frame_T, Frame_T)
+ * @param frame: A signed record update to apply
+ * @param response: kUPD with an empty payload once applied, kMAL if the
+ *                  update can't be parsed, kNTF if it was rejected
+ * @return None
  **/
-static void* Frame_thread(void* arg) {
-  Socket_T socket;
+static void Frame_responseUPD(Frame_T frame, Frame_T response) {
+  Update_T update;
+
+  update = Update_init(frame->payload, frame->sHeader.length);
+  if (update == NULL) {
+    response->sHeader.op = kMAL;
+    return;
+  }
+
+  if (Local_update(update) < 0) {
+    response->sHeader.op = kNTF;
+  } else {
+    response->sHeader.aa = 1;
+  }
+
+  Update_free(update);
+}
+
+/**
+ * void Frame_responseXFR(Frame_T, Frame_T)
+ * @param frame: A secondary's zone transfer request
+ * @param response: filled with the next snapshot page or changes, kNTF if transfers are off,
+ *                  the requester is not a configured secondary or its MAC is wrong
+ * @return None
+ **/
+static void Frame_responseXFR(Frame_T frame, Frame_T response) {
+  size_t requestLen;
+  int len;
+
+  /* Unsealed or Unknown Requesters Learn Nothing About the Zone */
+  if (Frame_unseal(frame, &requestLen) < 0 || !frame->from.sin_family) {
+    response->sHeader.op = kNTF;
+    return;
+  }
+
+  response->payload = calloc(RESPONSE_ROOM, sizeof(uint8_t));
+  if (response->payload == NULL) {
+    response->sHeader.op = kNTF;
+    return;
+  }
+
+  len = Local_transfer(&(frame->from), frame->payload, requestLen, response->payload, RESPONSE_ROOM);
+  if (len < 0) {
+    free(response->payload);
+    response->payload = NULL;
+    response->sHeader.op = kNTF;
+    return;
+  }
+
+  response->sHeader.length = len;
+  response->sHeader.aa = 1;
+}
+
+/**
+ * int Frame_responseWarm(Frame_T, Frame_T)
+ * @param frame: A PER_WARM request for our hottest cache entries from a rank on
+ * @param response: filled with the next rank to ask for, 0 when done, then a chunk of entries,
+ *                  then with a peerkey set a MAC over the request and the chunk
+ * @return 0 on success, negative if malformed or its MAC is wrong
+ **/
+static int Frame_responseWarm(Frame_T frame, Frame_T response) {
+  uint16_t rank, next;
+  size_t more, len, room = RESPONSE_ROOM - 1 - sizeof(uint16_t);
+  int added;
+
+  /* The Request Is Sealed Like a Push, So Only Nodes Holding the Peerkey Get Answers */
+  if (Frame_unseal(frame, &len) < 0 || len != 1 + sizeof(uint16_t)) return -1;
+  memcpy(&rank, frame->payload + 1, sizeof(uint16_t));
+
+  /* Our Hottest Records Say What Our Clients Look Up, Only Share Them With Peers */
+  if (!frame->from.sin_family || !Peers_knows(&(frame->from))) return -1;
+
+  response->payload = calloc(RESPONSE_ROOM, sizeof(uint8_t));
+  if (response->payload == NULL) return -1;
+
+  if (Local_hasPeerKey()) room -= PEER_MAC;
+  added = Cache_hot(ntohs(rank), response->payload + 1 + sizeof(uint16_t), room, &more);
+  if (added < 0) return -1;
+
+  response->payload[0] = PER_WARM;
+  next = htons((uint16_t)more);
+  memcpy(response->payload + 1, &next, sizeof(uint16_t));
+  response->sHeader.length = 1 + sizeof(uint16_t) + added;
+
+  /* Bound to the Request, so a Chunk Can't Be Replayed as the Answer to Another */
+  if (Local_hasPeerKey()) {
+    if (Frame_replyMac(frame->payload, len, response->payload, response->sHeader.length,
+                       response->payload + response->sHeader.length) < 0) return -1;
+    response->sHeader.length += PEER_MAC;
+  }
+  return 0;
+}
+
+static Frame_T Frame_process(Frame_T frame, Socket_T socket);
+
+/* Wakes the batch thread as each member's answer is ready */
+struct batchwait {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  int done;
+};
+
+/* One query of a PER_BATCH frame, answered on its own thread */
+struct batchjob {
   Frame_T frame;
+  uint8_t* answer;
+  size_t len;
+  bool done;
+  bool sent;
+  bool started;
+  pthread_t thread;
+  struct batchwait* wait;
+};
+
+/* Collects the queries of a PER_BATCH frame */
+struct batchparse {
+  Frame_T batch;
+  struct batchjob* jobs;
+  int count;
+};
+
+/* Frame_items() callback, parses one query of a batch into its own frame; only standard queries are batched */
+static void Frame_batchItem(void* user, const void* item, size_t len) {
+  struct batchparse* parse = user;
+  Frame_T frame;
+
+  frame = Frame_init();
+  if (frame == NULL) return;
+  if (Frame_parse(frame, item, len) < 0 || frame->sHeader.version != LOCAL_VERSION || !frame->sHeader.qr ||
+      frame->sHeader.op != kSTD) {
+    Frame_free(frame);
+    return;
+  }
+
+  /* Budgets Run From When the Batch Arrived, Answers Go Back to Whoever Sent it */
+  frame->arrived = parse->batch->arrived;
+  frame->from = parse->batch->from;
+  parse->jobs[parse->count++].frame = frame;
+}
+
+/* Answers one query of a batch, serialized as Frame_thread() would send it */
+static void* Frame_batchThread(void* arg) {
+  struct batchjob* job = arg;
   Frame_T response;
-  int *ret;
-  int bad = 0;
-  uint8_t* resBuf;
-  struct threadarg *args = arg;
+  uint8_t* answer = NULL;
+  size_t len = 0;
+
+  response = Frame_process(job->frame, NULL);
+  if (response != NULL) {
+    answer = malloc(FRAME_MAX);
+    if (answer != NULL) len = Frame_serialize(response, answer, FRAME_MAX);
+    if (len == 0) {
+      free(answer);
+      answer = NULL;
+    }
+    Frame_free(response);
+  }
+  Frame_free(job->frame);
+  job->frame = NULL;
+  Frame_release();
+
+  pthread_mutex_lock(&(job->wait->lock));
+  job->answer = answer;
+  job->len = len;
+  job->done = true;
+  job->wait->done++;
+  pthread_cond_signal(&(job->wait->ready));
+  pthread_mutex_unlock(&(job->wait->lock));
+
+  return NULL;
+}
 
-  /* Fill Socket and Frame */
-  assert(arg != NULL);
-  socket = args->socket;
-  frame = args->frame;
-  ret = (int*)args;
-  *ret = -1;
+/* Sends @param count answers to @param to, packed into one batch when there are several */
+static void Frame_sendAnswers(Socket_T socket, const struct sockaddr_in* to, const void* const* items,
+                              const size_t* lens, int count) {
+  uint8_t buf[FRAME_MAX];
+  size_t len;
+
+  if (count == 1) {
+    Socket_sendto(socket, to, items[0], lens[0]);
+    return;
+  }
+  len = Frame_batch(buf, FRAME_MAX, items, lens, count, 0);
+  if (len > 0) Socket_sendto(socket, to, buf, len);
+}
+
+/**
+ * int Frame_flushAnswers(Socket_T, const struct sockaddr_in*, struct batchjob*, int)
+ * Sends every finished answer not yet sent, as few datagrams as fit. Wait lock must be held.
+ * @return Number of answers newly flushed
+ **/
+static int Frame_flushAnswers(Socket_T socket, const struct sockaddr_in* to, struct batchjob* jobs, int count) {
+  const void* items[BATCH_MAX];
+  size_t lens[BATCH_MAX];
+  size_t bytes = 0;
+  int i, n = 0, flushed = 0;
+
+  for (i = 0; i < count; i++) {
+    if (!jobs[i].done || jobs[i].sent) continue;
+    jobs[i].sent = true;
+    flushed++;
+    if (jobs[i].answer == NULL) continue;
+
+    if (n > 0 && bytes + sizeof(uint16_t) + jobs[i].len > BATCH_ROOM) {
+      Frame_sendAnswers(socket, to, items, lens, n);
+      n = 0;
+      bytes = 0;
+    }
+    items[n] = jobs[i].answer;
+    lens[n] = jobs[i].len;
+    bytes += sizeof(uint16_t) + jobs[i].len;
+    n++;
+  }
+  if (n > 0) Frame_sendAnswers(socket, to, items, lens, n);
+
+  return flushed;
+}
+
+/**
+ * int Frame_responseBatch(Frame_T, Socket_T)
+ * Answers every standard query packed in a PER_BATCH frame concurrently, sending
+ * the answers back batched as they finish, rather than waiting on the slowest.
+ * Each query takes a response slot, those over capacity are answered busy.
+ * @param frame: The batch, payload after the subtype
+ * @param socket: Answers are sent to the batch's source through it
+ * @return Number of queries answered, negative if malformed
+ **/
+static int Frame_responseBatch(Frame_T frame, Socket_T socket) {
+  struct batchwait wait;
+  struct batchparse parse;
+  struct timespec now;
+  long window;
+  int flushed = 0, i;
+
+  if (socket == NULL || frame->from.sin_family == 0) return -1;
+
+  parse.batch = frame;
+  parse.count = 0;
+  parse.jobs = calloc(BATCH_MAX, sizeof(struct batchjob));
+  if (parse.jobs == NULL) return -1;
+  Frame_items(frame->payload + 1, frame->sHeader.length - 1, Frame_batchItem, &parse);
+  if (parse.count == 0) {
+    free(parse.jobs);
+    return -1;
+  }
+
+  pthread_mutex_init(&(wait.lock), NULL);
+  pthread_cond_init(&(wait.ready), NULL);
+  wait.done = 0;
+
+  pthread_mutex_lock(&(wait.lock));
+  for (i = 0; i < parse.count; i++) {
+    parse.jobs[i].wait = &wait;
+
+    /* Each Query Takes a Response Slot Like Any Other, Those Over Capacity are Answered Busy */
+    if (!Frame_admit()) {
+      parse.jobs[i].answer = malloc(HEADER + sizeof(struct extension));
+      if (parse.jobs[i].answer != NULL)
+        parse.jobs[i].len = Frame_busy(&(parse.jobs[i].frame->sHeader), parse.jobs[i].answer,
+                                       HEADER + sizeof(struct extension));
+      if (parse.jobs[i].len == 0) {
+        free(parse.jobs[i].answer);
+        parse.jobs[i].answer = NULL;
+      }
+      Frame_free(parse.jobs[i].frame);
+      parse.jobs[i].frame = NULL;
+      parse.jobs[i].done = true;
+      wait.done++;
+      continue;
+    }
+
+    parse.jobs[i].started = pthread_create(&(parse.jobs[i].thread), NULL, Frame_batchThread, &(parse.jobs[i])) == 0;
+    if (!parse.jobs[i].started) {
+      Frame_release();
+      Frame_free(parse.jobs[i].frame);
+      parse.jobs[i].frame = NULL;
+      parse.jobs[i].done = true;
+      wait.done++;
+    }
+  }
+
+  /* Send Answers as They Finish, Holding Each for the Batching Window so Others Can Join it */
+  window = Local_getBatch();
+  while (flushed < parse.count) {
+    while (wait.done == flushed) pthread_cond_wait(&(wait.ready), &(wait.lock));
+
+    if (window > 0 && wait.done < parse.count) {
+      clock_gettime(CLOCK_REALTIME, &now);
+      now.tv_nsec += window * 1000L;
+      now.tv_sec += now.tv_nsec / 1000000000L;
+      now.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&(wait.ready), &(wait.lock), &now);
+    }
+    flushed += Frame_flushAnswers(socket, &(frame->from), parse.jobs, parse.count);
+  }
+  pthread_mutex_unlock(&(wait.lock));
+
+  for (i = 0; i < parse.count; i++) {
+    if (parse.jobs[i].started) pthread_join(parse.jobs[i].thread, NULL);
+    free(parse.jobs[i].answer);
+  }
+  pthread_cond_destroy(&(wait.ready));
+  pthread_mutex_destroy(&(wait.lock));
+  free(parse.jobs);
+
+  return parse.count;
+} /* End Frame_responseBatch() */
+
+/**
+ * void Frame_responsePER(Frame_T, Frame_T, Socket_T)
+ * @param frame: A peer exchange message, dispatched on its PER_ subtype
+ * @param response: kPER once accepted, with our peer list for PER_LIST, kMAL if malformed
+ * @param socket: Where @param frame arrived, NULL when answering one query of a batch
+ * @return None
+ **/
+static void Frame_responsePER(Frame_T frame, Frame_T response, Socket_T socket) {
+  size_t len;
+  int error = -1;
+
+  if (frame->sHeader.length < 1) {
+    response->sHeader.op = kMAL;
+    return;
+  }
+
+  switch (frame->payload[0]) {
+  case PER_FILTER: /* Content Summary */
+    if (Frame_unseal(frame, &len) < 0) {
+      fprintf(stderr, "%s: Frame_responsePER: Dropped a summary with a bad MAC\n", programName);
+      break;
+    }
+    error = Summary_receive(frame->from.sin_family ? &(frame->from) : NULL, frame->payload + 1, len - 1);
+    break;
+  case PER_BATCH: /* Queries Bound for Us, Answered Separately */
+    error = Frame_responseBatch(frame, socket);
+    break;
+  case PER_LIST: /* Peer List, Answered with Ours */
+    response->payload = calloc(RESPONSE_ROOM, sizeof(uint8_t));
+    if (response->payload == NULL) break;
+    error = Discovery_answer(frame->from.sin_family ? &(frame->from) : NULL, frame->payload + 1,
+                             frame->sHeader.length - 1, response->payload, RESPONSE_ROOM);
+    if (error >= 0) response->sHeader.length = error;
+    break;
+  case PER_WARM: /* Our Hottest Cache Entries, a Chunk at a Time */
+    error = Frame_responseWarm(frame, response);
+    break;
+  case PER_GOSSIP: /* Fresh Records From an Anycast Sibling */
+    if (Frame_unseal(frame, &len) < 0) {
+      fprintf(stderr, "%s: Frame_responsePER: Dropped gossip with a bad MAC\n", programName);
+      break;
+    }
+    error = Gossip_receive(frame->from.sin_family ? &(frame->from) : NULL, frame->payload + 1, len - 1);
+    break;
+  }
+
+  if (error < 0) response->sHeader.op = kMAL;
+}
+
+/**
+ * Frame_T Frame_process(Frame_T, Socket_T)
+ * Validates @param frame and builds its response.
+ * @param socket: Where @param frame arrived, NULL when answering one query of a batch
+ * @return The response, or NULL if out of memory
+ **/
+static Frame_T Frame_process(Frame_T frame, Socket_T socket) {
+  Frame_T response;
 
   /* Make Response Frame */
-  response = malloc(sizeof(Frame_T));
-  if (response == NULL) return ret;
+  response = malloc(sizeof(struct frame));
+  if (response == NULL) return NULL;
   *response = *frame;
   response->sHeader.qr = 0; /* Response */
   response->sHeader.length = 0;
   response->payload = NULL;
+  response->pending = NULL;
+
+  /* Responses Carry our Load, so Recursing Peers Can Spread Away From Us, but
+   * Only to Senders Whose Query Had the Extension and so Can Parse One Back */
+  memset(&(response->ext), 0, sizeof(struct extension));
+  response->sHeader.z = frame->sHeader.z & Z_EXT;
+  response->ext.load = Frame_loadHint();
 
   /* Validate Frame Header */
-  if (frame->sHeader.z) bad = 1;
-  if (!frame->sHeader.qr) bad = 1;
-  if (bad) {
+  if ((frame->sHeader.z & ~Z_EXT) || !frame->sHeader.qr) {
     response->sHeader.op = kMAL;
-    *ret = Socket_respond(socket, &response->sHeader, HEADER);
-    free(response);
-    Frame_free(frame);
-    Frame_free(response);
-    return ret;
+    return response;
   }
 
   /* Op Code Mux */
   switch (frame->sHeader.op) {
   case kSTD: /* Standard Query */
-    Frame_responseSTD(frame, response);
+    Frame_responseSTD(frame, response, socket != NULL);
     break;
   case kREV: /* TODO: Currently Unsupported */
     response->sHeader.op = kNTF;
     break;
-  case kPER:
+  case kPER: /* Peer Exchange */
+    Frame_responsePER(frame, response, socket);
     break;
   case kPNG:
     break;
+  case kUPD: /* Record Update */
+    Frame_responseUPD(frame, response);
+    break;
+  case kXFR: /* Zone Transfer */
+    Frame_responseXFR(frame, response);
+    break;
   default:
     response->sHeader.op = kMAL;
   }
 
-  /* Serialize and Send Response */
-  resBuf = calloc(HEADER + response->sHeader.length, sizeof(uint8_t));
-  if (resBuf == NULL) {
-    response->sHeader.op = kNTF;
-    *ret = Socket_respond(socket, &(response->sHeader), HEADER);
+  return response;
+} /* End Frame_process() */
+
+/* Send a local answer once signed, and remember it for the next query */
+static void Frame_signed(void* user, int error) {
+  struct pending* pending = user;
+  struct header head;
+  uint8_t* payload = pending->buf + pending->offset;
+
+  if (error < 0) {
+    fprintf(stderr, "%s: Frame_signed: Could not sign answer\n", programName);
+    memcpy(&head, pending->buf, HEADER);
+    head.op = kNTF;
+    head.z = 0;
+    head.length = 0;
+    Socket_respond(pending->socket, &head, HEADER);
   } else {
-    memcpy(resBuf, &(response->sHeader), HEADER);
-    memcpy(resBuf + HEADER, response->payload, response->sHeader.length);
-    *ret = Socket_respond(socket, resBuf, sizeof(struct header) + response->sHeader.length);
+    Socket_respond(pending->socket, pending->buf, pending->len);
+    Memo_put(pending->hash, pending->protocols, pending->generation, payload, pending->len - pending->offset, pending->ttl);
+  }
+  Frame_freePending(pending);
+}
+
+/**
+ * int Frame_signLater(Frame_T, Socket_T, uint8_t*, size_t)
+ * Hands a serialized local answer to the signing threads, which send it once
+ * signed. If they are busy or not running, it is signed and sent here instead.
+ * @param buf: @param response serialized, taken over and freed once sent
+ * @return 0, the answer is sent either way
+ **/
+static int Frame_signLater(Frame_T response, Socket_T socket, uint8_t* buf, size_t len) {
+  struct pending* pending = response->pending;
+
+  response->pending = NULL;
+  pending->socket = socket;
+  pending->buf = buf;
+  pending->len = len;
+  pending->offset = len - response->sHeader.length;
+
+  if (Signer_submit(buf + pending->offset, response->sHeader.length, Frame_signed, pending) < 0)
+    Frame_signed(pending, Response_signBuffer(buf + pending->offset, response->sHeader.length,
+                                              (const uint8_t*)Local_getPrivkey()));
+  return 0;
+}
+
+/**
+ * void* Frame_thread(void*)
+ * @param arg: Socket and Frame to respond to
+ * @return a pointer to the integer return value. MUST BE FREED!
+ **/
+static void* Frame_thread(void* arg) {
+  Socket_T socket;
+  Frame_T frame;
+  Frame_T response;
+  int *ret;
+  uint8_t* resBuf;
+  size_t resLen;
+  struct threadarg *args = arg;
+
+  /* Fill Socket and Frame */
+  assert(arg != NULL);
+  socket = args->socket;
+  frame = args->frame;
+  ret = (int*)args;
+  *ret = -1;
+
+  response = Frame_process(frame, socket);
+  if (response != NULL) {
+    /* Serialize and Send Response */
+    resBuf = calloc(FRAME_MAX, sizeof(uint8_t));
+    resLen = resBuf != NULL ? Frame_serialize(response, resBuf, FRAME_MAX) : 0;
+    if (resLen == 0) {
+      response->sHeader.op = kNTF;
+      response->sHeader.z = 0;
+      *ret = Socket_respond(socket, &(response->sHeader), HEADER);
+    } else if (response->pending != NULL) {
+      /* Sent Once Signed, Without Holding This Thread */
+      *ret = Frame_signLater(response, socket, resBuf, resLen);
+      resBuf = NULL;
+    } else {
+      *ret = Socket_respond(socket, resBuf, resLen);
+    }
+    Frame_free(response);
+    free(resBuf);
   }
 
   Frame_free(frame);
-  Frame_free(response);
-  free(resBuf);
+  Frame_release();
   return ret;
 } /* End Frame_thread() */
 
@@ -540,6 +1769,12 @@ void Frame_printInfo(Frame_T frame) {
   case kPNG:
     puts("Ping");
     break;
+  case kUPD:
+    puts("Update");
+    break;
+  case kXFR:
+    puts("Zone Transfer");
+    break;
   default:
     puts("Unknown");
   }
@@ -548,6 +1783,9 @@ void Frame_printInfo(Frame_T frame) {
   if (frame->sHeader.aa) puts("Authoritative: Yes");
   else puts("Authoritative: No");
 
+  if (frame->sHeader.z & Z_BUSY) puts("Busy: Yes, ask another server");
+  if (!frame->sHeader.qr && (frame->sHeader.z & Z_EXT)) printf("Server Load: %d%%\n", frame->ext.load);
+
   if (frame->sHeader.rd)
     printf("Recursion requested to depth %d.", frame->sHeader.recurse);
 
@@ -7,21 +7,47 @@
 #ifndef FRAME_H
 #define FRAME_H
 
+#include <stdbool.h>
 #include <pthread.h>
 
 /* Local files */
 #include "network/socket.h"
+#include "signer.h"
 #include "network/recursor.h"
+#include "network/directory.h"
+#include "network/verify.h"
+#include "network/summary.h"
+#include "network/cluster.h"
+#include "network/health.h"
+#include "network/discovery.h"
+#include "network/warm.h"
+#include "network/gossip.h"
 
 #include "data/cache.h"
+#include "data/memo.h"
 #include "data/local.h"
 
 #include "object/query.h"
 #include "object/response.h"
+#include "object/update.h"
 
 /* Holds Frame header and payload. */
 typedef struct frame *Frame_T;
 
+/* Peer exchange (kPER) subtypes, the first payload byte */
+#define PER_FILTER 1
+#define PER_BATCH 2
+#define PER_LIST 3
+#define PER_WARM 4
+#define PER_GOSSIP 5
+
+/* Most datagrams in one PER_BATCH frame, and the bytes they may take with
+ * their 16-bit length prefixes: FRAME_MAX less the header and subtype */
+#define BATCH_MAX 64
+#define BATCH_ROOM 1459
+/* HMAC-SHA256 trailing pushes when a peerkey is set */
+#define PEER_MAC 32
+
 /**
  * Frame_T Frame_init(void)
  * Allocates a new Frame in the heap. 
@@ -40,6 +66,65 @@ Frame_T Frame_init(void);
  **/
 Frame_T Frame_buildQuery(int authoritative, int recurseDepth, const void* payload, size_t payLen);
 
+/**
+ * Frame_T Frame_buildUpdate(const void*, size_t)
+ * @param payload: A serialized, signed Update
+ * @param payLen: Length of @param payload
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildUpdate(const void* payload, size_t payLen);
+
+/**
+ * Frame_T Frame_buildTransfer(const void*, size_t)
+ * @param payload: A zone transfer request from Local_transferRequest()
+ * @param payLen: Length of @param payload
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildTransfer(const void* payload, size_t payLen);
+
+/**
+ * Frame_T Frame_buildPeer(const void*, size_t)
+ * @param payload: A peer exchange message, starting with its PER_ subtype
+ * @param payLen: Length of @param payload
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildPeer(const void* payload, size_t payLen);
+
+/**
+ * Frame_T Frame_buildPush(const void*, size_t)
+ * Like Frame_buildPeer(), for pushes that change what the receiver believes
+ * about us. With a peerkey set, @param payload is followed by its MAC.
+ * @return a new Frame, or NULL on failure
+ **/
+Frame_T Frame_buildPush(const void* payload, size_t payLen);
+
+/**
+ * Frame_T Frame_buildPing(void)
+ * @return a new, empty kPNG Frame, or NULL on failure
+ **/
+Frame_T Frame_buildPing(void);
+
+/**
+ * void Frame_setBudget(Frame_T, uint16_t)
+ * @param budget: Milliseconds the sender will wait for the answer, recursing
+ *                nodes give up once it is spent
+ * @return None
+ **/
+void Frame_setBudget(Frame_T frame, uint16_t budget);
+
+/**
+ * uint32_t Frame_getQID(Frame_T)
+ * @return Query ID shared by a query and its response
+ **/
+uint32_t Frame_getQID(Frame_T frame);
+
+/**
+ * bool Frame_isApplied(Frame_T)
+ * @return true when the frame acknowledges an update: a kUPD response the server marked
+ *         authoritative. kNTF, kMAL and anything else mean the update was not applied.
+ **/
+bool Frame_isApplied(Frame_T frame);
+
 /**
  * const uint8_t Frame_getPayload(Frame_T, uint16_t*)
  * @param frame: To get the payload, can't be NULL
@@ -48,6 +133,16 @@ Frame_T Frame_buildQuery(int authoritative, int recurseDepth, const void* payloa
  **/
 const uint8_t* Frame_getPayload(Frame_T frame, uint16_t* len);
 
+/**
+ * const uint8_t* Frame_getSealedPayload(Frame_T, const void*, size_t, uint16_t*)
+ * Like Frame_getPayload(), for a response a peer sealed against the request it
+ * answers. Without a peerkey, the payload is returned as is.
+ * @param request, requestLen: Payload of the request @param frame answers, without its MAC
+ * @param len: Value Parameter, overwritten with length of payload without its MAC
+ * @return pointer to the payload buffer, NULL if its MAC is missing or wrong
+ **/
+const uint8_t* Frame_getSealedPayload(Frame_T frame, const void* request, size_t requestLen, uint16_t* len);
+
 /**
  * void Frame_printInfo(Frame_T)
  * @param frame: To print
@@ -75,6 +170,31 @@ int Frame_listen(Frame_T dest, Socket_T socket, int timeout);
  **/
 pthread_t* Frame_respond(Frame_T frame, Socket_T socket);
 
+/**
+ * int Frame_shed(Frame_T, Socket_T, int)
+ * Answers a standard query with a busy response instead of queueing it when
+ * every response thread is taken, so the sender asks another node at once.
+ * @param capacity: Most response threads the daemon runs, the load hint's 100%
+ * @return 1 if @param frame was answered busy and should be freed, 0 to respond as usual
+ **/
+int Frame_shed(Frame_T frame, Socket_T socket, int capacity);
+
+/**
+ * int Frame_load(const void*, size_t, bool*)
+ * Reads the load a responder reported, without parsing the whole datagram.
+ * @param buf: A received response
+ * @param busy: Overwritten with whether the responder turned the query away
+ * @return Percent of the responder's capacity in use, negative if it did not say
+ **/
+int Frame_load(const void* buf, size_t len, bool* busy);
+
+/**
+ * bool Frame_isAnswer(const void*, size_t)
+ * @param buf: A received response
+ * @return true if @param buf is a standard answer, false for kNTF, busy and other non-answers
+ **/
+bool Frame_isAnswer(const void* buf, size_t len);
+
 /**
  * int Frame_send(Frame_T, Socket_T, const char* uint16_t)
  * @param frame: To serialize and Send
@@ -84,6 +204,27 @@ pthread_t* Frame_respond(Frame_T frame, Socket_T socket);
  **/
 int Frame_send(Frame_T frame, Socket_T socket, const char* ip, uint16_t port);
 
+/**
+ * size_t Frame_batch(void*, size_t, const void* const*, const size_t*, int, int)
+ * Packs datagrams bound for the same node into one PER_BATCH frame.
+ * @param buf: Overwritten with the batch datagram
+ * @param bufLen: Size of @param buf
+ * @param items: Serialized frames, @param lens long
+ * @param count: Number of @param items, at most BATCH_MAX
+ * @param query: Nonzero for a batch of queries, 0 for a batch of answers
+ * @return Bytes written to @param buf, 0 if they do not fit
+ **/
+size_t Frame_batch(void* buf, size_t bufLen, const void* const* items, const size_t* lens, int count, int query);
+
+/**
+ * int Frame_unbatch(const void*, size_t, void (*)(void*, const void*, size_t), void*)
+ * Calls @param fn with every datagram packed in a PER_BATCH frame.
+ * @param buf: A received datagram
+ * @param user: Passed through to @param fn
+ * @return Number of datagrams, 0 if @param buf is not a batch
+ **/
+int Frame_unbatch(const void* buf, size_t len, void (*fn)(void* user, const void* item, size_t itemLen), void* user);
+
 /**
  * void Frame_free(Frame_T)
  * @param frame: Frame to completely clean up and de-allocate.
@@ -9,14 +9,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <time.h>
 
 /* Local Files */
 #include "uthash.h"
 #include "frame.h"
 #include "signal.h"
+#include "signer.h"
 #include "network/socket.h"
 #include "network/peers.h"
+#include "network/recursor.h"
+#include "network/directory.h"
+#include "network/verify.h"
+#include "network/summary.h"
+#include "network/cluster.h"
+#include "network/health.h"
+#include "network/discovery.h"
+#include "network/warm.h"
+#include "network/gossip.h"
+#include "network/transfer.h"
 #include "data/cache.h"
+#include "data/memo.h"
 #include "data/local.h"
 
 struct thread_container {
@@ -33,15 +46,19 @@ volatile bool isRunning;
 char* programName;
 
 /* File Constants */
-#define PORT 5001
 #define MAX_THREAD 10
+/* Seconds between reports of queries turned away busy */
+#define SHED_REPORT 60
 
 int main(int argc, char** argv) {
   Frame_T frame = NULL;
   Socket_T socket = NULL;
   int error = 0;
+  int status = EXIT_FAILURE;
   int count = 0;
   struct thread_container *head, *current, *tmp;
+  unsigned long shed = 0, shedReported = 0;
+  time_t shedAt = time(NULL);
   head = NULL;
 
   isRunning = true;
@@ -74,13 +91,112 @@ int main(int argc, char** argv) {
   }
   printf("%s: main: Loaded %d cache entries from config/cache.dat...\n", programName, error);
 
+  /* Initialize Known Peers */
+  error = Peers_init("config/peers.dat");
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not initialize peer list.\n", programName);
+    return EXIT_FAILURE;
+  }
+  printf("%s: main: Loaded %d peers from config/peers.dat...\n", programName, error);
+
+  /* Initialize Authoritative Server Directory */
+  error = Directory_init("config/directory.dat");
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not initialize server directory.\n", programName);
+    return EXIT_FAILURE;
+  }
+  printf("%s: main: Loaded %d hosts from config/directory.dat...\n", programName, error);
+
+  /* Load Host Keys, if Signed Answers are Verified */
+  error = Verify_init("config/hostkeys.dat", Local_getVerify());
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not load host keys.\n", programName);
+    return EXIT_FAILURE;
+  }
+  if (error > 0) printf("%s: main: Verifying answers for %d hosts from config/hostkeys.dat...\n", programName, error);
+
+  /* Initialize Cache Partitioning, if this Node is in a Cluster */
+  error = Cluster_init("config/cluster.dat", Local_getCluster());
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not initialize cluster ring.\n", programName);
+    return EXIT_FAILURE;
+  }
+  if (error > 0) printf("%s: main: Partitioning cache across %d cluster nodes...\n", programName, error);
+
+  /* Load Anycast Siblings, if Gossip is On */
+  error = Gossip_init("config/siblings.dat", Local_getGossip());
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not load anycast siblings.\n", programName);
+    return EXIT_FAILURE;
+  }
+  if (error > 0) printf("%s: main: Gossiping fresh records with %d siblings...\n", programName, error);
+
+  /* Sign Local Answers on Dedicated Threads, if Signing is On */
+  if (Local_getSign()) {
+    error = Signer_start((const uint8_t*)Local_getPrivkey(), Local_getSigners());
+    if (error < 0) {
+      fprintf(stderr, "%s: main: Could not start signing threads.\n", programName);
+      goto stop;
+    }
+    printf("%s: main: Signing local answers on %d threads...\n", programName, Local_getSigners());
+  }
+
+  /* Initialize Shared Recursion Socket */
+  error = Recursor_start(Local_getBatch());
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not initialize recursion socket.\n", programName);
+    goto stop;
+  }
+
   /* Initialize Server UDP Socket */
-  socket = Socket_init(PORT);
+  socket = Socket_init(MARP_PORT);
   if (socket == NULL) {
     fprintf(stderr, "%s: main: Could not initialize socket.\n", programName);
-    return EXIT_FAILURE;
+    goto stop;
+  }
+  printf("%s: main: Server started on port %d...\n\n", programName, MARP_PORT);
+
+  /* Replicate from the Primary, if this is a Secondary */
+  error = Transfer_start();
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not start zone transfers.\n", programName);
+    goto stop;
+  }
+
+  /* Publish Our Content Summary to Peers */
+  error = Summary_start();
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not start content summaries.\n", programName);
+    goto stop;
+  }
+
+  /* Ping Peers so Dead Ones Stop Costing Recursion Timeouts */
+  error = Health_start();
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not start peer health checks.\n", programName);
+    goto stop;
+  }
+
+  /* Trade Peer Lists so the Mesh Grows Beyond config/peers.dat */
+  error = Discovery_start();
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not start peer discovery.\n", programName);
+    goto stop;
+  }
+
+  /* Pull Peers' Hottest Records While We Start Serving, Rather Than Recurse for All of Them */
+  error = Warm_start();
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not start cache warm-up.\n", programName);
+    goto stop;
+  }
+
+  /* Share Newly Cached, Often Looked-Up Records with Anycast Siblings */
+  error = Gossip_start();
+  if (error < 0) {
+    fprintf(stderr, "%s: main: Could not start cache gossip.\n", programName);
+    goto stop;
   }
-  printf("%s: main: Server started on port %d...\n\n", programName, PORT);
 
   fflush(stdout);
 
@@ -98,6 +214,10 @@ int main(int argc, char** argv) {
 
     if (error < 0 || !isRunning) {
       Frame_free(frame);
+    } else if (Frame_shed(frame, socket, MAX_THREAD) > 0) {
+      /* Every Thread Busy, Told the Sender to Ask Elsewhere */
+      shed++;
+      Frame_free(frame);
     } else {
       /* Prepare Thread Pool */
       printf("%s: main: Received new query...\n", programName);
@@ -135,8 +255,19 @@ int main(int argc, char** argv) {
     }
     count++;
     count %= MAX_THREAD;
+
+    /* Report Shedding Once in a While, Printing Each Would Only Add to the Load */
+    if (time(NULL) - shedAt >= SHED_REPORT) {
+      if (shed != shedReported)
+        printf("%s: main: Busy, turned %lu queries away in the last %d seconds...\n",
+               programName, shed - shedReported, (int)(time(NULL) - shedAt));
+      shedReported = shed;
+      shedAt = time(NULL);
+    }
   }
 
+  if (shed > 0) printf("%s: main: Busy, turned %lu queries away in all...\n", programName, shed);
+
   /* Destroy Thread Pool */
   printf("%s: main: Waiting for threads to exit...\n", programName);
   HASH_ITER(hh, head, current, tmp) {
@@ -147,9 +278,21 @@ int main(int argc, char** argv) {
     free(current->thread);
     free(current);
   }
+  status = EXIT_SUCCESS;
 
-  /* Destroy Server UDP Socket */
+stop:
+  /* Stop Everything Started, Newest First; Each Stop is a No-op if it Never Started */
+  isRunning = false;
+  Gossip_stop();
+  Warm_stop();
+  Discovery_stop();
+  Health_stop();
+  Summary_stop();
+  Transfer_stop();
   Socket_free(socket);
+  Recursor_stop();
+  Signer_stop();
+  if (status != EXIT_SUCCESS) return status;
 
   /* Destroy In-Memory Cache */
   error = Cache_dump("config/cache.dat");
@@ -158,6 +301,23 @@ int main(int argc, char** argv) {
   else printf("%s: main: Dumped %d records to cache file config/cache.dat...\n", programName, error);
 
   Cache_destroy();
+  Memo_destroy();
+
+  /* Persist Discovered Peers */
+  error = Peers_dump("config/peers.dat");
+  if (error < 0)
+    fprintf(stderr, "%s: main: Peer dump to file config/peers.dat failed!", programName);
+  else printf("%s: main: Dumped %d peers to peer file config/peers.dat...\n", programName, error);
+  Peers_destroy();
+
+  /* Persist Learned Authoritative Servers */
+  error = Directory_dump("config/directory.dat");
+  if (error < 0)
+    fprintf(stderr, "%s: main: Directory dump to file config/directory.dat failed!", programName);
+  else printf("%s: main: Dumped %d hosts to directory file config/directory.dat...\n", programName, error);
+  Directory_destroy();
+  Verify_destroy();
+  Cluster_destroy();
 
   /* Destroy Local Config File Data */
   Local_destroy();
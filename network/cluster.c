@@ -0,0 +1,210 @@
+/**
+ * File: cluster.c
+ * Author: Ethan Gordon
+ * Consistent-hash ring over the nodes of a marpd cluster, so each record's
+ * misses are recursed for and cached at one owner node. (Abstract Object)
+ **/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "cluster.h"
+#include "peers.h"
+#include "../libsha2/sha256.h"
+
+extern char* programName;
+
+/* Points per member, enough to spread keys within a few percent of evenly */
+#define VNODES 64
+#define MAX_LINE 32
+#define MAX_MEMBERS 256
+
+/* A point on the ring, owned by members[member] */
+struct point {
+  uint64_t position;
+  int member;
+};
+
+static struct {
+  struct sockaddr_in* members;
+  int count;
+  /* Index of this node in members */
+  int self;
+  /* Sorted by position */
+  struct point* ring;
+  size_t points;
+} cluster = { NULL, 0, -1, NULL, 0 };
+
+/* First 8 bytes of @param hash, big-endian, as a ring position */
+static uint64_t Cluster_position(const uint8_t* hash) {
+  uint64_t ret = 0;
+  int i;
+
+  for (i = 0; i < 8; i++) ret = (ret << 8) | hash[i];
+  return ret;
+}
+
+static int Cluster_compare(const void* a, const void* b) {
+  uint64_t x = ((const struct point*)a)->position;
+  uint64_t y = ((const struct point*)b)->position;
+  return (x > y) - (x < y);
+}
+
+/* Parse "<ip>:<port>" into @param addr */
+static int Cluster_parse(const char* hostport, struct sockaddr_in* addr) {
+  char buf[MAX_LINE];
+  char* port;
+
+  if (strlen(hostport) >= MAX_LINE) return -1;
+  strcpy(buf, hostport);
+  buf[strcspn(buf, " \t\r\n")] = '\0';
+
+  port = strrchr(buf, ':');
+  if (port == NULL) return -1;
+  *port++ = '\0';
+
+  memset(addr, 0, sizeof(struct sockaddr_in));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons((uint16_t)atoi(port));
+  if (inet_pton(AF_INET, buf, &(addr->sin_addr)) != 1) return -1;
+  return 0;
+}
+
+/**
+ * int Cluster_init(const char*, const char*)
+ * @param file: Newline-delimited <ip>:<port> of every cluster member, this node included
+ * @param self: This node's <ip>:<port> on the ring, NULL disables cluster mode
+ * @return number of members on success, 0 if disabled, negative on failure
+ **/
+int Cluster_init(const char* file, const char* self) {
+  struct sockaddr_in me;
+  char line[MAX_LINE];
+  FILE* in;
+  int i, v;
+
+  if (self == NULL) return 0;
+  if (Cluster_parse(self, &me) < 0) {
+    fprintf(stderr, "%s: Cluster_init: Invalid cluster address %s\n", programName, self);
+    return -1;
+  }
+
+  in = fopen(file, "r");
+  if (in == NULL) {
+    perror(programName);
+    return -1;
+  }
+
+  cluster.members = calloc(MAX_MEMBERS, sizeof(struct sockaddr_in));
+  if (cluster.members == NULL) {
+    fclose(in);
+    return -1;
+  }
+
+  while (cluster.count < MAX_MEMBERS && fgets(line, MAX_LINE, in) != NULL) {
+    struct sockaddr_in* member = &(cluster.members[cluster.count]);
+
+    if (line[0] == '#' || line[0] == ';' || line[0] == '\n') continue;
+    if (Cluster_parse(line, member) < 0) continue;
+
+    /* Skip Duplicates, They Would Skew the Ring */
+    for (i = 0; i < cluster.count; i++) {
+      if (cluster.members[i].sin_addr.s_addr == member->sin_addr.s_addr &&
+          cluster.members[i].sin_port == member->sin_port) break;
+    }
+    if (i < cluster.count) continue;
+
+    if (member->sin_addr.s_addr == me.sin_addr.s_addr && member->sin_port == me.sin_port)
+      cluster.self = cluster.count;
+    cluster.count++;
+  }
+  fclose(in);
+
+  if (cluster.self < 0) {
+    fprintf(stderr, "%s: Cluster_init: %s is not listed in %s\n", programName, self, file);
+    Cluster_destroy();
+    return -1;
+  }
+
+  /* Place Every Member's Virtual Nodes, Each at the Hash of "<ip>:<port>#<n>" */
+  cluster.ring = calloc(cluster.count * VNODES, sizeof(struct point));
+  if (cluster.ring == NULL) {
+    Cluster_destroy();
+    return -1;
+  }
+  for (i = 0; i < cluster.count; i++) {
+    char ip[INET_ADDRSTRLEN];
+    char name[INET_ADDRSTRLEN + 16];
+    uint8_t digest[SHA256_SIZE];
+
+    inet_ntop(AF_INET, &(cluster.members[i].sin_addr), ip, INET_ADDRSTRLEN);
+    for (v = 0; v < VNODES; v++) {
+      int len = snprintf(name, sizeof(name), "%s:%d#%d", ip, ntohs(cluster.members[i].sin_port), v);
+      sha256_simple((const uint8_t*)name, len, digest);
+      cluster.ring[cluster.points].position = Cluster_position(digest);
+      cluster.ring[cluster.points].member = i;
+      cluster.points++;
+    }
+  }
+  qsort(cluster.ring, cluster.points, sizeof(struct point), Cluster_compare);
+
+  return cluster.count;
+} /* End Cluster_init() */
+
+/**
+ * int Cluster_owner(const char*, struct sockaddr_in*)
+ * The owner is the first member clockwise of @param hash on the ring that
+ * health checks haven't marked dead, so a dead owner's records fall to the
+ * next member until it answers again.
+ * @param hash: Query_id() of the record
+ * @param owner: Overwritten with the owning node if it is not this one
+ * @return 1 if another node owns @param hash, 0 if this node does or cluster mode is off
+ **/
+int Cluster_owner(const char hash[SHA256_SIZE], struct sockaddr_in* owner) {
+  uint64_t key;
+  size_t low, high, mid, i;
+  int member;
+
+  if (cluster.points == 0) return 0;
+
+  /* First Point Clockwise of the Key, Wrapping Past the Top */
+  key = Cluster_position((const uint8_t*)hash);
+  low = 0;
+  high = cluster.points;
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (cluster.ring[mid].position < key) low = mid + 1;
+    else high = mid;
+  }
+  if (low == cluster.points) low = 0;
+
+  /* Walk on Past Dead Members, Stopping at Ourselves */
+  for (i = 0; i < cluster.points; i++) {
+    member = cluster.ring[(low + i) % cluster.points].member;
+    if (member == cluster.self) return 0;
+    if (!Peers_isDead(&(cluster.members[member]))) break;
+  }
+  if (i == cluster.points) return 0;
+
+  *owner = cluster.members[member];
+  return 1;
+} /* End Cluster_owner() */
+
+/**
+ * void Cluster_destroy(void)
+ * Cleans up all resources associated with this AO.
+ * @return None
+ **/
+void Cluster_destroy(void) {
+  free(cluster.members);
+  free(cluster.ring);
+  cluster.members = NULL;
+  cluster.ring = NULL;
+  cluster.count = 0;
+  cluster.points = 0;
+  cluster.self = -1;
+}
@@ -0,0 +1,41 @@
+/**
+ * File: cluster.h
+ * Author: Ethan Gordon
+ * Consistent-hash ring over the nodes of a marpd cluster, so each record's
+ * misses are recursed for and cached at one owner node. (Abstract Object)
+ **/
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <netinet/in.h>
+
+#define SHA256_SIZE 32
+
+/**
+ * int Cluster_init(const char*, const char*)
+ * @param file: Newline-delimited <ip>:<port> of every cluster member, this node included
+ * @param self: This node's <ip>:<port> on the ring, NULL disables cluster mode
+ * @return number of members on success, 0 if disabled, negative on failure
+ **/
+int Cluster_init(const char* file, const char* self);
+
+/**
+ * int Cluster_owner(const char*, struct sockaddr_in*)
+ * The owner is the first member clockwise of @param hash on the ring that
+ * health checks haven't marked dead, so a dead owner's records fall to the
+ * next member until it answers again.
+ * @param hash: Query_id() of the record
+ * @param owner: Overwritten with the owning node if it is not this one
+ * @return 1 if another node owns @param hash, 0 if this node does or cluster mode is off
+ **/
+int Cluster_owner(const char hash[SHA256_SIZE], struct sockaddr_in* owner);
+
+/**
+ * void Cluster_destroy(void)
+ * Cleans up all resources associated with this AO.
+ * @return None
+ **/
+void Cluster_destroy(void);
+
+#endif
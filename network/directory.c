@@ -0,0 +1,266 @@
+/**
+ * File: directory.c
+ * Author: Ethan Gordon
+ * Maps MARP hosts to the server authoritative for them, so recursion can
+ * ask that server directly instead of fanning out. (Abstract Object)
+ **/
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "directory.h"
+#include "../uthash.h"
+
+/* Host -> Authoritative Server */
+typedef struct entry {
+  char* host;
+  struct sockaddr_in addr;
+  /* When the entry was last learned */
+  time_t learned;
+  /* Configured by the operator: never expires, forgotten or relearned */
+  bool pinned;
+  UT_hash_handle hh;
+} entry;
+
+static struct {
+  entry* table;
+  size_t count;
+  pthread_mutex_t lock;
+  bool initialized;
+} directory = { NULL, 0, PTHREAD_MUTEX_INITIALIZER, false };
+
+extern char* programName;
+
+/* Entries learned beyond this are dropped, so answers can't grow the table without bound */
+#define MAX_ENTRIES 4096
+#define MAX_LINE 320
+/* Seconds an entry is trusted before it must be learned again */
+#define EXPIRE_AFTER 3600
+/* Marks dumped entries that were learned, followed by when, so they aren't read back as pinned */
+#define LEARNED_TAG "learned"
+
+/* Remove @param found. Lock must be held. */
+static void Directory_drop(entry* found) {
+  HASH_DEL(directory.table, found);
+  free(found->host);
+  free(found);
+  directory.count--;
+}
+
+/* Insert or overwrite @param host, a learned entry never overwrites a pinned one. Lock must be held. */
+static int Directory_put(const char* host, const struct sockaddr_in* addr, bool pinned, time_t learned) {
+  entry* found;
+
+  HASH_FIND_STR(directory.table, host, found);
+  if (found != NULL) {
+    if (found->pinned && !pinned) return 0;
+    found->addr = *addr;
+    found->learned = learned;
+    found->pinned = pinned;
+    return 0;
+  }
+  if (directory.count >= MAX_ENTRIES) return -1;
+
+  found = calloc(1, sizeof(entry));
+  if (found == NULL) return -1;
+  found->host = strdup(host);
+  if (found->host == NULL) {
+    free(found);
+    return -1;
+  }
+  found->addr = *addr;
+  found->learned = learned;
+  found->pinned = pinned;
+
+  HASH_ADD_KEYPTR(hh, directory.table, found->host, strlen(found->host), found);
+  directory.count++;
+  return 0;
+}
+
+/**
+ * int Directory_init(const char*)
+ * Initialize the AO directory.
+ * @param file: Optional file with newline-delimited "<host> <ip>:<port>" entries, which
+ *              are pinned, and learned entries dumped as "<host> <ip>:<port> learned <time>"
+ * @return number of entries read on success, negative on failure.
+ **/
+int Directory_init(const char* file) {
+  FILE* in;
+  char* line;
+  int count = 0;
+
+  directory.initialized = true;
+  if (file == NULL) return 0;
+
+  in = fopen(file, "r");
+  if (in == NULL) return 0; /* Nothing Learned Yet */
+
+  line = calloc(MAX_LINE, sizeof(char));
+  if (line == NULL) {
+    fclose(in);
+    return -1;
+  }
+
+  while (fgets(line, MAX_LINE, in) != NULL) {
+    struct sockaddr_in addr;
+    char *host, *ip, *port, *tag, *when, *save;
+    bool pinned = true;
+    time_t learned = time(NULL);
+
+    host = strtok_r(line, " \t\r\n", &save);
+    if (host == NULL || host[0] == '#' || host[0] == ';') continue;
+    ip = strtok_r(NULL, " \t\r\n", &save);
+    if (ip == NULL || (port = strrchr(ip, ':')) == NULL) {
+      fprintf(stderr, "%s: Directory_init: Skipping malformed entry for %s\n", programName, host);
+      continue;
+    }
+    *port++ = '\0';
+
+    /* Learned Entries Keep Their Age Across Restarts */
+    tag = strtok_r(NULL, " \t\r\n", &save);
+    if (tag != NULL && strcmp(tag, LEARNED_TAG) == 0) {
+      when = strtok_r(NULL, " \t\r\n", &save);
+      pinned = false;
+      learned = when != NULL ? (time_t)atoll(when) : 0;
+      if (time(NULL) - learned > EXPIRE_AFTER) continue;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(port));
+    if (inet_pton(AF_INET, ip, &(addr.sin_addr)) != 1) {
+      fprintf(stderr, "%s: Directory_init: Invalid address %s for %s\n", programName, ip, host);
+      continue;
+    }
+
+    pthread_mutex_lock(&(directory.lock));
+    if (Directory_put(host, &addr, pinned, learned) == 0) count++;
+    pthread_mutex_unlock(&(directory.lock));
+  }
+
+  free(line);
+  fclose(in);
+  return count;
+} /* End Directory_init() */
+
+/**
+ * int Directory_lookup(const char*, struct sockaddr_in*)
+ * @param host: Host part of a "handle@host" query
+ * @param addr: Overwritten with the authoritative server for @param host
+ * @return 0 if the server is known, negative otherwise
+ **/
+int Directory_lookup(const char* host, struct sockaddr_in* addr) {
+  entry* found;
+
+  assert(addr != NULL);
+  if (host == NULL || !directory.initialized) return -1;
+
+  pthread_mutex_lock(&(directory.lock));
+  HASH_FIND_STR(directory.table, host, found);
+  if (found != NULL && !found->pinned && time(NULL) - found->learned > EXPIRE_AFTER) {
+    /* Stale, Fan Out Until the Host's Server Answers Again */
+    Directory_drop(found);
+    found = NULL;
+  }
+  if (found != NULL) *addr = found->addr;
+  pthread_mutex_unlock(&(directory.lock));
+
+  return found != NULL ? 0 : -1;
+}
+
+/**
+ * int Directory_learn(const char*, const struct sockaddr_in*)
+ * Records that the server at @param addr answered authoritatively for @param host.
+ * @return 0 on success, negative on failure or if the directory is full
+ **/
+int Directory_learn(const char* host, const struct sockaddr_in* addr) {
+  int ret;
+
+  assert(addr != NULL);
+  if (host == NULL || !directory.initialized) return -1;
+
+  pthread_mutex_lock(&(directory.lock));
+  ret = Directory_put(host, addr, false, time(NULL));
+  pthread_mutex_unlock(&(directory.lock));
+
+  return ret;
+}
+
+/**
+ * void Directory_forget(const char*, const struct sockaddr_in*)
+ * Drops the learned entry for @param host if it still points at @param addr,
+ * after that server timed out or had no answer. Pinned entries stay.
+ * @return None
+ **/
+void Directory_forget(const char* host, const struct sockaddr_in* addr) {
+  entry* found;
+
+  assert(addr != NULL);
+  if (host == NULL || !directory.initialized) return;
+
+  pthread_mutex_lock(&(directory.lock));
+  HASH_FIND_STR(directory.table, host, found);
+  if (found != NULL && !found->pinned && found->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+      found->addr.sin_port == addr->sin_port) {
+    Directory_drop(found);
+  }
+  pthread_mutex_unlock(&(directory.lock));
+}
+
+/**
+ * int Directory_dump(const char*)
+ * @param file: Overwritten with every entry, in the format read by Directory_init(),
+ *              learned entries tagged so they are not read back as pinned
+ * @return number of entries written on success, negative on failure
+ **/
+int Directory_dump(const char* file) {
+  FILE* out;
+  entry *current, *tmp;
+  char ip[INET_ADDRSTRLEN];
+  int count = 0;
+
+  if (file == NULL) return -1;
+
+  out = fopen(file, "w+");
+  if (out == NULL) {
+    perror(programName);
+    return -1;
+  }
+
+  pthread_mutex_lock(&(directory.lock));
+  HASH_ITER(hh, directory.table, current, tmp) {
+    if (!current->pinned && time(NULL) - current->learned > EXPIRE_AFTER) continue;
+    if (inet_ntop(AF_INET, &(current->addr.sin_addr), ip, INET_ADDRSTRLEN) == NULL) continue;
+    if (current->pinned) fprintf(out, "%s %s:%d\n", current->host, ip, ntohs(current->addr.sin_port));
+    else fprintf(out, "%s %s:%d %s %lld\n", current->host, ip, ntohs(current->addr.sin_port),
+                 LEARNED_TAG, (long long)current->learned);
+    count++;
+  }
+  pthread_mutex_unlock(&(directory.lock));
+
+  fclose(out);
+  return count;
+} /* End Directory_dump() */
+
+/**
+ * void Directory_destroy(void)
+ * Cleans up all resources associated with this AO.
+ * @return None
+ **/
+void Directory_destroy(void) {
+  entry *current, *tmp;
+
+  pthread_mutex_lock(&(directory.lock));
+  HASH_ITER(hh, directory.table, current, tmp) Directory_drop(current);
+  directory.initialized = false;
+  pthread_mutex_unlock(&(directory.lock));
+}
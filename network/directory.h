@@ -0,0 +1,63 @@
+/**
+ * File: directory.h
+ * Author: Ethan Gordon
+ * Maps MARP hosts to the server authoritative for them, so recursion can
+ * ask that server directly instead of fanning out. (Abstract Object)
+ **/
+
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/**
+ * int Directory_init(const char*)
+ * Initialize the AO directory.
+ * @param file: Optional file with newline-delimited "<host> <ip>:<port>" entries, which
+ *              are pinned, and learned entries dumped as "<host> <ip>:<port> learned <time>"
+ * @return number of entries read on success, negative on failure.
+ **/
+int Directory_init(const char* file);
+
+/**
+ * int Directory_lookup(const char*, struct sockaddr_in*)
+ * @param host: Host part of a "handle@host" query
+ * @param addr: Overwritten with the authoritative server for @param host
+ * @return 0 if the server is known, negative otherwise
+ **/
+int Directory_lookup(const char* host, struct sockaddr_in* addr);
+
+/**
+ * int Directory_learn(const char*, const struct sockaddr_in*)
+ * Records that the server at @param addr answered authoritatively for @param host,
+ * with an answer verified against the host's key. Learned entries expire after an hour,
+ * and never replace a pinned one.
+ * @return 0 on success, negative on failure or if the directory is full
+ **/
+int Directory_learn(const char* host, const struct sockaddr_in* addr);
+
+/**
+ * void Directory_forget(const char*, const struct sockaddr_in*)
+ * Drops the learned entry for @param host if it still points at @param addr,
+ * after that server timed out or had no answer. Pinned entries stay.
+ * @return None
+ **/
+void Directory_forget(const char* host, const struct sockaddr_in* addr);
+
+/**
+ * int Directory_dump(const char*)
+ * @param file: Overwritten with every entry, in the format read by Directory_init(),
+ *              learned entries tagged so they are not read back as pinned
+ * @return number of entries written on success, negative on failure
+ **/
+int Directory_dump(const char* file);
+
+/**
+ * void Directory_destroy(void)
+ * Cleans up all resources associated with this AO.
+ * @return None
+ **/
+void Directory_destroy(void);
+
+#endif
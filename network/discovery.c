@@ -0,0 +1,212 @@
+/**
+ * File: discovery.c
+ * Author: Ethan Gordon
+ * Peer discovery: nodes periodically ask a few peers for a sample of their
+ * healthy peers, and ping each one before adding it to their own table.
+ *
+ * A request is the subtype and our advertised port, so the node asked learns
+ * us once we answer its ping, zero padded to the largest answer so a spoofed
+ * request can't be reflected into a bigger datagram. The answer is the subtype, the address the request came from (so
+ * the asker can tell itself apart from its peers), a count, then per peer its
+ * IPv4 address, port and smoothed RTT in milliseconds, all in network order.
+ * The advertised RTT is only a hint: a newcomer starts from the RTT we measure.
+ **/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#include "socket.h"
+#include "periodic.h"
+#include "peers.h"
+#include "discovery.h"
+#include "health.h"
+#include "../frame.h"
+
+extern char* programName;
+
+#define TIMEOUT 1
+
+/* Seconds between exchanges */
+#define INTERVAL 60
+/* Peers asked per exchange */
+#define FANOUT 3
+/* Most peers in one answer */
+#define LIST_MAX 32
+
+/* Wire sizes: answer before the entries, one entry, and requests, as long as the longest answer */
+#define ANSWER_HEAD (1 + sizeof(uint32_t) + 1)
+#define ENTRY_LEN (sizeof(uint32_t) + 2 * sizeof(uint16_t))
+#define REQUEST_LEN (ANSWER_HEAD + LIST_MAX * ENTRY_LEN)
+
+static Periodic_T worker = NULL;
+
+/**
+ * int Discovery_answer(const struct sockaddr_in*, const uint8_t*, size_t, uint8_t*, size_t)
+ * Answers with a sample of our healthy peers, and has the node asking pinged
+ * so it is learned once it proves it is there.
+ * @param from: Source address of the request, its port is replaced by the advertised one
+ * @param payload: PER_LIST request, after the subtype
+ * @param len: Length of @param payload
+ * @param out: Overwritten with the PER_LIST answer
+ * @param outLen: Size of @param out
+ * @return Bytes written to @param out, negative if malformed
+ **/
+int Discovery_answer(const struct sockaddr_in* from, const uint8_t* payload, size_t len, uint8_t* out, size_t outLen) {
+  struct sockaddr_in asker, peers[LIST_MAX];
+  double rtts[LIST_MAX];
+  uint8_t* entry;
+  int count, i;
+
+  if (from == NULL || len != REQUEST_LEN - 1 || outLen < ANSWER_HEAD + LIST_MAX * ENTRY_LEN) return -1;
+
+  /* Asked From an Ephemeral Socket, so Trust the Address but Not the Port; the Source May Be Spoofed, so Ping First */
+  asker = *from;
+  memcpy(&(asker.sin_port), payload, sizeof(uint16_t));
+  (void)Health_candidate(&asker);
+
+  count = Peers_share(peers, rtts, LIST_MAX, &asker);
+
+  out[0] = PER_LIST;
+  memcpy(out + 1, &(from->sin_addr.s_addr), sizeof(uint32_t));
+  out[1 + sizeof(uint32_t)] = (uint8_t)count;
+
+  entry = out + ANSWER_HEAD;
+  for (i = 0; i < count; i++) {
+    uint16_t rtt = htons(rtts[i] < UINT16_MAX ? (uint16_t)rtts[i] : UINT16_MAX);
+
+    memcpy(entry, &(peers[i].sin_addr.s_addr), sizeof(uint32_t));
+    memcpy(entry + sizeof(uint32_t), &(peers[i].sin_port), sizeof(uint16_t));
+    memcpy(entry + sizeof(uint32_t) + sizeof(uint16_t), &rtt, sizeof(uint16_t));
+    entry += ENTRY_LEN;
+  }
+
+  return (int)(ANSWER_HEAD + count * ENTRY_LEN);
+} /* End Discovery_answer() */
+
+/**
+ * int Discovery_queue(const uint8_t*, size_t)
+ * Queues the peers in an answer for a ping, skipping ourselves and known peers.
+ * Nothing the answer claims is trusted until the peer answers us directly.
+ * @return Number of peers queued, negative if malformed
+ **/
+static int Discovery_queue(const uint8_t* payload, size_t len) {
+  struct sockaddr_in peer;
+  uint32_t self;
+  const uint8_t* entry;
+  int count, queued = 0, i;
+
+  if (len < ANSWER_HEAD || payload[0] != PER_LIST) return -1;
+  count = payload[1 + sizeof(uint32_t)];
+  if (count > LIST_MAX || len != ANSWER_HEAD + count * ENTRY_LEN) return -1;
+  memcpy(&self, payload + 1, sizeof(uint32_t));
+
+  entry = payload + ANSWER_HEAD;
+  for (i = 0; i < count; i++, entry += ENTRY_LEN) {
+    memset(&peer, 0, sizeof(struct sockaddr_in));
+    peer.sin_family = AF_INET;
+    memcpy(&(peer.sin_addr.s_addr), entry, sizeof(uint32_t));
+    memcpy(&(peer.sin_port), entry + sizeof(uint32_t), sizeof(uint16_t));
+
+    if (peer.sin_addr.s_addr == self && peer.sin_port == htons(MARP_PORT)) continue;
+    if (peer.sin_port == 0 || peer.sin_addr.s_addr == INADDR_ANY || Peers_has(&peer)) continue;
+    if (Health_candidate(&peer) == 0) queued++;
+  }
+
+  return queued;
+} /* End Discovery_queue() */
+
+/**
+ * int Discovery_exchange(Socket_T)
+ * Asks FANOUT peers for their peer lists and queues the peers they name for a ping.
+ * @return Number of peers queued, negative on failure
+ **/
+static int Discovery_exchange(Socket_T socket) {
+  struct sockaddr_in peers[FANOUT];
+  uint32_t qids[FANOUT];
+  uint8_t request[REQUEST_LEN] = { 0 };
+  uint16_t port = htons(MARP_PORT);
+  char ip[INET_ADDRSTRLEN];
+  Frame_T frame;
+  int count, sent = 0, answered = 0, queued = 0, i;
+
+  count = Peers_select(peers, FANOUT, NULL, 0, 0, NULL);
+  if (count == 0) return 0;
+
+  request[0] = PER_LIST;
+  memcpy(request + 1, &port, sizeof(uint16_t));
+
+  for (i = 0; i < count; i++) {
+    frame = Frame_buildPeer(request, REQUEST_LEN);
+    if (frame == NULL) break;
+
+    qids[sent] = Frame_getQID(frame);
+    if (inet_ntop(AF_INET, &(peers[i].sin_addr), ip, INET_ADDRSTRLEN) != NULL &&
+        Frame_send(frame, socket, ip, ntohs(peers[i].sin_port)) >= 0) sent++;
+    Frame_free(frame);
+  }
+
+  /* Queue Answers as They Arrive, Giving Up on Silent Peers After TIMEOUT */
+  while (answered < sent) {
+    const uint8_t* payload;
+    uint16_t len;
+    int added;
+
+    frame = Frame_init();
+    if (frame == NULL) break;
+    if (Frame_listen(frame, socket, TIMEOUT) < 0) {
+      Frame_free(frame);
+      break;
+    }
+
+    for (i = 0; i < sent; i++) {
+      if (qids[i] == Frame_getQID(frame)) break;
+    }
+    if (i < sent) {
+      answered++;
+      payload = Frame_getPayload(frame, &len);
+      added = payload != NULL ? Discovery_queue(payload, len) : -1;
+      if (added > 0) queued += added;
+    }
+    Frame_free(frame);
+  }
+  for (i = 0; i < sent; i++) Socket_clearQID(socket, qids[i]);
+
+  return queued;
+} /* End Discovery_exchange() */
+
+/* Exchange every INTERVAL seconds */
+static int Discovery_work(Socket_T socket, void* arg) {
+  int queued;
+
+  (void)arg;
+  queued = Discovery_exchange(socket);
+  if (queued < 0)
+    fprintf(stderr, "%s: Discovery: Could not exchange peer lists\n", programName);
+  else if (queued > 0)
+    printf("%s: Discovery: Pinging %d peers we were told about, %zu known\n", programName, queued, Peers_count());
+
+  return INTERVAL;
+}
+
+/**
+ * int Discovery_start(void)
+ * Starts the thread that trades peer lists with a few peers at a time.
+ * @return 0 on success, negative on failure
+ **/
+int Discovery_start(void) {
+  worker = Periodic_start(Discovery_work, NULL);
+  return worker == NULL ? -1 : 0;
+}
+
+/**
+ * void Discovery_stop(void)
+ * Waits for the exchange thread to notice shutdown and exit.
+ **/
+void Discovery_stop(void) {
+  Periodic_stop(worker);
+  worker = NULL;
+}
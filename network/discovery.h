@@ -0,0 +1,41 @@
+/**
+ * File: discovery.h
+ * Author: Ethan Gordon
+ * Peer discovery: nodes periodically ask a few peers for a sample of their
+ * healthy peers and merge it into their own table.
+ **/
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+/**
+ * int Discovery_answer(const struct sockaddr_in*, const uint8_t*, size_t, uint8_t*, size_t)
+ * Answers with a sample of our healthy peers, and has the node asking pinged
+ * so it is learned once it proves it is there.
+ * @param from: Source address of the request, its port is replaced by the advertised one
+ * @param payload: PER_LIST request, after the subtype
+ * @param len: Length of @param payload
+ * @param out: Overwritten with the PER_LIST answer
+ * @param outLen: Size of @param out
+ * @return Bytes written to @param out, negative if malformed
+ **/
+int Discovery_answer(const struct sockaddr_in* from, const uint8_t* payload, size_t len, uint8_t* out, size_t outLen);
+
+/**
+ * int Discovery_start(void)
+ * Starts the thread that trades peer lists with a few peers at a time.
+ * @return 0 on success, negative on failure
+ **/
+int Discovery_start(void);
+
+/**
+ * void Discovery_stop(void)
+ * Waits for the exchange thread to notice shutdown and exit.
+ **/
+void Discovery_stop(void);
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * File: gossip.c
+ * Author: Ethan Gordon
+ * Cache gossip between anycast siblings: nodes behind one address each see a
+ * slice of the same clients, so each pushes its newly cached, often looked-up
+ * records to a few siblings, who then answer them from cache.
+ *
+ * A push is the subtype then entries in the Cache_hot() format, so each record
+ * keeps only the TTL it has left. Every entry goes out once; what a sibling
+ * learns is marked shared and never forwarded, so pushes don't echo around.
+ **/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#include "socket.h"
+#include "periodic.h"
+#include "gossip.h"
+#include "../frame.h"
+#include "../data/cache.h"
+
+extern char* programName;
+extern volatile bool isRunning;
+
+#define TIMEOUT 1
+#define MAX_LINE 32
+#define MAX_SIBLINGS 64
+
+/* Siblings each push goes to */
+#define FANOUT 3
+/* Lookups before a record is worth sharing */
+#define MIN_HITS 2
+/* Most pushes per interval, so a burst of new records can't flood siblings */
+#define CHUNKS_MAX 16
+/* Entries per push: FRAME_MAX less the header, subtype and MAC */
+#define CHUNK_ROOM (BATCH_ROOM - PEER_MAC)
+
+static struct {
+  struct sockaddr_in members[MAX_SIBLINGS];
+  int count;
+  int interval;
+} siblings = { .count = 0, .interval = 0 };
+
+static Periodic_T worker = NULL;
+
+/* Parse "<ip>:<port>" into @param addr */
+static int Gossip_parse(const char* hostport, struct sockaddr_in* addr) {
+  char buf[MAX_LINE];
+  char* port;
+
+  if (strlen(hostport) >= MAX_LINE) return -1;
+  strcpy(buf, hostport);
+  buf[strcspn(buf, " \t\r\n")] = '\0';
+
+  port = strrchr(buf, ':');
+  if (port == NULL) return -1;
+  *port++ = '\0';
+
+  memset(addr, 0, sizeof(struct sockaddr_in));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons((uint16_t)atoi(port));
+  if (inet_pton(AF_INET, buf, &(addr->sin_addr)) != 1) return -1;
+  return 0;
+}
+
+/**
+ * int Gossip_init(const char*, int)
+ * @param file: Newline-delimited <ip>:<port> of every other node behind our anycast address
+ * @param interval: Seconds between pushes, 0 disables gossip
+ * @return number of siblings on success, 0 if disabled, negative on failure
+ **/
+int Gossip_init(const char* file, int interval) {
+  char line[MAX_LINE];
+  FILE* in;
+
+  if (interval <= 0) return 0;
+
+  in = fopen(file, "r");
+  if (in == NULL) {
+    perror(programName);
+    return -1;
+  }
+
+  while (siblings.count < MAX_SIBLINGS && fgets(line, MAX_LINE, in) != NULL) {
+    if (line[0] == '#' || line[0] == ';' || line[0] == '\n') continue;
+    if (Gossip_parse(line, &(siblings.members[siblings.count])) < 0) continue;
+    siblings.count++;
+  }
+  fclose(in);
+
+  siblings.interval = interval;
+  return siblings.count;
+} /* End Gossip_init() */
+
+/**
+ * int Gossip_receive(const struct sockaddr_in*, const uint8_t*, size_t)
+ * Caches the records a sibling pushed, keeping any we already hold.
+ * @param from: Source address of the push, NULL if unknown
+ * @param payload: PER_GOSSIP entries, after the subtype
+ * @param len: Length of @param payload
+ * @return Number of records added, negative if malformed or not from a sibling
+ **/
+int Gossip_receive(const struct sockaddr_in* from, const uint8_t* payload, size_t len) {
+  int i;
+
+  if (from == NULL) return -1;
+
+  /* Pushed From an Ephemeral Socket, so Match the Address Only */
+  for (i = 0; i < siblings.count; i++) {
+    if (siblings.members[i].sin_addr.s_addr == from->sin_addr.s_addr) break;
+  }
+  if (i == siblings.count) return -1;
+
+  return Cache_warm(payload, len, NULL, NULL);
+} /* End Gossip_receive() */
+
+/**
+ * int Gossip_push(Socket_T, const uint8_t*, size_t)
+ * Sends one push to FANOUT random siblings and waits for their acknowledgements.
+ * @return Number of siblings that acknowledged
+ **/
+static int Gossip_push(Socket_T socket, const uint8_t* push, size_t len) {
+  int order[MAX_SIBLINGS];
+  uint32_t qids[FANOUT];
+  char ip[INET_ADDRSTRLEN];
+  Frame_T frame;
+  int count, sent = 0, answered = 0, i, j;
+
+  /* Partial Shuffle, the First count are the Siblings Picked */
+  count = siblings.count < FANOUT ? siblings.count : FANOUT;
+  for (i = 0; i < siblings.count; i++) order[i] = i;
+  for (i = 0; i < count; i++) {
+    int tmp;
+
+    j = i + rand() % (siblings.count - i);
+    tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  for (i = 0; i < count; i++) {
+    const struct sockaddr_in* sibling = &(siblings.members[order[i]]);
+
+    frame = Frame_buildPush(push, len);
+    if (frame == NULL) break;
+    qids[sent] = Frame_getQID(frame);
+    if (inet_ntop(AF_INET, &(sibling->sin_addr), ip, INET_ADDRSTRLEN) != NULL &&
+        Frame_send(frame, socket, ip, ntohs(sibling->sin_port)) >= 0) sent++;
+    Frame_free(frame);
+  }
+
+  /* Drain Acknowledgements, Giving Up on Silent Siblings After TIMEOUT */
+  while (answered < sent) {
+    frame = Frame_init();
+    if (frame == NULL) break;
+    if (Frame_listen(frame, socket, TIMEOUT) < 0) {
+      Frame_free(frame);
+      break;
+    }
+    for (i = 0; i < sent; i++) {
+      if (qids[i] == Frame_getQID(frame)) answered++;
+    }
+    Frame_free(frame);
+  }
+  for (i = 0; i < sent; i++) Socket_clearQID(socket, qids[i]);
+
+  return answered;
+} /* End Gossip_push() */
+
+/* Push fresh entries every interval */
+static int Gossip_work(Socket_T socket, void* arg) {
+  uint8_t push[1 + CHUNK_ROOM];
+  int len, chunks;
+
+  (void)arg;
+  push[0] = PER_GOSSIP;
+  for (chunks = 0; chunks < CHUNKS_MAX && isRunning; chunks++) {
+    len = Cache_fresh(push + 1, CHUNK_ROOM, MIN_HITS);
+    if (len <= 0) break;
+    Gossip_push(socket, push, 1 + len);
+  }
+  if (chunks > 0) printf("%s: Gossip: Pushed %d chunks of fresh records to siblings\n", programName, chunks);
+
+  return siblings.interval;
+}
+
+/**
+ * int Gossip_start(void)
+ * Starts the thread that pushes fresh cache entries to siblings, if gossip is on.
+ * @return 0 on success, negative on failure
+ **/
+int Gossip_start(void) {
+  if (siblings.interval <= 0 || siblings.count == 0) return 0;
+  worker = Periodic_start(Gossip_work, NULL);
+  return worker == NULL ? -1 : 0;
+}
+
+/**
+ * void Gossip_stop(void)
+ * Waits for the gossip thread to notice shutdown and exit.
+ **/
+void Gossip_stop(void) {
+  Periodic_stop(worker);
+  worker = NULL;
+}
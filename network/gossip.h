@@ -0,0 +1,47 @@
+/**
+ * File: gossip.h
+ * Author: Ethan Gordon
+ * Cache gossip between anycast siblings: nodes behind one address each see a
+ * slice of the same clients, so each pushes its newly cached, often looked-up
+ * records to a few siblings, who then answer them from cache.
+ **/
+
+#ifndef GOSSIP_H
+#define GOSSIP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+/**
+ * int Gossip_init(const char*, int)
+ * @param file: Newline-delimited <ip>:<port> of every other node behind our anycast address
+ * @param interval: Seconds between pushes, 0 disables gossip
+ * @return number of siblings on success, 0 if disabled, negative on failure
+ **/
+int Gossip_init(const char* file, int interval);
+
+/**
+ * int Gossip_receive(const struct sockaddr_in*, const uint8_t*, size_t)
+ * Caches the records a sibling pushed, keeping any we already hold.
+ * @param from: Source address of the push, NULL if unknown
+ * @param payload: PER_GOSSIP entries, after the subtype
+ * @param len: Length of @param payload
+ * @return Number of records added, negative if malformed or not from a sibling
+ **/
+int Gossip_receive(const struct sockaddr_in* from, const uint8_t* payload, size_t len);
+
+/**
+ * int Gossip_start(void)
+ * Starts the thread that pushes fresh cache entries to siblings, if gossip is on.
+ * @return 0 on success, negative on failure
+ **/
+int Gossip_start(void);
+
+/**
+ * void Gossip_stop(void)
+ * Waits for the gossip thread to notice shutdown and exit.
+ **/
+void Gossip_stop(void);
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * File: health.c
+ * Author: Ethan Gordon
+ * Background peer health checking: pings peers with kPNG so dead ones drop
+ * out of recursion, and are re-admitted once they answer again. Nodes that
+ * asked to be our peer are pinged the same way, and added once they answer.
+ **/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "socket.h"
+#include "periodic.h"
+#include "peers.h"
+#include "health.h"
+#include "../frame.h"
+
+extern char* programName;
+
+/* Seconds to wait for pongs */
+#define TIMEOUT 1
+/* Most peers pinged in one round, the rest wait for the next */
+#define MAX_ROUND 64
+/* Most nodes waiting to answer their first ping, room for a few discovery answers */
+#define MAX_CANDIDATES 64
+
+static Periodic_T worker = NULL;
+
+static struct sockaddr_in candidates[MAX_CANDIDATES];
+static int candidateCount = 0;
+static pthread_mutex_t candidateLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * int Health_candidate(const struct sockaddr_in*)
+ * Queues a node that asked to be our peer, or that a peer told us about. It is
+ * pinged with the next round and added to our peers, starting from the RTT we
+ * measured, once it answers.
+ * @return 0 if queued, negative if the queue is full
+ **/
+int Health_candidate(const struct sockaddr_in* addr) {
+  int ret = 0, i;
+
+  pthread_mutex_lock(&candidateLock);
+  for (i = 0; i < candidateCount; i++) {
+    if (candidates[i].sin_addr.s_addr == addr->sin_addr.s_addr && candidates[i].sin_port == addr->sin_port) break;
+  }
+  if (i == candidateCount) {
+    if (candidateCount < MAX_CANDIDATES) candidates[candidateCount++] = *addr;
+    else ret = -1;
+  }
+  pthread_mutex_unlock(&candidateLock);
+
+  return ret;
+}
+
+/**
+ * int Health_round(Socket_T)
+ * Pings every peer that is due and every candidate, then reports which answered.
+ * @return Number of peers that answered, negative on failure
+ **/
+static int Health_round(Socket_T socket) {
+  struct sockaddr_in peers[MAX_ROUND + MAX_CANDIDATES];
+  uint32_t qids[MAX_ROUND + MAX_CANDIDATES];
+  bool alive[MAX_ROUND + MAX_CANDIDATES] = { false };
+  bool sent[MAX_ROUND + MAX_CANDIDATES] = { false };
+  struct timespec sentAt, now;
+  double rtts[MAX_ROUND + MAX_CANDIDATES];
+  char ip[INET_ADDRSTRLEN];
+  Frame_T frame;
+  int count, known, pending = 0, answered = 0, i;
+
+  /* Candidates Follow the Known Peers */
+  known = Peers_due(peers, MAX_ROUND);
+  pthread_mutex_lock(&candidateLock);
+  memcpy(peers + known, candidates, candidateCount * sizeof(struct sockaddr_in));
+  count = known + candidateCount;
+  candidateCount = 0;
+  pthread_mutex_unlock(&candidateLock);
+  if (count == 0) return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &sentAt);
+  for (i = 0; i < count; i++) {
+    frame = Frame_buildPing();
+    if (frame == NULL) break;
+    qids[i] = Frame_getQID(frame);
+
+    if (inet_ntop(AF_INET, &(peers[i].sin_addr), ip, INET_ADDRSTRLEN) != NULL &&
+        Frame_send(frame, socket, ip, ntohs(peers[i].sin_port)) >= 0) {
+      sent[i] = true;
+      pending++;
+    }
+    Frame_free(frame);
+  }
+
+  /* Any Answer Means the Server is Up, Match it to the Ping by QID */
+  while (pending > 0) {
+    uint32_t qid;
+
+    frame = Frame_init();
+    if (frame == NULL) break;
+    if (Frame_listen(frame, socket, TIMEOUT) < 0) {
+      Frame_free(frame);
+      break;
+    }
+    qid = Frame_getQID(frame);
+    Frame_free(frame);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < count; i++) {
+      if (!sent[i] || alive[i] || qids[i] != qid) continue;
+      alive[i] = true;
+      rtts[i] = (now.tv_sec - sentAt.tv_sec) * 1000.0 + (now.tv_nsec - sentAt.tv_nsec) / 1e6;
+      pending--;
+      answered++;
+      break;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    if (!sent[i]) continue;
+    Socket_clearQID(socket, qids[i]);
+    if (i < known) {
+      Peers_probed(&(peers[i]), alive[i]);
+    } else if (alive[i] && Peers_merge(&(peers[i]), &(rtts[i]), 1) > 0 &&
+               inet_ntop(AF_INET, &(peers[i].sin_addr), ip, INET_ADDRSTRLEN) != NULL) {
+      printf("%s: Health: Learned %s:%d, it answered our ping\n", programName, ip, ntohs(peers[i].sin_port));
+    }
+  }
+
+  return answered;
+} /* End Health_round() */
+
+/* Ping peers as they fall due, checking again every second */
+static int Health_work(Socket_T socket, void* arg) {
+  (void)arg;
+  if (Health_round(socket) < 0)
+    fprintf(stderr, "%s: Health: Could not ping peers\n", programName);
+  return 1;
+}
+
+/**
+ * int Health_start(void)
+ * Starts the thread that pings peers as they fall due.
+ * @return 0 on success, negative on failure
+ **/
+int Health_start(void) {
+  worker = Periodic_start(Health_work, NULL);
+  return worker == NULL ? -1 : 0;
+}
+
+/**
+ * void Health_stop(void)
+ * Waits for the ping thread to notice shutdown and exit.
+ **/
+void Health_stop(void) {
+  Periodic_stop(worker);
+  worker = NULL;
+}
@@ -0,0 +1,35 @@
+/**
+ * File: health.h
+ * Author: Ethan Gordon
+ * Background peer health checking: pings peers with kPNG so dead ones drop
+ * out of recursion, and are re-admitted once they answer again.
+ **/
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <netinet/in.h>
+
+/**
+ * int Health_candidate(const struct sockaddr_in*)
+ * Queues a node that asked to be our peer, or that a peer told us about. It is
+ * pinged with the next round and added to our peers, starting from the RTT we
+ * measured, once it answers.
+ * @return 0 if queued, negative if the queue is full
+ **/
+int Health_candidate(const struct sockaddr_in* addr);
+
+/**
+ * int Health_start(void)
+ * Starts the thread that pings peers as they fall due.
+ * @return 0 on success, negative on failure
+ **/
+int Health_start(void);
+
+/**
+ * void Health_stop(void)
+ * Waits for the ping thread to notice shutdown and exit.
+ **/
+void Health_stop(void);
+
+#endif
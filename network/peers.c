@@ -2,6 +2,10 @@
  * File: peers.h
  * Author: Ethan Gordon
  * A local cache of MARP peers. (Abstract Object)
+ * Readers work on an immutable snapshot of the peer list, so recursion never
+ * waits on peers being added or dropped; writers copy the list and publish a
+ * new snapshot, and replaced snapshots are freed once no reader is left.
+ * Taking and dropping a snapshot is lock-free.
  **/
 
 #include <stdint.h>
@@ -14,40 +18,343 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #include "peers.h"
-
+#include "../uthash.h"
 
 /** Peer Object **/
 struct peer {
-  /* Used for array access */
+  /* Position in the writer's dense peer array, updated when another peer is swapped in */
   int index;
+  /* ip:port, for the hash index */
+  uint64_t key;
+  UT_hash_handle hh;
+  /* The writer's table and every snapshot holding this peer, guarded by the writer lock */
+  int refs;
   /* Remote IP Address */
   char* ip;
   /* Remote Port */
   uint16_t port;
+  /* Listed by the operator in the peer file rather than learned, never evicted */
+  bool seed;
   /* Sockaddr Struct for socket.h calls */
   struct sockaddr_in socket_address;
+
+  /* Guards everything below */
+  pthread_mutex_t stats;
+
+  /* Smoothed round-trip time and its variation, in milliseconds */
+  double srtt;
+  double rttvar;
+  /* Smoothed fraction of recursions this peer answered */
+  double success;
+  unsigned long answers;
+  unsigned long timeouts;
+
+  /* Content summary the peer last published, NULL if none */
+  uint8_t* summary;
+  time_t summaryAt;
+
+  /* Health: consecutive failed pings, dead peers are never selected */
+  int failures;
+  bool dead;
+  time_t deadSince;
+  /* Last answer of any kind, a peer heard from recently needs no ping */
+  time_t heardAt;
+  /* Next ping, and seconds between pings while the peer stays healthy */
+  time_t probeAt;
+  int interval;
+
+  /* Load: percent of its capacity the peer last reported in use, and until when it turned queries away */
+  int load;
+  time_t loadAt;
+  time_t busyUntil;
+};
+
+/* Immutable view of the peer list, what readers work on */
+struct snapshot {
+  /* Next replaced snapshot waiting to be freed */
+  struct snapshot* retired;
+  size_t count;
+  Peer_T* peers;
+  /* Open-addressing index on ip:port into peers, SLOT_EMPTY where free */
+  uint32_t* slots;
+  size_t mask;
 };
 
 struct peerAO {
-  size_t size;
+  /* Writer's table. Dense, peers[0..count) are all live; removal swaps the last peer in */
+  size_t count;
   size_t cap;
   Peer_T* peers;
-  bool* exists;
+  /* Hash index on ip:port, for dedup */
+  Peer_T index;
+  /* Serializes writers: the table, peer references, and publishing */
+  pthread_mutex_t lock;
+
+  /* Latest snapshot, swapped by writers and loaded by readers atomically */
+  struct snapshot* current;
+  /* Readers between Peers_acquire() and Peers_release(), whatever snapshot they hold */
+  int readers;
+  /* Replaced snapshots, freed by whoever finds no reader left; written under the writer lock */
+  struct snapshot* retired;
 };
 
 static struct peerAO *peerList;
 extern char* programName;
 
 #define INITIAL_SIZE 4
-#define MAX_STR_BUF 23
-#define PORT_LEN 5
+#define MAX_STR_BUF 32
+#define PORT_LEN 6
+
+#define SLOT_EMPTY UINT32_MAX
+
+/* RTT assumed for a peer never heard from, so new peers get tried */
+#define INITIAL_RTT 100.0
+/* EWMA gains, as for TCP's retransmission timer (RFC 6298) */
+#define RTT_ALPHA 0.125
+#define RTT_BETA 0.25
+#define SUCCESS_GAIN 0.125
+/* Shortest hedge delay in milliseconds, so jitter on a very close peer doesn't trigger hedges */
+#define MIN_HEDGE 2.0
+/* Floor on the success rate, so a peer that timed out still gets picked now and then */
+#define MIN_SUCCESS 0.05
+
+/* Seconds between pings: from PROBE_MIN, doubling while a peer stays healthy, up to PROBE_MAX */
+#define PROBE_MIN 5
+#define PROBE_MAX 60
+/* Failed pings before a peer is suspect (pinged at PROBE_MIN) and dead (out of selection) */
+#define SUSPECT_AFTER 1
+#define DEAD_AFTER 3
+/* Seconds a learned peer may stay dead before it is forgotten */
+#define EVICT_AFTER 3600
+/* Follows learned peers in the peer file, lines without it are seeds */
+#define LEARNED_TAG " learned"
+
+/* Seconds a load report counts for, and a peer that turned a query away stays de-weighted */
+#define LOAD_STALE 10
+#define BUSY_BACKOFF 2
+/* Score multipliers: a fully loaded peer up to 1 + LOAD_WEIGHT, a busy one BUSY_WEIGHT */
+#define LOAD_WEIGHT 3.0
+#define BUSY_WEIGHT 16.0
+
+/* Most peers learned through discovery, beyond it a newcomer must displace a worse peer */
+#define PEERS_MAX 512
+
+/* Up to this many peers selection considers each one, beyond it samples */
+#define SCAN_MAX 256
+/* Random draws per pick on a large table before giving up */
+#define SAMPLE_TRIES 16
+
+/* MurmurHash3 finalizer */
+static uint64_t Peers_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Hash index key for @param addr */
+static uint64_t Peers_key(const struct sockaddr_in* addr) {
+  return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+/* Drop one reference to @param peer, freeing it with the last. Writer lock must be held. */
+static void Peers_unref(Peer_T peer) {
+  if (--peer->refs > 0) return;
+
+  pthread_mutex_destroy(&(peer->stats));
+  free(peer->ip);
+  free(peer->summary);
+  free(peer);
+}
+
+/* Free @param snap and its peer references. Writer lock must be held. */
+static void Peers_freeSnapshot(struct snapshot* snap) {
+  size_t i;
+
+  for (i = 0; i < snap->count; i++) Peers_unref(snap->peers[i]);
+  free(snap->peers);
+  free(snap->slots);
+  free(snap);
+}
+
+/* Free replaced snapshots if no reader can still hold one. Writer lock must be held. */
+static void Peers_reclaim(void) {
+  struct snapshot* snap;
+
+  /* A Reader Counted After This Load Can Only Have Seen the Current Snapshot */
+  if (__atomic_load_n(&(peerList->readers), __ATOMIC_SEQ_CST) != 0) return;
+
+  while ((snap = peerList->retired) != NULL) {
+    __atomic_store_n(&(peerList->retired), snap->retired, __ATOMIC_SEQ_CST);
+    Peers_freeSnapshot(snap);
+  }
+}
+
+/* Latest snapshot, held until Peers_release(). NULL before Peers_init(). */
+static struct snapshot* Peers_acquire(void) {
+  struct snapshot* snap;
+
+  if (peerList == NULL) return NULL;
+
+  /* Count Ourselves Before Loading, so a Writer Never Frees What We Are About to Use */
+  __atomic_add_fetch(&(peerList->readers), 1, __ATOMIC_SEQ_CST);
+  snap = __atomic_load_n(&(peerList->current), __ATOMIC_SEQ_CST);
+  if (snap == NULL) __atomic_sub_fetch(&(peerList->readers), 1, __ATOMIC_SEQ_CST);
+
+  return snap;
+}
+
+/* Done with @param snap. @param locked if the writer lock is held. */
+static void Peers_release(struct snapshot* snap, bool locked) {
+  if (snap == NULL) return;
+  if (__atomic_sub_fetch(&(peerList->readers), 1, __ATOMIC_SEQ_CST) != 0) return;
+  if (__atomic_load_n(&(peerList->retired), __ATOMIC_SEQ_CST) == NULL) return;
+
+  /* Last Reader Out Frees Replaced Snapshots, Unless a Writer is Busy; it Reclaims on its Next Publish */
+  if (locked) {
+    Peers_reclaim();
+  } else if (pthread_mutex_trylock(&(peerList->lock)) == 0) {
+    Peers_reclaim();
+    pthread_mutex_unlock(&(peerList->lock));
+  }
+}
+
+/**
+ * int Peers_publish(void)
+ * Copies the writer's table into a new snapshot and makes it current.
+ * Writer lock must be held.
+ * @return 0 on success, negative if out of memory (the old snapshot stays current)
+ **/
+static int Peers_publish(void) {
+  struct snapshot *snap, *old;
+  size_t i, size = 8, slot;
+
+  snap = calloc(1, sizeof(struct snapshot));
+  if (snap == NULL) return -1;
+  while (size < peerList->count * 2) size *= 2;
+
+  snap->peers = calloc(peerList->count ? peerList->count : 1, sizeof(Peer_T));
+  snap->slots = malloc(size * sizeof(uint32_t));
+  if (snap->peers == NULL || snap->slots == NULL) {
+    free(snap->peers); free(snap->slots); free(snap);
+    return -1;
+  }
+  memset(snap->slots, 0xff, size * sizeof(uint32_t));
+  snap->mask = size - 1;
+  snap->count = peerList->count;
+
+  for (i = 0; i < peerList->count; i++) {
+    Peer_T peer = peerList->peers[i];
+
+    snap->peers[i] = peer;
+    peer->refs++;
+    for (slot = Peers_mix(peer->key) & snap->mask; snap->slots[slot] != SLOT_EMPTY; slot = (slot + 1) & snap->mask);
+    snap->slots[slot] = (uint32_t)i;
+  }
+
+  old = __atomic_exchange_n(&(peerList->current), snap, __ATOMIC_SEQ_CST);
+  if (old != NULL) {
+    old->retired = peerList->retired;
+    __atomic_store_n(&(peerList->retired), old, __ATOMIC_SEQ_CST);
+  }
+
+  Peers_reclaim();
+  return 0;
+} /* End Peers_publish() */
+
+/* Find the peer with address @param addr in @param snap */
+static Peer_T Peers_lookup(const struct snapshot* snap, const struct sockaddr_in* addr) {
+  uint64_t key = Peers_key(addr);
+  size_t slot;
+
+  for (slot = Peers_mix(key) & snap->mask; snap->slots[slot] != SLOT_EMPTY; slot = (slot + 1) & snap->mask) {
+    if (snap->peers[snap->slots[slot]]->key == key) return snap->peers[snap->slots[slot]];
+  }
+  return NULL;
+}
+
+/**
+ * int Peers_insert(const char*, uint16_t)
+ * Adds a peer to the writer's table without publishing. Writer lock must be held.
+ * @return: 0 if added, 1 if already known, negative on failure
+ **/
+static int Peers_insert(const char* ip, uint16_t port) {
+  Peer_T newPeer, found;
+
+  assert(ip != NULL);
+
+  newPeer = calloc(1, sizeof(struct peer));
+  if (newPeer == NULL) return -1;
+
+  newPeer->ip = calloc(strlen(ip) + 1, sizeof(char));
+  if (newPeer->ip == NULL) {
+    free(newPeer); return -1;
+  }
+
+  strcpy(newPeer->ip, ip);
+  newPeer->port = port;
+  newPeer->srtt = INITIAL_RTT;
+  newPeer->rttvar = INITIAL_RTT / 2;
+  newPeer->success = 1.0;
+  newPeer->interval = PROBE_MIN;
+
+  newPeer->socket_address.sin_family = AF_INET;
+  newPeer->socket_address.sin_addr.s_addr=inet_addr(ip);
+  newPeer->socket_address.sin_port=htons(port);
+  newPeer->key = Peers_key(&(newPeer->socket_address));
+
+  /* Already Known */
+  HASH_FIND(hh, peerList->index, &(newPeer->key), sizeof(uint64_t), found);
+  if (found != NULL) {
+    free(newPeer->ip); free(newPeer);
+    return 1;
+  }
+
+  if (peerList->count == peerList->cap) {
+    /* Grow Peer List */
+    Peer_T* grown = realloc(peerList->peers, peerList->cap * 2 * sizeof(Peer_T));
+    if (grown == NULL) { free(newPeer->ip); free(newPeer); return -1; }
+    peerList->peers = grown;
+    peerList->cap *= 2;
+  }
+
+  /* Add Peer to List */
+  pthread_mutex_init(&(newPeer->stats), NULL);
+  newPeer->refs = 1;
+  newPeer->index = peerList->count;
+  peerList->peers[peerList->count++] = newPeer;
+  HASH_ADD(hh, peerList->index, key, sizeof(uint64_t), newPeer);
+
+  return 0;
+} /* End Peers_insert() */
+
+/* Removes the peer at @param i from the writer's table, moving the last peer into its slot. Writer lock must be held. */
+static void Peers_remove(size_t i) {
+  Peer_T peer = peerList->peers[i];
+
+  HASH_DEL(peerList->index, peer);
+
+  peerList->count--;
+  if (i != peerList->count) {
+    peerList->peers[i] = peerList->peers[peerList->count];
+    peerList->peers[i]->index = (int)i;
+  }
+  peerList->peers[peerList->count] = NULL;
+
+  /* Snapshots Still Holding it Keep it Alive */
+  Peers_unref(peer);
+}
 
 /**
  * int Peers_init(char*)
  * Initialize the AO list of peers.
- * @param peerFile: Optional file with newline-delimited <host>:<port> combinations.
+ * @param peerFile: Optional file with newline-delimited <host>:<port> combinations,
+ *                  followed by "learned" for peers that are not seeds.
  * @return number of peers read on success, negative on failure.
  **/
 int Peers_init(char* peerFile) {
@@ -61,32 +368,29 @@ int Peers_init(char* peerFile) {
   if (peerList == NULL) return -1;
 
   peerList->peers = calloc(INITIAL_SIZE, sizeof(Peer_T));
-  if (peerList->peers == NULL) { free(peerList); return -1; }
-  peerList->exists = calloc(INITIAL_SIZE, sizeof(bool));
-  if (peerList->exists == NULL) { free(peerList->peers); free(peerList); return -1; }
+  if (peerList->peers == NULL) { free(peerList); peerList = NULL; return -1; }
 
-  peerList->size = 0;
+  peerList->count = 0;
   peerList->cap = INITIAL_SIZE;
+  peerList->index = NULL;
+  pthread_mutex_init(&(peerList->lock), NULL);
 
-  if (peerFile != NULL) {
-    peers = fopen(peerFile, "r");
-    if (peers == NULL) {
-      perror(programName);
-      return 0;
-    }
-    
+  pthread_mutex_lock(&(peerList->lock));
+  if (peerFile != NULL && (peers = fopen(peerFile, "r")) == NULL) {
+    perror(programName);
+  } else if (peerFile != NULL) {
     hostport = calloc(MAX_STR_BUF, sizeof(char));
     if (hostport == NULL) {
       fclose(peers);
-      return 0;
+      peers = NULL;
     }
 
-    while(!feof(peers)) {
+    while(peers != NULL && !feof(peers)) {
       char *ip, *portStr;
       uint16_t port;
       char* nullCheck = fgets(hostport, MAX_STR_BUF, peers);
       if (nullCheck == NULL) break;
-      
+
       ip = hostport;
       portStr = strrchr(hostport, ':');
       if (portStr == NULL) continue;
@@ -94,24 +398,38 @@ int Peers_init(char* peerFile) {
       portStr++;
 
       port = (uint16_t)atoi(portStr);
-      if (Peers_add(ip, port) == 0) count++;
+      if (Peers_insert(ip, port) == 0) {
+        peerList->peers[peerList->count - 1]->seed = strstr(portStr, LEARNED_TAG) == NULL;
+        count++;
+      }
     }
     free(hostport);
-    fclose(peers);
+    if (peers != NULL) fclose(peers);
   }
 
+  /* Publish the Whole File at Once */
+  if (Peers_publish() < 0) {
+    pthread_mutex_unlock(&(peerList->lock));
+    Peers_destroy();
+    return -1;
+  }
+  pthread_mutex_unlock(&(peerList->lock));
+
   return count;
 }
 
 /**
  * int Peers_dump(char*)
  * Dump all known peers to a file.
- * @param peerFile: Overwritten with newline-delimited <host>:<port> combinations.
+ * @param peerFile: Overwritten with newline-delimited <host>:<port> combinations,
+ *                  learned peers tagged so they are not read back as seeds.
  * @return number of peers written on success, negative on failure
  **/
 int Peers_dump(char* peerFile) {
+  struct snapshot* snap;
   FILE* peers;
-  int i, count;
+  size_t i;
+  int count = 0;
   if (peerFile == NULL) return -1;
 
   peers = fopen(peerFile, "w+");
@@ -120,42 +438,433 @@ int Peers_dump(char* peerFile) {
     return -1;
   }
 
-  for (i = 0; i < peerList->cap; i++) {
-    if (peerList->exists[i]) {
-      char port[PORT_LEN];
-      fputs(peerList->peers[i]->ip, peers);
-      fputc(':', peers);
-      snprintf(port, PORT_LEN, "%d", peerList->peers[i]->port);
-      fputs(port, peers);
-      fputc('\n', peers);
-      count++;
-    }
+  snap = Peers_acquire();
+  for (i = 0; snap != NULL && i < snap->count; i++) {
+    char port[PORT_LEN];
+    fputs(snap->peers[i]->ip, peers);
+    fputc(':', peers);
+    snprintf(port, PORT_LEN, "%d", snap->peers[i]->port);
+    fputs(port, peers);
+    if (!snap->peers[i]->seed) fputs(LEARNED_TAG, peers);
+    fputc('\n', peers);
+    count++;
   }
+  Peers_release(snap, false);
 
+  fclose(peers);
   return count;
 }
-  
+
 
 /**
- * Peer_T Peers_random(void)
- * @return A random peer from known peers.
+ * int Peers_random(struct sockaddr_in*)
+ * @param out: Overwritten with the address of a random known peer
+ * @return 0 on success, negative if there are no peers
  **/
-Peer_T Peers_random(void) {
+int Peers_random(struct sockaddr_in* out) {
+  struct snapshot* snap;
+  int ret = -1;
+
+  assert(out != NULL);
+
+  snap = Peers_acquire();
+  if (snap != NULL && snap->count > 0) {
+    *out = snap->peers[rand() % snap->count]->socket_address;
+    ret = 0;
+  }
+  Peers_release(snap, false);
+  return ret;
+}
+
+/* Expected cost of asking @param peer: a pessimistic RTT, inflated by how often it fails to answer and how loaded it is */
+static double Peers_score(Peer_T peer) {
+  double score, success;
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&(peer->stats));
+  success = peer->success > MIN_SUCCESS ? peer->success : MIN_SUCCESS;
+  score = (peer->srtt + 4 * peer->rttvar) / success;
+  if (now - peer->loadAt <= LOAD_STALE) score *= 1 + LOAD_WEIGHT * peer->load / 100.0;
+  if (peer->busyUntil > now) score *= BUSY_WEIGHT;
+  pthread_mutex_unlock(&(peer->stats));
+
+  return score;
+}
+
+/* True if @param peer published a summary recently and it matches @param probe. Stats lock must be held. */
+static bool Peers_holds(Peer_T peer, const struct probe* probe, time_t now) {
+  if (peer->summary == NULL || now - peer->summaryAt > SUMMARY_STALE) return false;
+  return Summary_matches(peer->summary, probe);
+}
+
+/* True if @param addr is one of the @param count addresses in @param list */
+static bool Peers_listed(const struct sockaddr_in* addr, const struct sockaddr_in* list, int count) {
   int i;
-  do {
-    /* Don't care too much about uniformity for this... */
-    i = rand() % peerList->cap;
-  } while (!peerList->exists[i]);
-  return peerList->peers[i];
+
+  for (i = 0; i < count; i++) {
+    if (list[i].sin_addr.s_addr == addr->sin_addr.s_addr && list[i].sin_port == addr->sin_port) return true;
+  }
+  return false;
+}
+
+/**
+ * uint64_t Peers_filterBits(const struct sockaddr_in*)
+ * @return The bits @param addr sets in a visited-node filter (a 64-bit Bloom filter)
+ **/
+uint64_t Peers_filterBits(const struct sockaddr_in* addr) {
+  uint64_t h;
+
+  assert(addr != NULL);
+
+  /* MurmurHash3 Finalizer over ip:port, Two Bits from Independent Slices */
+  h = Peers_mix(((uint64_t)ntohl(addr->sin_addr.s_addr) << 16) | ntohs(addr->sin_port));
+
+  return (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63));
 }
 
 /**
- * struct sockaddr Peers_socket(Peer_T);
- * @return Socket associated with @param peer
+ * bool Peers_eligible(Peer_T, const struct sockaddr_in*, int, uint64_t, const struct probe*, time_t, bool*)
+ * @return true if @param peer may be picked: alive, not excluded, and not already on the query's path
+ * @param holds: Overwritten with whether its summary matches @param probe
  **/
-struct sockaddr* Peers_socket(Peer_T peer) {
-  assert(peer != NULL);
-  return (struct sockaddr*)(&peer->socket_address);
+static bool Peers_eligible(Peer_T peer, const struct sockaddr_in* exclude, int excluded, uint64_t visited,
+                           const struct probe* probe, time_t now, bool* holds) {
+  bool dead;
+
+  if (Peers_listed(&(peer->socket_address), exclude, excluded)) return false;
+  if (visited) {
+    uint64_t bits = Peers_filterBits(&(peer->socket_address));
+    if ((visited & bits) == bits) return false;
+  }
+
+  pthread_mutex_lock(&(peer->stats));
+  dead = peer->dead;
+  *holds = !dead && probe != NULL && Peers_holds(peer, probe, now);
+  pthread_mutex_unlock(&(peer->stats));
+
+  return !dead;
+}
+
+/**
+ * int Peers_sample(const struct snapshot*, struct sockaddr_in*, int, const struct sockaddr_in*, int, uint64_t, const struct probe*)
+ * Peers_select() on a table too large to walk: each pick draws random peers
+ * until it has two eligible ones, or one whose summary matches, and keeps
+ * the better.
+ * @return Number of peers picked
+ **/
+static int Peers_sample(const struct snapshot* snap, struct sockaddr_in* out, int max,
+                        const struct sockaddr_in* exclude, int excluded, uint64_t visited, const struct probe* probe) {
+  time_t now = time(NULL);
+  int count = 0, draws, tries;
+
+  while (count < max) {
+    Peer_T best = NULL;
+    bool bestHolds = false;
+
+    for (draws = 0, tries = 0; tries < SAMPLE_TRIES; tries++) {
+      Peer_T peer = snap->peers[rand() % snap->count];
+      bool holds;
+
+      /* Without Replacement: Already Picked Counts as Excluded */
+      if (Peers_listed(&(peer->socket_address), out, count)) continue;
+      if (!Peers_eligible(peer, exclude, excluded, visited, probe, now, &holds)) continue;
+      draws++;
+
+      if (best == NULL || (holds && !bestHolds) ||
+          (holds == bestHolds && Peers_score(peer) < Peers_score(best))) {
+        best = peer;
+        bestHolds = holds;
+      }
+      if (draws >= 2 && (probe == NULL || bestHolds)) break;
+    }
+    if (best == NULL) break;
+
+    out[count++] = best->socket_address;
+  }
+
+  return count;
+} /* End Peers_sample() */
+
+/**
+ * int Peers_select(struct sockaddr_in*, int, const struct sockaddr_in*, int, uint64_t, const struct probe*)
+ * Picks distinct peers, favouring fast and reliable ones: each pick takes the
+ * better scoring of two random remaining peers (power of two choices).
+ * @param out: Filled with the addresses of the picked peers
+ * @param max: Maximum number of peers to pick, the size of @param out
+ * @param exclude: Peers that must not be picked, may be NULL
+ * @param excluded: Length of @param exclude
+ * @param visited: Filter of nodes already on the query's path, their peers aren't picked
+ * @param probe: If not NULL and some peers' summaries match it, only those are picked
+ * @return Number of peers picked
+ **/
+int Peers_select(struct sockaddr_in* out, int max, const struct sockaddr_in* exclude, int excluded,
+                 uint64_t visited, const struct probe* probe) {
+  struct snapshot* snap;
+  size_t* live;
+  size_t remaining = 0, matching = 0, i, a, b, pick;
+  time_t now = time(NULL);
+  int count = 0;
+
+  if (max <= 0) return 0;
+  snap = Peers_acquire();
+  if (snap == NULL) return 0;
+
+  if (snap->count > SCAN_MAX) {
+    count = Peers_sample(snap, out, max, exclude, excluded, visited, probe);
+    Peers_release(snap, false);
+    return count;
+  }
+
+  live = calloc(snap->count ? snap->count : 1, sizeof(size_t));
+  if (live == NULL) {
+    Peers_release(snap, false);
+    return 0;
+  }
+  for (i = 0; i < snap->count; i++) {
+    bool holds;
+
+    if (!Peers_eligible(snap->peers[i], exclude, excluded, visited, probe, now, &holds)) continue;
+    live[remaining++] = i;
+
+    /* Keep Peers Whose Fresh Summary Matches at the Front */
+    if (holds) {
+      live[remaining - 1] = live[matching];
+      live[matching++] = i;
+    }
+  }
+
+  /* Only Ask Peers That Can Answer, Unless None Claim To, Then Walk as Before */
+  if (matching > 0) remaining = matching;
+
+  while (count < max && remaining > 0) {
+    a = rand() % remaining;
+    pick = a;
+    if (remaining > 1) {
+      b = rand() % (remaining - 1);
+      if (b >= a) b++;
+      if (Peers_score(snap->peers[live[b]]) < Peers_score(snap->peers[live[a]])) pick = b;
+    }
+
+    out[count++] = snap->peers[live[pick]]->socket_address;
+    /* Remove from the Candidates */
+    live[pick] = live[--remaining];
+  }
+
+  free(live);
+  Peers_release(snap, false);
+  return count;
+} /* End Peers_select() */
+
+/**
+ * int Peers_setSummary(const struct sockaddr_in*, const uint8_t*, size_t)
+ * Stores the content summary the peer at @param addr published.
+ * @param filter: SUMMARY_BYTES long Bloom filter
+ * @return 0 on success, negative if the peer is unknown
+ **/
+int Peers_setSummary(const struct sockaddr_in* addr, const uint8_t* filter, size_t len) {
+  struct snapshot* snap;
+  Peer_T peer;
+  int ret = -1;
+
+  if (len != SUMMARY_BYTES) return -1;
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer != NULL) {
+    pthread_mutex_lock(&(peer->stats));
+    if (peer->summary == NULL) peer->summary = malloc(SUMMARY_BYTES);
+    if (peer->summary != NULL) {
+      memcpy(peer->summary, filter, SUMMARY_BYTES);
+      peer->summaryAt = time(NULL);
+      ret = 0;
+    }
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+  return ret;
+}
+
+/**
+ * void Peers_answered(const struct sockaddr_in*, double)
+ * Records that the peer at @param addr answered a recursion.
+ * @param rtt: Milliseconds between sending the query and receiving the answer
+ * @return None
+ **/
+void Peers_answered(const struct sockaddr_in* addr, double rtt) {
+  struct snapshot* snap;
+  Peer_T peer;
+
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer != NULL) {
+    pthread_mutex_lock(&(peer->stats));
+    if (peer->answers == 0) {
+      /* First Sample */
+      peer->srtt = rtt;
+      peer->rttvar = rtt / 2;
+    } else {
+      double err = rtt - peer->srtt;
+      peer->rttvar += RTT_BETA * ((err < 0 ? -err : err) - peer->rttvar);
+      peer->srtt += RTT_ALPHA * err;
+    }
+    peer->success += SUCCESS_GAIN * (1.0 - peer->success);
+    peer->answers++;
+
+    /* Proof of Life, Whatever Path it Came By */
+    peer->heardAt = time(NULL);
+    peer->failures = 0;
+    peer->dead = false;
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+}
+
+/**
+ * void Peers_loaded(const struct sockaddr_in*, int, bool)
+ * Records the load the peer at @param addr reported, de-weighting it while it is high.
+ * @param load: Percent of its capacity in use, negative if it did not say
+ * @param busy: Whether it turned the query away, it is avoided for BUSY_BACKOFF
+ * @return None
+ **/
+void Peers_loaded(const struct sockaddr_in* addr, int load, bool busy) {
+  struct snapshot* snap;
+  Peer_T peer;
+  time_t now = time(NULL);
+
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer != NULL) {
+    pthread_mutex_lock(&(peer->stats));
+    if (load >= 0) {
+      peer->load = load;
+      peer->loadAt = now;
+    }
+    if (busy) peer->busyUntil = now + BUSY_BACKOFF;
+
+    /* Overloaded, but Alive */
+    peer->heardAt = now;
+    peer->failures = 0;
+    peer->dead = false;
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+}
+
+/**
+ * double Peers_hedgeDelay(const struct sockaddr_in*)
+ * @return Milliseconds within which the peer at @param addr usually answers (about its p95 RTT)
+ **/
+double Peers_hedgeDelay(const struct sockaddr_in* addr) {
+  struct snapshot* snap;
+  Peer_T peer;
+  double ret = INITIAL_RTT * 2;
+
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer != NULL) {
+    pthread_mutex_lock(&(peer->stats));
+    ret = peer->srtt + 2 * peer->rttvar;
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+
+  return ret > MIN_HEDGE ? ret : MIN_HEDGE;
+}
+
+/**
+ * void Peers_timedOut(const struct sockaddr_in*)
+ * Records that the peer at @param addr never answered a recursion.
+ * @return None
+ **/
+void Peers_timedOut(const struct sockaddr_in* addr) {
+  struct snapshot* snap;
+  Peer_T peer;
+
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer != NULL) {
+    pthread_mutex_lock(&(peer->stats));
+    peer->success -= SUCCESS_GAIN * peer->success;
+    peer->timeouts++;
+
+    /* Ping Soon to Tell a Slow Recursion From a Dead Peer */
+    if (peer->probeAt > time(NULL) + PROBE_MIN) peer->probeAt = time(NULL) + PROBE_MIN;
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+}
+
+/**
+ * size_t Peers_count(void)
+ * @return Number of known peers
+ **/
+size_t Peers_count(void) {
+  struct snapshot* snap;
+  size_t count = 0;
+
+  snap = Peers_acquire();
+  if (snap != NULL) count = snap->count;
+  Peers_release(snap, false);
+  return count;
+}
+
+/**
+ * bool Peers_knows(const struct sockaddr_in*)
+ * For requests sent from an ephemeral socket, whose port says nothing.
+ * @return true if a known peer has the IP address of @param addr, whatever its port
+ **/
+bool Peers_knows(const struct sockaddr_in* addr) {
+  struct snapshot* snap;
+  size_t i;
+  bool known = false;
+
+  assert(addr != NULL);
+  snap = Peers_acquire();
+  for (i = 0; snap != NULL && i < snap->count && !known; i++)
+    known = snap->peers[i]->socket_address.sin_addr.s_addr == addr->sin_addr.s_addr;
+  Peers_release(snap, false);
+
+  return known;
+}
+
+/**
+ * bool Peers_has(const struct sockaddr_in*)
+ * @return true if @param addr, IP and port, is already a known peer
+ **/
+bool Peers_has(const struct sockaddr_in* addr) {
+  struct snapshot* snap;
+  size_t i;
+  bool known = false;
+
+  assert(addr != NULL);
+  snap = Peers_acquire();
+  for (i = 0; snap != NULL && i < snap->count && !known; i++)
+    known = snap->peers[i]->socket_address.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            snap->peers[i]->socket_address.sin_port == addr->sin_port;
+  Peers_release(snap, false);
+
+  return known;
+}
+
+/**
+ * bool Peers_isDead(const struct sockaddr_in*)
+ * @return true if @param addr is a known peer that health checks marked dead
+ **/
+bool Peers_isDead(const struct sockaddr_in* addr) {
+  struct snapshot* snap;
+  Peer_T peer;
+  bool dead = false;
+
+  assert(addr != NULL);
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer != NULL) {
+    pthread_mutex_lock(&(peer->stats));
+    dead = peer->dead;
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+
+  return dead;
 }
 
 /**
@@ -163,87 +872,302 @@ struct sockaddr* Peers_socket(Peer_T peer) {
  * Add peer to known peers.
  * @param ip: A valid ipv4 or ipv6 address
  * @param port: Valid port number
- * @return: 0 on success, negative on failure
+ * @return: 0 if added, 1 if already known, negative on failure
  **/
 int Peers_add(const char* ip, uint16_t port) {
-  Peer_T newPeer = calloc(1, sizeof(struct peer));
-  if (newPeer == NULL) return -1;
+  int ret;
 
   assert(ip != NULL);
-  
-  newPeer->ip = calloc(strlen(ip) + 1, sizeof(char));
-  if (newPeer->ip == NULL) {
-    free(newPeer); return -1;
+  if (peerList == NULL) return -1;
+
+  pthread_mutex_lock(&(peerList->lock));
+  ret = Peers_insert(ip, port);
+  if (ret == 0 && Peers_publish() < 0) {
+    Peers_remove(peerList->count - 1);
+    ret = -1;
   }
+  pthread_mutex_unlock(&(peerList->lock));
 
-  strcpy(newPeer->ip, ip);
-  newPeer->port = port;
+  return ret;
+}
 
-  newPeer->socket_address.sin_family = AF_INET;
-  newPeer->socket_address.sin_addr.s_addr=inet_addr(ip);
-  newPeer->socket_address.sin_port=htons(port);
+/**
+ * int Peers_share(struct sockaddr_in*, double*, int, const struct sockaddr_in*)
+ * Picks healthy peers to tell another node about: alive and heard from,
+ * each pick the better scoring of two random remaining ones.
+ * @param out: Filled with the addresses of the picked peers
+ * @param rtts: Filled with each picked peer's smoothed RTT in milliseconds
+ * @param max: Size of @param out and @param rtts
+ * @param exclude: The node asking, never picked, may be NULL
+ * @return Number of peers picked
+ **/
+int Peers_share(struct sockaddr_in* out, double* rtts, int max, const struct sockaddr_in* exclude) {
+  struct snapshot* snap;
+  size_t* live;
+  size_t remaining = 0, i, a, b, pick;
+  int count = 0;
 
-  if (peerList->size + 1 >= peerList->cap) {
-    int i;
-    /* Grow Peer List */
-    peerList->cap *= 2;
-    peerList->peers = realloc(peerList->peers, peerList->cap * sizeof(Peer_T));
-    if (peerList->peers == NULL) { free(newPeer->ip); free(newPeer); peerList->cap /= 2; return -1; }
-    peerList->exists = realloc(peerList->exists, peerList->cap * sizeof(bool));
-    if (peerList->exists == NULL) { free(newPeer->ip); free(newPeer); peerList->cap /= 2; return -1; }
-    for (i = peerList->cap / 2; i < peerList->cap; i++) peerList->exists[i] = false;
+  if (max <= 0) return 0;
+  snap = Peers_acquire();
+  if (snap == NULL) return 0;
+
+  live = calloc(snap->count ? snap->count : 1, sizeof(size_t));
+  if (live == NULL) {
+    Peers_release(snap, false);
+    return 0;
   }
-  
-  /* Add Peer to List */
-  newPeer->index = peerList->size;
-  peerList->peers[peerList->size] = newPeer;
-  peerList->exists[peerList->size] = true;
-  peerList->size++;
+  for (i = 0; i < snap->count; i++) {
+    Peer_T peer = snap->peers[i];
+    bool healthy;
 
-  return 0;
-}
+    if (exclude != NULL && Peers_listed(&(peer->socket_address), exclude, 1)) continue;
+
+    /* Only Vouch for Peers We Have Heard From */
+    pthread_mutex_lock(&(peer->stats));
+    healthy = !peer->dead && peer->heardAt != 0;
+    pthread_mutex_unlock(&(peer->stats));
+    if (healthy) live[remaining++] = i;
+  }
+
+  while (count < max && remaining > 0) {
+    Peer_T peer;
+
+    a = rand() % remaining;
+    pick = a;
+    if (remaining > 1) {
+      b = rand() % (remaining - 1);
+      if (b >= a) b++;
+      if (Peers_score(snap->peers[live[b]]) < Peers_score(snap->peers[live[a]])) pick = b;
+    }
+
+    peer = snap->peers[live[pick]];
+    out[count] = peer->socket_address;
+    pthread_mutex_lock(&(peer->stats));
+    rtts[count] = peer->srtt;
+    pthread_mutex_unlock(&(peer->stats));
+    count++;
+    live[pick] = live[--remaining];
+  }
+
+  free(live);
+  Peers_release(snap, false);
+  return count;
+} /* End Peers_share() */
 
 /**
- * int Peers_drop(Peer_T peer)
- * Removes and frees peer from known peers (usually used after failed Ping)
- * @param peer: Must be a peer returned by Peers_random()
+ * int Peers_merge(const struct sockaddr_in*, const double*, int)
+ * Adds peers we have reached ourselves, keeping at most PEERS_MAX: once full, a
+ * newcomer only replaces a dead peer or one scoring worse than its RTT, never a seed.
+ * @param addrs: Addresses of the new peers
+ * @param rtts: RTT in milliseconds we measured to each, the starting point for its statistics, NULL if unknown
+ * @param count: Length of @param addrs
+ * @return Number of peers added, negative on failure
+ **/
+int Peers_merge(const struct sockaddr_in* addrs, const double* rtts, int count) {
+  char ip[INET_ADDRSTRLEN];
+  int added = 0, i;
+  bool changed = false;
+  size_t j;
+
+  if (peerList == NULL) return -1;
+
+  pthread_mutex_lock(&(peerList->lock));
+  for (i = 0; i < count; i++) {
+    Peer_T found, peer;
+    uint64_t key = Peers_key(&(addrs[i]));
+
+    HASH_FIND(hh, peerList->index, &key, sizeof(uint64_t), found);
+    if (found != NULL || addrs[i].sin_port == 0 || addrs[i].sin_addr.s_addr == INADDR_ANY) continue;
+
+    if (peerList->count >= PEERS_MAX) {
+      /* Displace the Worst Peer, Dead Ones First, if the Newcomer Looks Better; Seeds Stay */
+      size_t worst = 0;
+      double worstScore = -1, score;
+      bool worstDead = false;
+
+      for (j = 0; j < peerList->count; j++) {
+        bool dead;
+
+        if (peerList->peers[j]->seed) continue;
+        pthread_mutex_lock(&(peerList->peers[j]->stats));
+        dead = peerList->peers[j]->dead;
+        pthread_mutex_unlock(&(peerList->peers[j]->stats));
+        score = Peers_score(peerList->peers[j]);
+        if ((dead && !worstDead) || (dead == worstDead && score > worstScore)) {
+          worst = j;
+          worstScore = score;
+          worstDead = dead;
+        }
+      }
+
+      /* Score of a Peer Never Heard From: srtt + 4 * srtt / 2 */
+      if (worstScore < 0) continue;
+      if (!worstDead && worstScore <= 3 * (rtts != NULL ? rtts[i] : INITIAL_RTT)) continue;
+      Peers_remove(worst);
+      changed = true;
+    }
+
+    if (inet_ntop(AF_INET, &(addrs[i].sin_addr), ip, INET_ADDRSTRLEN) == NULL) continue;
+    if (Peers_insert(ip, ntohs(addrs[i].sin_port)) != 0) continue;
+
+    /* Start From Our Measurement, Later Answers Refine It */
+    peer = peerList->peers[peerList->count - 1];
+    if (rtts != NULL) {
+      peer->srtt = rtts[i];
+      peer->rttvar = rtts[i] / 2;
+    }
+    added++;
+    changed = true;
+  }
+
+  if (changed && Peers_publish() < 0) added = -1;
+  pthread_mutex_unlock(&(peerList->lock));
+
+  return added;
+} /* End Peers_merge() */
+
+/**
+ * int Peers_due(struct sockaddr_in*, int)
+ * Picks the peers due a ping: not heard from within their interval, and dead
+ * ones every PROBE_MAX so they can be re-admitted. Each is rescheduled.
+ * @param out: Filled with the addresses to ping
+ * @param max: Size of @param out
+ * @return Number of peers to ping
+ **/
+int Peers_due(struct sockaddr_in* out, int max) {
+  struct snapshot* snap;
+  time_t now = time(NULL);
+  size_t i;
+  int count = 0;
+
+  snap = Peers_acquire();
+  for (i = 0; snap != NULL && i < snap->count && count < max; i++) {
+    Peer_T peer = snap->peers[i];
+
+    pthread_mutex_lock(&(peer->stats));
+    if (peer->probeAt <= now) {
+      /* Answered Recursions Recently, No Need to Ask */
+      if (!peer->dead && peer->heardAt + peer->interval > now) {
+        peer->probeAt = peer->heardAt + peer->interval;
+      } else {
+        out[count++] = peer->socket_address;
+        peer->probeAt = now + peer->interval;
+      }
+    }
+    pthread_mutex_unlock(&(peer->stats));
+  }
+  Peers_release(snap, false);
+
+  return count;
+} /* End Peers_due() */
+
+/**
+ * void Peers_probed(const struct sockaddr_in*, bool)
+ * Records the outcome of a ping, marking the peer suspect or dead after
+ * consecutive failures, re-admitting it once it answers, and forgetting a
+ * learned peer once it has been dead for EVICT_AFTER. Seeds are kept.
+ * @param alive: Whether the peer at @param addr answered
+ * @return None
+ **/
+void Peers_probed(const struct sockaddr_in* addr, bool alive) {
+  struct snapshot* snap;
+  Peer_T peer;
+  time_t now = time(NULL);
+  bool evict = false;
+
+  snap = Peers_acquire();
+  peer = snap != NULL ? Peers_lookup(snap, addr) : NULL;
+  if (peer == NULL) {
+    Peers_release(snap, false);
+    return;
+  }
+
+  pthread_mutex_lock(&(peer->stats));
+  if (alive) {
+    if (peer->dead) printf("%s: Peers: %s:%d answered again, re-admitted\n", programName, peer->ip, peer->port);
+    peer->failures = 0;
+    peer->dead = false;
+    peer->heardAt = now;
+    /* Healthy, Ping Less Often */
+    peer->interval = peer->interval * 2 < PROBE_MAX ? peer->interval * 2 : PROBE_MAX;
+  } else {
+    peer->failures++;
+    peer->interval = PROBE_MIN;
+    if (peer->failures >= DEAD_AFTER) {
+      if (!peer->dead) {
+        printf("%s: Peers: %s:%d missed %d pings, dead\n", programName, peer->ip, peer->port, peer->failures);
+        peer->dead = true;
+        peer->deadSince = now;
+      }
+      peer->interval = PROBE_MAX;
+      if (!peer->seed && now - peer->deadSince >= EVICT_AFTER) {
+        printf("%s: Peers: %s:%d dead for too long, evicted\n", programName, peer->ip, peer->port);
+        evict = true;
+      }
+    } else if (peer->failures == SUSPECT_AFTER) {
+      printf("%s: Peers: %s:%d missed a ping, suspect\n", programName, peer->ip, peer->port);
+    }
+  }
+  peer->probeAt = now + peer->interval;
+  pthread_mutex_unlock(&(peer->stats));
+  Peers_release(snap, false);
+
+  if (evict) Peers_drop(addr);
+} /* End Peers_probed() */
+
+/**
+ * int Peers_drop(const struct sockaddr_in*)
+ * Removes a peer from known peers (usually used after failed Ping)
+ * Readers already holding it keep it until they are done.
+ * @param addr: Address of the peer
  * @return: 0 on success, negative on failure or not found
  **/
-int Peers_drop(Peer_T peer) {
-  int i = peer->index;
-  assert(peer != NULL);
+int Peers_drop(const struct sockaddr_in* addr) {
+  Peer_T peer;
+  uint64_t key;
 
-  if (peerList->exists[i]) {
-    peerList->exists[i] = false;
-    free(peerList->peers[i]->ip);
-    free(peerList->peers[i]);
-    peerList->peers[i] = NULL;
-    return 0;
+  assert(addr != NULL);
+  if (peerList == NULL) return -1;
+  key = Peers_key(addr);
+
+  pthread_mutex_lock(&(peerList->lock));
+  HASH_FIND(hh, peerList->index, &key, sizeof(uint64_t), peer);
+  if (peer == NULL) {
+    pthread_mutex_unlock(&(peerList->lock));
+    return -1;
   }
 
-  return -1;
+  Peers_remove((size_t)peer->index);
+  /* Out of Memory Leaves it Visible Until the Next Publish */
+  (void)Peers_publish();
+  pthread_mutex_unlock(&(peerList->lock));
+  return 0;
 }
 
 /**
  * void Peers_destroy(void)
  * Cleans up all resources associated with this AO.
+ * Every reader must be done.
  * @return None
  **/
 void Peers_destroy(void) {
-  int i;
+  size_t count;
+
   if (peerList) {
-    if (peerList->peers) {
-      for (i = 0; i < peerList->cap; i++) {
-        if (peerList->peers[i]) {
-          if (peerList->peers[i]->ip) free(peerList->peers[i]->ip);
-          free(peerList->peers[i]);
-        }
-      }
-      free(peerList->peers);
+    pthread_mutex_lock(&(peerList->lock));
+    if (peerList->current != NULL) {
+      peerList->current->retired = peerList->retired;
+      peerList->retired = peerList->current;
+      peerList->current = NULL;
     }
-    if (peerList->exists) free(peerList->exists);
+    Peers_reclaim();
+    for (count = peerList->count; count > 0; count--) Peers_remove(count - 1);
+    free(peerList->peers);
+    HASH_CLEAR(hh, peerList->index);
+    pthread_mutex_unlock(&(peerList->lock));
+
+    pthread_mutex_destroy(&(peerList->lock));
     free(peerList);
     peerList = NULL;
   }
 }
-
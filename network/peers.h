@@ -2,20 +2,27 @@
  * File: peers.h
  * Author: Ethan Gordon
  * A local cache of MARP peers. (Abstract Object)
+ * Safe to call from any thread.
  **/
 
 #ifndef PEERS_H
 #define PEERS_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "summary.h"
 
 typedef struct peer *Peer_T;
 
 /**
  * int Peers_init(char*)
  * Initialize the AO list of peers.
- * @param peerFile: Optional file with newline-delimited <host>:<port> combinations.
+ * @param peerFile: Optional file with newline-delimited <host>:<port> combinations,
+ *                  followed by "learned" for peers that are not seeds.
  * @return number of peers read on success, negative on failure.
  **/
 int Peers_init(char* peerFile);
@@ -23,39 +30,163 @@ int Peers_init(char* peerFile);
 /**
  * int Peers_dump(char*)
  * Dump all known peers to a file.
- * @param peerFile: Overwritten with newline-delimited <host>:<port> combinations.
+ * @param peerFile: Overwritten with newline-delimited <host>:<port> combinations,
+ *                  learned peers tagged so they are not read back as seeds.
  * @return number of peers written on success, negative on failure
  **/
 int Peers_dump(char* peerFile);
 
 /**
- * Peer_T Peers_random(void)
- * @return A random peer from known peers.
+ * int Peers_random(struct sockaddr_in*)
+ * @param out: Overwritten with the address of a random known peer
+ * @return 0 on success, negative if there are no peers
+ **/
+int Peers_random(struct sockaddr_in* out);
+
+/**
+ * size_t Peers_count(void)
+ * @return Number of known peers
+ **/
+size_t Peers_count(void);
+
+/**
+ * bool Peers_knows(const struct sockaddr_in*)
+ * For requests sent from an ephemeral socket, whose port says nothing.
+ * @return true if a known peer has the IP address of @param addr, whatever its port
+ **/
+bool Peers_knows(const struct sockaddr_in* addr);
+
+/**
+ * bool Peers_has(const struct sockaddr_in*)
+ * @return true if @param addr, IP and port, is already a known peer
+ **/
+bool Peers_has(const struct sockaddr_in* addr);
+
+/**
+ * bool Peers_isDead(const struct sockaddr_in*)
+ * @return true if @param addr is a known peer that health checks marked dead
+ **/
+bool Peers_isDead(const struct sockaddr_in* addr);
+
+/**
+ * uint64_t Peers_filterBits(const struct sockaddr_in*)
+ * @return The bits @param addr sets in a visited-node filter (a 64-bit Bloom filter)
+ **/
+uint64_t Peers_filterBits(const struct sockaddr_in* addr);
+
+/**
+ * int Peers_select(struct sockaddr_in*, int, const struct sockaddr_in*, int, uint64_t, const struct probe*)
+ * Picks distinct peers, favouring fast and reliable ones: each pick takes the
+ * better scoring of two random remaining peers (power of two choices).
+ * @param out: Filled with the addresses of the picked peers
+ * @param max: Maximum number of peers to pick, the size of @param out
+ * @param exclude: Peers that must not be picked, may be NULL
+ * @param excluded: Length of @param exclude
+ * @param visited: Filter of nodes already on the query's path, their peers aren't picked
+ * @param probe: If not NULL and some peers' summaries match it, only those are picked
+ * @return Number of peers picked
+ **/
+int Peers_select(struct sockaddr_in* out, int max, const struct sockaddr_in* exclude, int excluded,
+                 uint64_t visited, const struct probe* probe);
+
+/**
+ * int Peers_setSummary(const struct sockaddr_in*, const uint8_t*, size_t)
+ * Stores the content summary the peer at @param addr published.
+ * @param filter: SUMMARY_BYTES long Bloom filter
+ * @return 0 on success, negative if the peer is unknown
  **/
-Peer_T Peers_random(void);
+int Peers_setSummary(const struct sockaddr_in* addr, const uint8_t* filter, size_t len);
 
 /**
- * struct sockaddr Peers_socket(Peer_T);
- * @return Socket associated with @param peer
+ * double Peers_hedgeDelay(const struct sockaddr_in*)
+ * @return Milliseconds within which the peer at @param addr usually answers (about its p95 RTT)
+ **/
+double Peers_hedgeDelay(const struct sockaddr_in* addr);
+
+/**
+ * void Peers_answered(const struct sockaddr_in*, double)
+ * Records that the peer at @param addr answered a recursion.
+ * @param rtt: Milliseconds between sending the query and receiving the answer
+ * @return None
+ **/
+void Peers_answered(const struct sockaddr_in* addr, double rtt);
+
+/**
+ * void Peers_loaded(const struct sockaddr_in*, int, bool)
+ * Records the load the peer at @param addr reported, de-weighting it while it is high.
+ * @param load: Percent of its capacity in use, negative if it did not say
+ * @param busy: Whether it turned the query away, it is avoided for BUSY_BACKOFF
+ * @return None
+ **/
+void Peers_loaded(const struct sockaddr_in* addr, int load, bool busy);
+
+/**
+ * void Peers_timedOut(const struct sockaddr_in*)
+ * Records that the peer at @param addr never answered a recursion.
+ * @return None
+ **/
+void Peers_timedOut(const struct sockaddr_in* addr);
+
+/**
+ * int Peers_share(struct sockaddr_in*, double*, int, const struct sockaddr_in*)
+ * Picks healthy peers to tell another node about: alive and heard from,
+ * each pick the better scoring of two random remaining ones.
+ * @param out: Filled with the addresses of the picked peers
+ * @param rtts: Filled with each picked peer's smoothed RTT in milliseconds
+ * @param max: Size of @param out and @param rtts
+ * @param exclude: The node asking, never picked, may be NULL
+ * @return Number of peers picked
+ **/
+int Peers_share(struct sockaddr_in* out, double* rtts, int max, const struct sockaddr_in* exclude);
+
+/**
+ * int Peers_merge(const struct sockaddr_in*, const double*, int)
+ * Adds peers we have reached ourselves, keeping at most PEERS_MAX: once full, a
+ * newcomer only replaces a dead peer or one scoring worse than its RTT, never a seed.
+ * @param addrs: Addresses of the new peers
+ * @param rtts: RTT in milliseconds we measured to each, the starting point for its statistics, NULL if unknown
+ * @param count: Length of @param addrs
+ * @return Number of peers added, negative on failure
+ **/
+int Peers_merge(const struct sockaddr_in* addrs, const double* rtts, int count);
+
+/**
+ * int Peers_due(struct sockaddr_in*, int)
+ * Picks the peers due a ping: not heard from within their interval, and dead
+ * ones every PROBE_MAX so they can be re-admitted. Each is rescheduled.
+ * @param out: Filled with the addresses to ping
+ * @param max: Size of @param out
+ * @return Number of peers to ping
+ **/
+int Peers_due(struct sockaddr_in* out, int max);
+
+/**
+ * void Peers_probed(const struct sockaddr_in*, bool)
+ * Records the outcome of a ping, marking the peer suspect or dead after
+ * consecutive failures, re-admitting it once it answers, and forgetting a
+ * learned peer once it has been dead for EVICT_AFTER. Seeds are kept.
+ * @param alive: Whether the peer at @param addr answered
+ * @return None
  **/
-struct sockaddr* Peers_socket(Peer_T peer);
+void Peers_probed(const struct sockaddr_in* addr, bool alive);
 
 /**
  * int Peers_add(char*, uint16_t)
  * Add peer to known peers.
  * @param ip: A valid ipv4 or ipv6 address
  * @param port: Valid port number
- * @return: 0 on success, negative on failure
+ * @return: 0 if added, 1 if already known, negative on failure
  **/
 int Peers_add(const char* ip, uint16_t port);
 
 /**
- * int Peers_drop(Peer_T peer)
- * Removes peer from known peers (usually used after failed Ping)
- * @param peer: Must be a peer returned by Peers_random()
- * @return: 0 on success, negative on failur or not found
+ * int Peers_drop(const struct sockaddr_in*)
+ * Removes a peer from known peers (usually used after failed Ping)
+ * Readers already holding it keep it until they are done.
+ * @param addr: Address of the peer
+ * @return: 0 on success, negative on failure or not found
  **/
-int Peers_drop(Peer_T peer);
+int Peers_drop(const struct sockaddr_in* addr);
 
 /**
  * void Peers_destroy(void)
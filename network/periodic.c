@@ -0,0 +1,79 @@
+/**
+ * File: periodic.c
+ * Author: Ethan Gordon
+ * Background workers: a thread with its own unbound socket that runs one
+ * round of work, waits, and runs the next, until the work is done or the
+ * daemon shuts down.
+ **/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "socket.h"
+#include "periodic.h"
+
+extern volatile bool isRunning;
+
+/* Worker struct, holds the thread and the round to run */
+struct periodic {
+  pthread_t thread;
+  Periodic_round round;
+  void* arg;
+};
+
+/* Run rounds until one says it is done, or shutdown */
+static void* Periodic_thread(void* arg) {
+  Periodic_T worker = arg;
+  Socket_T socket;
+  int wait, waited;
+
+  socket = Socket_init(0); /* Unbound Socket */
+  if (socket == NULL) return NULL;
+
+  while (isRunning) {
+    wait = worker->round(socket, worker->arg);
+    if (wait < 0) break;
+
+    /* Sleep a Second at a Time, so Shutdown Never Waits Out a Long Interval */
+    for (waited = 0; waited < wait && isRunning; waited++) sleep(1);
+  }
+
+  Socket_free(socket);
+  return NULL;
+} /* End Periodic_thread() */
+
+/**
+ * Periodic_T Periodic_start(Periodic_round, void*)
+ * Starts a thread that runs @param round until it finishes or the daemon
+ * shuts down, waking every second to notice shutdown while it waits.
+ * @param arg: Passed to every call of @param round
+ * @return a new worker, or NULL on failure
+ **/
+Periodic_T Periodic_start(Periodic_round round, void* arg) {
+  Periodic_T ret = calloc(1, sizeof(struct periodic));
+  if (ret == NULL) return NULL;
+
+  ret->round = round;
+  ret->arg = arg;
+  if (pthread_create(&(ret->thread), NULL, Periodic_thread, ret) != 0) {
+    free(ret);
+    return NULL;
+  }
+
+  return ret;
+}
+
+/**
+ * void Periodic_stop(Periodic_T)
+ * Waits for @param worker to notice shutdown and exit, then frees it.
+ * Does nothing if @param worker is NULL.
+ * @return None
+ **/
+void Periodic_stop(Periodic_T worker) {
+  if (worker == NULL) return;
+
+  pthread_join(worker->thread, NULL);
+  free(worker);
+}
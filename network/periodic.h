@@ -0,0 +1,44 @@
+/**
+ * File: periodic.h
+ * Author: Ethan Gordon
+ * Background workers: a thread with its own unbound socket that runs one
+ * round of work, waits, and runs the next, until the work is done or the
+ * daemon shuts down.
+ **/
+
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#include "socket.h"
+
+/* Worker struct, holds the thread and the round to run */
+typedef struct periodic *Periodic_T;
+
+/**
+ * int (*Periodic_round)(Socket_T, void*)
+ * One round of a worker's job.
+ * @param socket: The worker's unbound socket
+ * @param arg: As passed to Periodic_start()
+ * @return Seconds to wait before the next round, 0 to go again at once,
+ *         negative once the job is done
+ **/
+typedef int (*Periodic_round)(Socket_T socket, void* arg);
+
+/**
+ * Periodic_T Periodic_start(Periodic_round, void*)
+ * Starts a thread that runs @param round until it finishes or the daemon
+ * shuts down, waking every second to notice shutdown while it waits.
+ * @param arg: Passed to every call of @param round
+ * @return a new worker, or NULL on failure
+ **/
+Periodic_T Periodic_start(Periodic_round round, void* arg);
+
+/**
+ * void Periodic_stop(Periodic_T)
+ * Waits for @param worker to notice shutdown and exit, then frees it.
+ * Does nothing if @param worker is NULL.
+ * @return None
+ **/
+void Periodic_stop(Periodic_T worker);
+
+#endif
@@ -3,130 +3,595 @@
  * Author: Ethan Gordon
  * A read-write UDP interface that broadcasts a datagram, then launches a
  * thread to wait on responses for a set period of time.
+ * All recursors share one daemon-owned socket, responses are handed back to
+ * the waiting recursor by QID and source address.
  **/
+#define _GNU_SOURCE
+
 #include "peers.h"
 #include "recursor.h"
+#include "../frame.h"
 
-#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <stdint.h>
-#include <sys/select.h>
+#include <pthread.h>
+
+#include "../uthash.h"
+
+/* A response waiting to be polled */
+struct answer {
+  void* buf;
+  size_t len;
+  struct sockaddr_in from;
+};
 
 /* Socket struct, holds QID-Address table and UDP information */
 struct recursor {
-  int nfds;
-  int* fds;
-  size_t numfd;
-  fd_set readSet;
-  struct timeval timeout;
+  uint32_t qid;
+  /* Query, kept to hedge to more peers */
+  void* data;
+  size_t dataLen;
+  /* Offset of the visited-node filter in data, 0 if none */
+  size_t visitedAt;
+  /* Content summary bits of the query, used if hasProbe */
+  struct probe probe;
+  bool hasProbe;
+
+  /* Peers the query was sent to, only their responses are accepted */
+  struct sockaddr_in* sent;
+  struct timespec* sentAt;
+  size_t numSent;
+  /* Most peers to send to, including hedges */
+  size_t fanout;
+  /* Send to one more peer if nothing has arrived by then */
+  struct timespec nextHedge;
+  /* Peers that already responded */
+  bool* answered;
+  size_t numAnswered;
+  /* Peers that turned the query away or had no answer, each owed a hedge at once */
+  size_t turnedAway;
+
+  /* Responses received but not yet polled */
+  struct answer* queue;
+  size_t queued;
+  pthread_cond_t ready;
+  struct timespec deadline;
+  bool done;
 
   void* buf;
   size_t bufLen;
+
+  /* In the shared QID table */
+  bool registered;
+  /* Other recursors waiting on the same QID */
+  struct recursor* sameQid;
+  UT_hash_handle hh;
+};
+
+/* Queries bound for one peer, waiting out the batching window to share a datagram */
+struct pending {
+  uint64_t key;
+  struct sockaddr_in to;
+  void* items[BATCH_MAX];
+  size_t lens[BATCH_MAX];
+  int count;
+  /* Bytes in the batch, length prefixes included */
+  size_t bytes;
+  struct timespec flushAt;
+  UT_hash_handle hh;
 };
-  
+
+/* Shared recursion socket, owned by the daemon */
+static struct {
+  int fd;
+  pthread_t thread;
+  volatile bool running;
+  /* Guards waiting, pending and every recursor's queue */
+  pthread_mutex_t lock;
+  struct recursor* waiting;
+
+  /* Microseconds a query waits for others bound to the same peer, 0 to send at once */
+  long batch;
+  struct pending* pending;
+  pthread_cond_t flush;
+  pthread_t batcher;
+} shared = { -1 };
+
 extern char* programName;
-#define MAX_BUF 512
+
+/* Largest UDP payload that is not fragmented on Ethernet */
+#define MAX_BUF 1472
+
+/* Milliseconds between two timespecs */
+#define ELAPSED_MS(from, to) (((to).tv_sec - (from).tv_sec) * 1000.0 + ((to).tv_nsec - (from).tv_nsec) / 1000000.0)
+
+/* Hand a datagram to the recursor waiting on its QID that sent to @param from. Lock must be held. */
+static void Recursor_deliver(const void* buf, size_t len, const struct sockaddr_in* from) {
+  struct recursor* current;
+  struct timespec now;
+  uint32_t qid;
+  size_t i;
+  bool busy;
+  int load;
+
+  if (len < sizeof(qid)) return;
+  memcpy(&qid, buf, sizeof(qid));
+
+  HASH_FIND(hh, shared.waiting, &qid, sizeof(qid), current);
+  for (; current != NULL; current = current->sameQid) {
+    if (current->done) continue;
+
+    for (i = 0; i < current->numSent; i++) {
+      if (current->answered[i]) continue;
+      if (current->sent[i].sin_addr.s_addr != from->sin_addr.s_addr) continue;
+      if (current->sent[i].sin_port != from->sin_port) continue;
+
+      load = Frame_load(buf, len, &busy);
+      if (!Frame_isAnswer(buf, len)) {
+        /* Not an Answer, Ask Someone Else Without Waiting Out the Hedge Timer */
+        current->answered[i] = true;
+        current->numAnswered++;
+        current->turnedAway++;
+        pthread_cond_signal(&(current->ready));
+        if (busy) {
+          Peers_loaded(from, load, true);
+        } else {
+          clock_gettime(CLOCK_MONOTONIC, &now);
+          Peers_answered(from, ELAPSED_MS(current->sentAt[i], now));
+          if (load >= 0) Peers_loaded(from, load, false);
+        }
+        return;
+      }
+
+      current->queue[current->queued].buf = malloc(len);
+      if (current->queue[current->queued].buf == NULL) return;
+      memcpy(current->queue[current->queued].buf, buf, len);
+      current->queue[current->queued].len = len;
+      current->queue[current->queued].from = *from;
+      current->queued++;
+
+      current->answered[i] = true;
+      current->numAnswered++;
+      pthread_cond_signal(&(current->ready));
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      Peers_answered(from, ELAPSED_MS(current->sentAt[i], now));
+      if (load >= 0) Peers_loaded(from, load, false);
+      return;
+    }
+  }
+}
+
+/* Frame_unbatch() callback, delivers each answer of a batch on its own. Lock must be held. */
+static void Recursor_deliverItem(void* from, const void* buf, size_t len) {
+  Recursor_deliver(buf, len, from);
+}
+
+/* Add @param ms milliseconds to @param ts */
+static void Recursor_addMs(struct timespec* ts, double ms) {
+  long nsec = ts->tv_nsec + (long)(ms * 1000000.0);
+
+  ts->tv_sec += nsec / 1000000000L;
+  ts->tv_nsec = nsec % 1000000000L;
+}
+
+/* Initialize @param cond to time its waits on CLOCK_MONOTONIC, so wall clock jumps can't stretch deadlines */
+static void Recursor_condInit(pthread_cond_t* cond) {
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+/* Sends and frees a pending batch, unwrapped if it only holds one query. Lock must be held. */
+static void Recursor_flush(struct pending* batch) {
+  uint8_t buf[MAX_BUF];
+  const void* data = batch->items[0];
+  size_t len = batch->lens[0];
+  int i;
+
+  if (batch->count > 1) {
+    len = Frame_batch(buf, MAX_BUF, (const void* const*)batch->items, batch->lens, batch->count, 1);
+    data = buf;
+  }
+  if (len > 0 && sendto(shared.fd, data, len, 0, (struct sockaddr*)&(batch->to), sizeof(struct sockaddr_in)) < 0)
+    perror(programName);
+
+  HASH_DEL(shared.pending, batch);
+  for (i = 0; i < batch->count; i++) free(batch->items[i]);
+  free(batch);
+}
+
+/**
+ * int Recursor_transmit(const struct sockaddr_in*, const void*, size_t)
+ * Sends a query to @param addr, or queues it to share a datagram with others
+ * bound there before the batching window closes. Lock must be held.
+ * @return 0 on success, negative on failure
+ **/
+static int Recursor_transmit(const struct sockaddr_in* addr, const void* data, size_t len) {
+  struct pending* batch;
+  uint64_t key;
+  void* copy;
+
+  if (shared.batch > 0 && sizeof(uint16_t) + len <= BATCH_ROOM) {
+    key = ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+    HASH_FIND(hh, shared.pending, &key, sizeof(uint64_t), batch);
+
+    /* Full, Send What is There and Start Over */
+    if (batch != NULL && (batch->count == BATCH_MAX || batch->bytes + sizeof(uint16_t) + len > BATCH_ROOM)) {
+      Recursor_flush(batch);
+      batch = NULL;
+    }
+
+    if (batch == NULL && (batch = calloc(1, sizeof(struct pending))) != NULL) {
+      batch->key = key;
+      batch->to = *addr;
+      clock_gettime(CLOCK_MONOTONIC, &(batch->flushAt));
+      Recursor_addMs(&(batch->flushAt), shared.batch / 1000.0);
+      HASH_ADD(hh, shared.pending, key, sizeof(uint64_t), batch);
+      pthread_cond_signal(&(shared.flush));
+    }
+
+    copy = batch != NULL ? malloc(len) : NULL;
+    if (copy != NULL) {
+      memcpy(copy, data, len);
+      batch->items[batch->count] = copy;
+      batch->lens[batch->count] = len;
+      batch->count++;
+      batch->bytes += sizeof(uint16_t) + len;
+      return 0;
+    }
+    if (batch != NULL && batch->count == 0) {
+      HASH_DEL(shared.pending, batch);
+      free(batch);
+    }
+  }
+
+  /* Batching Off, or Out of Memory */
+  if (sendto(shared.fd, data, len, 0, (const struct sockaddr*)addr, sizeof(struct sockaddr_in)) < 0) {
+    perror(programName);
+    return -1;
+  }
+  return 0;
+} /* End Recursor_transmit() */
+
+/* Flush each pending batch once its window closes, until Recursor_stop() */
+static void* Recursor_batcher(void* arg) {
+  struct pending *current, *tmp;
+  struct timespec now, wake;
+
+  (void)arg;
+  pthread_mutex_lock(&(shared.lock));
+  while (shared.running) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wake = now;
+    wake.tv_sec++;
+
+    HASH_ITER(hh, shared.pending, current, tmp) {
+      if (ELAPSED_MS(current->flushAt, now) >= 0) Recursor_flush(current);
+      else if (ELAPSED_MS(current->flushAt, wake) > 0) wake = current->flushAt;
+    }
+    pthread_cond_timedwait(&(shared.flush), &(shared.lock), &wake);
+  }
+
+  /* Nobody is Waiting on What is Left */
+  HASH_ITER(hh, shared.pending, current, tmp) Recursor_flush(current);
+  pthread_mutex_unlock(&(shared.lock));
+
+  return NULL;
+}
 
 /**
- * Recursor_T Recursor_init(void* size_t, int, int)
+ * int Recursor_sendNext(Recursor_T)
+ * Sends the query to sent[numSent], already filled in, and arms the next hedge
+ * for when that peer should have answered. Lock must be held.
+ * @return 0 if sent, negative on failure
+ **/
+static int Recursor_sendNext(Recursor_T recursor) {
+  struct sockaddr_in* addr;
+  uint64_t visited;
+  size_t i;
+
+  i = recursor->numSent++;
+  addr = &(recursor->sent[i]);
+
+  /* Mark the Peer Visited, so Neither it nor Anyone Down the Path Sends it Back */
+  if (recursor->visitedAt) {
+    memcpy(&visited, (uint8_t*)recursor->data + recursor->visitedAt, sizeof(uint64_t));
+    visited |= Peers_filterBits(addr);
+    memcpy((uint8_t*)recursor->data + recursor->visitedAt, &visited, sizeof(uint64_t));
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &(recursor->sentAt[i]));
+  if (Recursor_transmit(addr, recursor->data, recursor->dataLen) < 0) {
+    recursor->answered[i] = true;
+    recursor->numAnswered++;
+    return -1;
+  }
+
+  recursor->nextHedge = recursor->sentAt[i];
+  Recursor_addMs(&(recursor->nextHedge), Peers_hedgeDelay(addr));
+  return 0;
+}
+
+/**
+ * int Recursor_hedge(Recursor_T)
+ * Sends the query to one more peer, not yet asked. Lock must be held.
+ * @return 0 if sent, negative if the fanout is reached or no peer is left
+ **/
+static int Recursor_hedge(Recursor_T recursor) {
+  uint64_t visited = 0;
+  size_t i;
+
+  while (recursor->numSent < recursor->fanout) {
+    i = recursor->numSent;
+    if (recursor->visitedAt) memcpy(&visited, (uint8_t*)recursor->data + recursor->visitedAt, sizeof(uint64_t));
+    if (Peers_select(&(recursor->sent[i]), 1, recursor->sent, (int)i, visited,
+                     recursor->hasProbe ? &(recursor->probe) : NULL) == 0) break;
+
+    /* Try the Next Peer if Sending Fails */
+    if (Recursor_sendNext(recursor) == 0) return 0;
+  }
+
+  /* Nobody Left to Hedge to */
+  recursor->fanout = recursor->numSent;
+  return -1;
+} /* End Recursor_hedge() */
+
+/* Receive on the shared socket until Recursor_stop() */
+static void* Recursor_thread(void* arg) {
+  struct sockaddr_in from;
+  socklen_t fromLen;
+  uint8_t* buf;
+  ssize_t len;
+
+  (void)arg;
+  buf = malloc(MAX_BUF);
+  if (buf == NULL) return NULL;
+
+  while (shared.running) {
+    fromLen = sizeof(from);
+    len = recvfrom(shared.fd, buf, MAX_BUF, 0, (struct sockaddr*)&from, &fromLen);
+    if (len < 0) continue; /* Timeout, Check if Still Running */
+
+    pthread_mutex_lock(&(shared.lock));
+    if (Frame_unbatch(buf, (size_t)len, Recursor_deliverItem, &from) == 0)
+      Recursor_deliver(buf, (size_t)len, &from);
+    pthread_mutex_unlock(&(shared.lock));
+  }
+
+  free(buf);
+  return NULL;
+}
+
+/**
+ * int Recursor_start(long)
+ * Opens the shared recursion socket and starts the thread that receives on it.
+ * Must be called before Recursor_init().
+ * @param batch: Microseconds queries wait to share a datagram with others bound
+ *               to the same peer, 0 to send each at once
+ * @return 0 on success, negative on failure
+ **/
+int Recursor_start(long batch) {
+  struct timeval tv;
+
+  shared.fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (shared.fd < 0) {
+    perror(programName);
+    return -1;
+  }
+
+  /* Wake Up Periodically to Notice Recursor_stop() */
+  tv.tv_sec = 1;
+  tv.tv_usec = 0;
+  if (setsockopt(shared.fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(struct timeval)) < 0) {
+    perror(programName);
+    close(shared.fd);
+    shared.fd = -1;
+    return -1;
+  }
+
+  pthread_mutex_init(&(shared.lock), NULL);
+  Recursor_condInit(&(shared.flush));
+  shared.waiting = NULL;
+  shared.pending = NULL;
+  shared.batch = 0;
+  shared.running = true;
+  if (pthread_create(&(shared.thread), NULL, Recursor_thread, NULL) != 0) {
+    shared.running = false;
+    pthread_cond_destroy(&(shared.flush));
+    pthread_mutex_destroy(&(shared.lock));
+    close(shared.fd);
+    shared.fd = -1;
+    return -1;
+  }
+
+  /* Batching Only Once Something Flushes the Batches */
+  if (batch > 0 && pthread_create(&(shared.batcher), NULL, Recursor_batcher, NULL) == 0) shared.batch = batch;
+
+  return 0;
+} /* End Recursor_start() */
+
+/**
+ * void Recursor_stop(void)
+ * Stops the receive thread and closes the shared socket. Every recursor must be freed first.
+ * @return None
+ **/
+void Recursor_stop(void) {
+  if (shared.fd < 0) return;
+
+  pthread_mutex_lock(&(shared.lock));
+  shared.running = false;
+  pthread_cond_signal(&(shared.flush));
+  pthread_mutex_unlock(&(shared.lock));
+
+  pthread_join(shared.thread, NULL);
+  if (shared.batch > 0) pthread_join(shared.batcher, NULL);
+  shared.batch = 0;
+  pthread_cond_destroy(&(shared.flush));
+  pthread_mutex_destroy(&(shared.lock));
+  close(shared.fd);
+  shared.fd = -1;
+}
+
+/**
+ * Recursor_T Recursor_init(void* size_t, int, int, size_t, const struct sockaddr_in*, const struct probe*)
+ * Sends to the best known peer, then hedges to one more peer each time the
+ * last one is slower than its usual (about p95) round trip.
  * @param data: to be broadcasted to all peers
  * @param len: Length of @param data
- * @param peers: Maximum number of peers to broadcast to
- * @param timeout: Amount of wall time before we stop listening for responses
+ * @param peers: Maximum number of peers to send to, including hedges
+ * @param timeout: Milliseconds of wall time before we stop listening for responses
+ * @param visitedAt: Offset in @param data of a 64-bit visited-node filter, 0 if none.
+ *                   Peers in the filter are skipped, and each peer sent to is added.
+ * @param first: Server to ask first, e.g. the one authoritative for the query,
+ *               before hedging to peers. NULL to pick the best peer.
+ * @param probe: Summary bits of the query, so only peers holding the answer are asked. May be NULL.
  * @return New Recursor, or NULL if error or no peers to broadcast to.
  **/
-Recursor_T Recursor_init(void* data, size_t len, int peers, int timeout) {
-  int i, error, offset;
-  Recursor_T ret;
-  Peer_T randPeer;
+Recursor_T Recursor_init(void* data, size_t len, int peers, int timeout, size_t visitedAt,
+                         const struct sockaddr_in* first, const struct probe* probe) {
+  Recursor_T ret, head;
+  int error;
+
+  if (shared.fd < 0 || len < sizeof(uint32_t)) return NULL;
+  if (visitedAt && visitedAt + sizeof(uint64_t) > len) return NULL;
+  if ((size_t)peers > Peers_count() + (first != NULL)) peers = (int)Peers_count() + (first != NULL);
+  if (peers <= 0) return NULL;
 
   /* Create Data */
   ret = calloc(1, sizeof(struct recursor));
   if (ret == NULL) return NULL;
 
-  ret->fds = calloc(peers, sizeof(int));
-  if (ret->fds == NULL) { free(ret); return NULL; }
-
+  ret->data = malloc(len);
+  ret->sent = calloc(peers, sizeof(struct sockaddr_in));
+  ret->sentAt = calloc(peers, sizeof(struct timespec));
+  ret->answered = calloc(peers, sizeof(bool));
+  ret->queue = calloc(peers, sizeof(struct answer));
   ret->buf = calloc(MAX_BUF, sizeof(char));
-  if (ret->buf == NULL) {
-    free(ret->fds); free(ret);
+  if (ret->data == NULL || ret->sent == NULL || ret->sentAt == NULL || ret->answered == NULL ||
+      ret->queue == NULL || ret->buf == NULL) {
+    Recursor_free(ret);
     return NULL;
   }
+  memcpy(ret->data, data, len);
+  ret->dataLen = len;
+  ret->visitedAt = visitedAt;
+  if (probe != NULL) {
+    ret->probe = *probe;
+    ret->hasProbe = true;
+  }
+  ret->fanout = peers;
   ret->bufLen = MAX_BUF;
+  memcpy(&(ret->qid), data, sizeof(uint32_t));
+  Recursor_condInit(&(ret->ready));
 
-  ret->timeout.tv_sec = timeout;
-  ret->timeout.tv_usec = 0;
-  ret->nfds = 0;
-  
-  FD_ZERO(&ret->readSet);
-
-  /* Send Data to Random Peers, then add sockets to fd set */
-  offset = 0;
-  for (i = 0; i < peers; i++) {
-    randPeer = Peers_random();
-    ret->fds[i - offset] = socket(AF_INET,SOCK_DGRAM,0);
-    error = sendto(ret->fds[i-offset], data, len, 0, Peers_socket(randPeer), sizeof(struct sockaddr));
-    if (error < 0) {
-      perror(programName);
-      close(ret->fds[i-offset]);
-      offset++;
-    } else {
-      FD_SET(ret->fds[i-offset], &ret->readSet);
-      if (ret->fds[i-offset] >= ret->nfds) ret->nfds = ret->fds[i-offset] + 1;
-    }
+  clock_gettime(CLOCK_MONOTONIC, &(ret->deadline));
+  Recursor_addMs(&(ret->deadline), timeout);
+
+  /* Register Before Sending, so no Response is Missed */
+  pthread_mutex_lock(&(shared.lock));
+  HASH_FIND(hh, shared.waiting, &(ret->qid), sizeof(uint32_t), head);
+  if (head == NULL) {
+    HASH_ADD(hh, shared.waiting, qid, sizeof(uint32_t), ret);
+  } else {
+    ret->sameQid = head->sameQid;
+    head->sameQid = ret;
+  }
+  ret->registered = true;
+
+  /* First Peer, Favouring Fast and Reliable Ones Unless Told Who to Ask */
+  if (first != NULL) {
+    ret->sent[0] = *first;
+    error = Recursor_sendNext(ret);
+    if (error < 0) error = Recursor_hedge(ret);
+  } else {
+    error = Recursor_hedge(ret);
+  }
+  pthread_mutex_unlock(&(shared.lock));
+
+  if (error < 0) {
+    Recursor_free(ret);
+    return NULL;
   }
 
-  ret->numfd = peers-offset;
   return ret;
 }
 
 /**
- * void* Recursor_poll(Recursor_T, size_t*)
+ * void* Recursor_poll(Recursor_T, size_t*, struct sockaddr_in*)
+ * Waits for the next response, hedging to another peer whenever the hedge timer fires first.
  * @param recursor: from which to receive data
  * @param retLen (value): Writes with length of returned buffer.
+ * @param from (value): Overwritten with the responding server, may be NULL
  * @return Data received from network, or NULL on timeout / all responses received; Stored in a constant buffer, overwritten on next poll.
  **/
-const void* Recursor_poll(Recursor_T recursor, size_t* retLen) {
-  int i;
+const void* Recursor_poll(Recursor_T recursor, size_t* retLen, struct sockaddr_in* from) {
+  struct answer next;
+  struct timespec now, wake;
+
   assert(retLen != NULL);
   assert(recursor != NULL);
-  /* All Receives Have Happened! */
-  if (recursor->nfds == 0) return NULL;
-
-  /* TODO (Compatability Note): Currently relies on Linux's implementation with shrinking timeout. */
-  i = select(recursor->nfds, &recursor->readSet, NULL, NULL, &recursor->timeout);
-  if (i <= 0) return NULL; /* Timeout Reached */
-  
-  for (i = 0; i < recursor->numfd; i++) {
-    if (recursor->fds[i] < 0) continue;
-    if (FD_ISSET(recursor->fds[i], &recursor->readSet)) {
-      recursor->bufLen = recv(recursor->fds[i], recursor->buf, recursor->bufLen, 0);
-      recursor->fds[i] = -1;
-      break;
+
+  pthread_mutex_lock(&(shared.lock));
+  while (recursor->queued == 0 && !recursor->done) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (ELAPSED_MS(recursor->deadline, now) >= 0) break; /* Timeout Reached */
+
+    /* Turned Away or Not Found, Hedge Straight Away */
+    if (recursor->turnedAway > 0 && recursor->numSent < recursor->fanout) {
+      recursor->turnedAway--;
+      Recursor_hedge(recursor);
+      continue;
     }
-  }
 
-  FD_ZERO(&recursor->readSet);
+    /* All Receives Have Happened! */
+    if (recursor->numAnswered == recursor->numSent) break;
+
+    /* Nothing Yet, Hedge */
+    wake = recursor->deadline;
+    if (recursor->numSent < recursor->fanout) {
+      if (ELAPSED_MS(recursor->nextHedge, now) >= 0) {
+        Recursor_hedge(recursor);
+        continue;
+      }
+      if (ELAPSED_MS(recursor->nextHedge, wake) > 0) wake = recursor->nextHedge;
+    }
 
-  /* Rebuild fd set */
-  recursor->nfds = 0;
-  for (i = 0; i < recursor->numfd; i++) {
-    if (recursor->fds[i] == -1) continue;
-    if (recursor->nfds <= recursor->fds[i])
-      recursor->nfds = recursor->fds[i] + 1;
-    FD_SET(recursor->fds[i], &recursor->readSet);
+    pthread_cond_timedwait(&(recursor->ready), &(shared.lock), &wake);
   }
- 
-  *retLen = recursor->bufLen;
+
+  if (recursor->queued == 0 || recursor->done) {
+    pthread_mutex_unlock(&(shared.lock));
+    return NULL;
+  }
+
+  next = recursor->queue[0];
+  recursor->queued--;
+  memmove(recursor->queue, recursor->queue + 1, recursor->queued * sizeof(struct answer));
+  pthread_mutex_unlock(&(shared.lock));
+
+  memcpy(recursor->buf, next.buf, next.len);
+  free(next.buf);
+
+  *retLen = next.len;
+  if (from != NULL) *from = next.from;
   return recursor->buf;
 }
+
 /**
  * void Recursor_Timeout(Recursor_T)
  * Automatically forces timeout and kills the poll thread.
@@ -136,7 +601,10 @@ const void* Recursor_poll(Recursor_T recursor, size_t* retLen) {
  **/
 void Recursor_Timeout(Recursor_T recursor) {
   assert(recursor != NULL);
-  recursor->nfds = 0;
+
+  pthread_mutex_lock(&(shared.lock));
+  recursor->done = true;
+  pthread_mutex_unlock(&(shared.lock));
 }
 
 /**
@@ -145,10 +613,45 @@ void Recursor_Timeout(Recursor_T recursor) {
  * @return None
  **/
 void Recursor_free(Recursor_T recursor) {
+  Recursor_T head, current;
+  struct timespec now;
+  size_t i;
+
   if(recursor) {
-    if (recursor->fds) free(recursor->fds);
+    /* Stop Receiving for this Recursor */
+    if (recursor->registered) {
+      pthread_mutex_lock(&(shared.lock));
+      HASH_FIND(hh, shared.waiting, &(recursor->qid), sizeof(uint32_t), head);
+      if (head == recursor) {
+        HASH_DEL(shared.waiting, recursor);
+        if (recursor->sameQid) HASH_ADD(hh, shared.waiting, qid, sizeof(uint32_t), recursor->sameQid);
+      } else if (head != NULL) {
+        for (current = head; current->sameQid != NULL; current = current->sameQid) {
+          if (current->sameQid == recursor) {
+            current->sameQid = recursor->sameQid;
+            break;
+          }
+        }
+      }
+      pthread_mutex_unlock(&(shared.lock));
+
+      /* Peers Still Silent at the Deadline Timed Out, Unless the Caller Stopped Early */
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (ELAPSED_MS(recursor->deadline, now) >= 0) {
+        for (i = 0; i < recursor->numSent; i++)
+          if (!recursor->answered[i]) Peers_timedOut(&(recursor->sent[i]));
+      }
+
+      pthread_cond_destroy(&(recursor->ready));
+      for (i = 0; i < recursor->queued; i++) free(recursor->queue[i].buf);
+    }
+
+    if (recursor->data) free(recursor->data);
+    if (recursor->sent) free(recursor->sent);
+    if (recursor->sentAt) free(recursor->sentAt);
+    if (recursor->answered) free(recursor->answered);
+    if (recursor->queue) free(recursor->queue);
     if (recursor->buf) free(recursor->buf);
     free(recursor);
   }
 }
-
@@ -8,26 +8,58 @@
 #ifndef RECURSOR_H
 #define RECURSOR_H
 
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "summary.h"
+
 /* Socket struct, holds QID-Address table and UDP information */
 typedef struct recursor *Recursor_T;
 
 /**
- * Recursor_T Recursor_init(void* size_t, int, int)
+ * int Recursor_start(long)
+ * Opens the shared recursion socket and starts the thread that receives on it.
+ * Must be called before Recursor_init().
+ * @param batch: Microseconds queries wait to share a datagram with others bound
+ *               to the same peer, 0 to send each at once
+ * @return 0 on success, negative on failure
+ **/
+int Recursor_start(long batch);
+
+/**
+ * void Recursor_stop(void)
+ * Stops the receive thread and closes the shared socket. Every recursor must be freed first.
+ * @return None
+ **/
+void Recursor_stop(void);
+
+/**
+ * Recursor_T Recursor_init(void* size_t, int, int, size_t, const struct sockaddr_in*, const struct probe*)
+ * Sends to the best known peer, then hedges to one more peer each time the
+ * last one is slower than its usual (about p95) round trip.
  * @param data: to be broadcasted to all peers
  * @param len: Length of @param data
- * @param peers: Maximum number of peers to broadcast to
- * @param timeout: Amount of wall time before we stop listening for responses
+ * @param peers: Maximum number of peers to send to, including hedges
+ * @param timeout: Milliseconds of wall time before we stop listening for responses
+ * @param visitedAt: Offset in @param data of a 64-bit visited-node filter, 0 if none.
+ *                   Peers in the filter are skipped, and each peer sent to is added.
+ * @param first: Server to ask first, e.g. the one authoritative for the query,
+ *               before hedging to peers. NULL to pick the best peer.
+ * @param probe: Summary bits of the query, so only peers holding the answer are asked. May be NULL.
  * @return New Recursor, or NULL if error or no peers to broadcast to.
  **/
-Recursor_T Recursor_init(void* data, size_t len, int peers, int timeout);
+Recursor_T Recursor_init(void* data, size_t len, int peers, int timeout, size_t visitedAt,
+                         const struct sockaddr_in* first, const struct probe* probe);
 
 /**
- * void* Recursor_poll(Recursor_T, size_t*)
+ * void* Recursor_poll(Recursor_T, size_t*, struct sockaddr_in*)
+ * Waits for the next response, hedging to another peer whenever the hedge timer fires first.
  * @param recursor: from which to receive data
  * @param retLen (value): Writes with length of returned buffer.
+ * @param from (value): Overwritten with the responding server, may be NULL
  * @return Data received from network, or NULL on timeout / all responses received
  **/
-const void* Recursor_poll(Recursor_T recursor, size_t* retLen);
+const void* Recursor_poll(Recursor_T recursor, size_t* retLen, struct sockaddr_in* from);
 
 /**
  * void Recursor_Timeout(Recursor_T)
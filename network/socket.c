@@ -251,6 +251,47 @@ int Socket_write(Socket_T socket, const char* ip, uint16_t port, void* buf, size
   return error;
 } /* End Socket_write() */
 
+/**
+ * int Socket_sendto(Socket_T, const struct sockaddr_in*, const void*, size_t)
+ * Write data to @param addr without associating its QID, e.g. extra answers to one query.
+ * @param buf: data to write
+ * @param len: Length of the buffer
+ * @return number of bytes written on success, -1 on failure
+ **/
+int Socket_sendto(Socket_T socket, const struct sockaddr_in* addr, const void* buf, size_t len) {
+  int error;
+
+  assert(socket != NULL);
+  assert(addr != NULL);
+  assert(buf != NULL);
+
+  error = sendto(socket->socketfd, buf, len, 0, (const struct sockaddr*)addr, sizeof(struct sockaddr_in));
+  if (error < 0) {
+    perror(programName);
+    return -1;
+  }
+  return error;
+} /* End Socket_sendto() */
+
+/**
+ * int Socket_source(Socket_T, uint32_t, struct sockaddr_in*)
+ * @param qid: Of a datagram read but not yet responded to
+ * @param addr: Overwritten with the address the datagram came from
+ * @return 0 on success, -1 if qid does not exist
+ **/
+int Socket_source(Socket_T socket, uint32_t qid, struct sockaddr_in* addr) {
+  kvQid* k;
+
+  assert(socket != NULL);
+  assert(addr != NULL);
+
+  HASH_FIND_INT(socket->hashmap, &qid, k);
+  if (k == NULL || k->address == NULL || k->address->sa_family != AF_INET) return -1;
+
+  memcpy(addr, k->address, sizeof(struct sockaddr_in));
+  return 0;
+} /* End Socket_source() */
+
 /**
  * void Socket_clearQID(Socket_T, uint32_t)
  * @param qid: Removes all associations with this qid.
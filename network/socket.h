@@ -9,6 +9,10 @@
 #define SOCKET_H
 
 #include <stdint.h>
+#include <netinet/in.h>
+
+/* Port every MARP server listens on, and so the one peers are reached at */
+#define MARP_PORT 5001
 
 /* Socket struct, holds QID-Address table and UDP information */
 typedef struct socket *Socket_T;
@@ -57,6 +61,23 @@ int Socket_respond(Socket_T socket, const void* buf, size_t len);
  **/
 int Socket_write(Socket_T socket, const char* ip, uint16_t port, void* buf, size_t len);
 
+/**
+ * int Socket_sendto(Socket_T, const struct sockaddr_in*, const void*, size_t)
+ * Write data to @param addr without associating its QID, e.g. extra answers to one query.
+ * @param buf: data to write
+ * @param len: Length of the buffer
+ * @return number of bytes written on success, -1 on failure
+ **/
+int Socket_sendto(Socket_T socket, const struct sockaddr_in* addr, const void* buf, size_t len);
+
+/**
+ * int Socket_source(Socket_T, uint32_t, struct sockaddr_in*)
+ * @param qid: Of a datagram read but not yet responded to
+ * @param addr: Overwritten with the address the datagram came from
+ * @return 0 on success, -1 if qid does not exist
+ **/
+int Socket_source(Socket_T socket, uint32_t qid, struct sockaddr_in* addr);
+
 /**
  * void Socket_clearQID(Socket_T, uint32_t)
  * @param qid: Removes all associations with this qid.
@@ -0,0 +1,224 @@
+/**
+ * File: summary.c
+ * Author: Ethan Gordon
+ * Content summaries: Bloom filters of the hosts a node is authoritative for
+ * and the records it caches, pushed to peers so recursion only asks peers
+ * that can answer.
+ **/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#include "socket.h"
+#include "periodic.h"
+#include "peers.h"
+#include "summary.h"
+#include "../frame.h"
+#include "../data/cache.h"
+#include "../data/local.h"
+
+extern char* programName;
+
+#define TIMEOUT 1
+
+#define BITS (SUMMARY_BYTES * 8)
+
+static Periodic_T worker = NULL;
+
+/* FNV-1a, 64-bit */
+static uint64_t Summary_fnv(const uint8_t* buf, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= buf[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/* Double hashing: bit i is h1 + i*h2, h2 forced odd so the bits differ */
+static void Summary_bits(uint64_t h1, uint64_t h2, uint32_t bits[SUMMARY_HASHES]) {
+  int i;
+
+  h2 |= 1;
+  for (i = 0; i < SUMMARY_HASHES; i++) bits[i] = (uint32_t)((h1 + i * h2) % BITS);
+}
+
+/* Bits for a host name */
+static void Summary_hostBits(const char* host, size_t hostLen, uint32_t bits[SUMMARY_HASHES]) {
+  uint64_t h = Summary_fnv((const uint8_t*)host, hostLen);
+  Summary_bits(h, (h >> 32) | (h << 32), bits);
+}
+
+/* Bits for a record hash, already uniformly distributed */
+static void Summary_hashBits(const char hash[SHA256_SIZE], uint32_t bits[SUMMARY_HASHES]) {
+  uint64_t h1, h2;
+
+  memcpy(&h1, hash, sizeof(uint64_t));
+  memcpy(&h2, hash + sizeof(uint64_t), sizeof(uint64_t));
+  Summary_bits(h1, h2, bits);
+}
+
+static void Summary_set(uint8_t* filter, const uint32_t bits[SUMMARY_HASHES]) {
+  int i;
+  for (i = 0; i < SUMMARY_HASHES; i++) filter[bits[i] / 8] |= (uint8_t)(1 << (bits[i] % 8));
+}
+
+static bool Summary_test(const uint8_t* filter, const uint32_t bits[SUMMARY_HASHES]) {
+  int i;
+  for (i = 0; i < SUMMARY_HASHES; i++) {
+    if (!(filter[bits[i] / 8] & (1 << (bits[i] % 8)))) return false;
+  }
+  return true;
+}
+
+/**
+ * void Summary_probe(const char*, const char*, struct probe*)
+ * @param host: Host part of the query, NULL for a reverse query
+ * @param hash: Query_id() of the query
+ * @param probe: Overwritten with the filter bits to test
+ * @return None
+ **/
+void Summary_probe(const char* host, const char hash[SHA256_SIZE], struct probe* probe) {
+  probe->hasHost = host != NULL;
+  if (host != NULL) Summary_hostBits(host, strlen(host), probe->host);
+  Summary_hashBits(hash, probe->hash);
+}
+
+/**
+ * bool Summary_matches(const uint8_t*, const struct probe*)
+ * @param filter: SUMMARY_BYTES long filter published by a peer
+ * @return true if the peer may hold the host or the record (false positives possible)
+ **/
+bool Summary_matches(const uint8_t* filter, const struct probe* probe) {
+  if (probe->hasHost && Summary_test(filter, probe->host)) return true;
+  return Summary_test(filter, probe->hash);
+}
+
+/* Local_hosts() callback */
+static void Summary_addHost(void* filter, const char* host, size_t hostLen) {
+  uint32_t bits[SUMMARY_HASHES];
+
+  Summary_hostBits(host, hostLen, bits);
+  Summary_set(filter, bits);
+}
+
+/* Cache_ids() callback */
+static void Summary_addHash(void* filter, const char hash[SHA256_SIZE]) {
+  uint32_t bits[SUMMARY_HASHES];
+
+  Summary_hashBits(hash, bits);
+  Summary_set(filter, bits);
+}
+
+/**
+ * int Summary_receive(const struct sockaddr_in*, const uint8_t*, size_t)
+ * Stores a summary published by a peer.
+ * @param from: Source address of the frame, its port is replaced by the advertised one
+ * @param payload: PER_FILTER payload, after the subtype
+ * @param len: Length of @param payload
+ * @return 0 on success, negative if malformed or not from a known peer
+ **/
+int Summary_receive(const struct sockaddr_in* from, const uint8_t* payload, size_t len) {
+  struct sockaddr_in peer;
+
+  if (from == NULL || len != sizeof(uint16_t) + SUMMARY_BYTES) return -1;
+
+  /* Published From an Ephemeral Socket, so Trust the Address but Not the Port */
+  peer = *from;
+  memcpy(&(peer.sin_port), payload, sizeof(uint16_t));
+
+  return Peers_setSummary(&peer, payload + sizeof(uint16_t), SUMMARY_BYTES);
+}
+
+/**
+ * int Summary_publish(Socket_T)
+ * Builds this node's summary and sends it to every known peer, then collects the acknowledgements.
+ * @return Number of peers that acknowledged, negative on failure
+ **/
+static int Summary_publish(Socket_T socket) {
+  struct sockaddr_in* peers;
+  uint8_t* payload;
+  uint32_t* qids;
+  char ip[INET_ADDRSTRLEN];
+  Frame_T frame;
+  int count, sent = 0, acked = 0, i;
+  uint16_t port = htons(MARP_PORT);
+
+  count = (int)Peers_count();
+  if (count == 0) return 0;
+
+  peers = calloc(count, sizeof(struct sockaddr_in));
+  qids = calloc(count, sizeof(uint32_t));
+  payload = calloc(1 + sizeof(uint16_t) + SUMMARY_BYTES, sizeof(uint8_t));
+  if (peers == NULL || qids == NULL || payload == NULL) {
+    free(peers); free(qids); free(payload);
+    return -1;
+  }
+
+  payload[0] = PER_FILTER;
+  memcpy(payload + 1, &port, sizeof(uint16_t));
+  Local_hosts(Summary_addHost, payload + 1 + sizeof(uint16_t));
+  Cache_ids(Summary_addHash, payload + 1 + sizeof(uint16_t));
+
+  count = Peers_select(peers, count, NULL, 0, 0, NULL);
+  for (i = 0; i < count; i++) {
+    frame = Frame_buildPush(payload, 1 + sizeof(uint16_t) + SUMMARY_BYTES);
+    if (frame == NULL) break;
+    qids[sent] = Frame_getQID(frame);
+
+    if (inet_ntop(AF_INET, &(peers[i].sin_addr), ip, INET_ADDRSTRLEN) != NULL &&
+        Frame_send(frame, socket, ip, ntohs(peers[i].sin_port)) >= 0) sent++;
+    Frame_free(frame);
+  }
+  free(payload);
+  free(peers);
+
+  /* Drain Acknowledgements, Giving Up on Silent Peers After TIMEOUT */
+  while (acked < sent) {
+    frame = Frame_init();
+    if (frame == NULL) break;
+    if (Frame_listen(frame, socket, TIMEOUT) < 0) {
+      Frame_free(frame);
+      break;
+    }
+    acked++;
+    Frame_free(frame);
+  }
+  for (i = 0; i < sent; i++) Socket_clearQID(socket, qids[i]);
+  free(qids);
+
+  return acked;
+} /* End Summary_publish() */
+
+/* Publish every SUMMARY_INTERVAL seconds */
+static int Summary_work(Socket_T socket, void* arg) {
+  (void)arg;
+  if (Summary_publish(socket) < 0)
+    fprintf(stderr, "%s: Summary: Could not publish content summary\n", programName);
+  return SUMMARY_INTERVAL;
+}
+
+/**
+ * int Summary_start(void)
+ * Starts the thread that publishes this node's summary to every peer.
+ * @return 0 on success, negative on failure
+ **/
+int Summary_start(void) {
+  worker = Periodic_start(Summary_work, NULL);
+  return worker == NULL ? -1 : 0;
+}
+
+/**
+ * void Summary_stop(void)
+ * Waits for the publishing thread to notice shutdown and exit.
+ **/
+void Summary_stop(void) {
+  Periodic_stop(worker);
+  worker = NULL;
+}
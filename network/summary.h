@@ -0,0 +1,73 @@
+/**
+ * File: summary.h
+ * Author: Ethan Gordon
+ * Content summaries: Bloom filters of the hosts a node is authoritative for
+ * and the records it caches, pushed to peers so recursion only asks peers
+ * that can answer.
+ **/
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#define SHA256_SIZE 32
+
+/* Filter size on the wire, fits a frame with room for the header */
+#define SUMMARY_BYTES 1024
+#define SUMMARY_HASHES 4
+
+/* Seconds between publishing summaries, a peer's is stale after missing a few */
+#define SUMMARY_INTERVAL 30
+#define SUMMARY_STALE (3 * SUMMARY_INTERVAL)
+
+/* Filter bits a query would set, computed once and tested against every peer */
+struct probe {
+  uint32_t host[SUMMARY_HASHES];
+  uint32_t hash[SUMMARY_HASHES];
+  bool hasHost;
+};
+
+/**
+ * void Summary_probe(const char*, const char*, struct probe*)
+ * @param host: Host part of the query, NULL for a reverse query
+ * @param hash: Query_id() of the query
+ * @param probe: Overwritten with the filter bits to test
+ * @return None
+ **/
+void Summary_probe(const char* host, const char hash[SHA256_SIZE], struct probe* probe);
+
+/**
+ * bool Summary_matches(const uint8_t*, const struct probe*)
+ * @param filter: SUMMARY_BYTES long filter published by a peer
+ * @return true if the peer may hold the host or the record (false positives possible)
+ **/
+bool Summary_matches(const uint8_t* filter, const struct probe* probe);
+
+/**
+ * int Summary_receive(const struct sockaddr_in*, const uint8_t*, size_t)
+ * Stores a summary published by a peer.
+ * @param from: Source address of the frame, its port is replaced by the advertised one
+ * @param payload: PER_FILTER payload, after the subtype
+ * @param len: Length of @param payload
+ * @return 0 on success, negative if malformed or not from a known peer
+ **/
+int Summary_receive(const struct sockaddr_in* from, const uint8_t* payload, size_t len);
+
+/**
+ * int Summary_start(void)
+ * Starts the thread that publishes this node's summary to every peer.
+ * @return 0 on success, negative on failure
+ **/
+int Summary_start(void);
+
+/**
+ * void Summary_stop(void)
+ * Waits for the publishing thread to notice shutdown and exit.
+ **/
+void Summary_stop(void);
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * File: transfer.c
+ * Author: Ethan Gordon
+ * Keeps a secondary server's local table in sync with its primary: one full
+ * snapshot, then incremental changes keyed by the primary's zone serial.
+ **/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "socket.h"
+#include "periodic.h"
+#include "transfer.h"
+#include "../frame.h"
+#include "../data/local.h"
+
+extern char* programName;
+
+#define TIMEOUT 1
+
+/* Transfer requests are a serial and a cursor */
+#define REQUEST_MAX 16
+
+static Periodic_T worker = NULL;
+
+/**
+ * int Transfer_pull(Socket_T, const char*)
+ * Sends one transfer request to the primary and applies the response.
+ * @return 1 if there is more to pull right away, 0 if caught up, negative on failure
+ **/
+static int Transfer_pull(Socket_T socket, const char* primary) {
+  uint8_t request[REQUEST_MAX];
+  const uint8_t* payload;
+  uint16_t len;
+  uint32_t qid;
+  Frame_T frame;
+  int error;
+
+  frame = Frame_buildTransfer(request, Local_transferRequest(request));
+  if (frame == NULL) return -1;
+  qid = Frame_getQID(frame);
+
+  error = Frame_send(frame, socket, primary, MARP_PORT);
+  Frame_free(frame);
+  if (error < 0) return -1;
+
+  frame = Frame_init();
+  if (frame == NULL) {
+    Socket_clearQID(socket, qid);
+    return -1;
+  }
+
+  error = Frame_listen(frame, socket, TIMEOUT);
+  Socket_clearQID(socket, qid);
+  if (error < 0 || Frame_getQID(frame) != qid) {
+    Frame_free(frame);
+    return -1;
+  }
+
+  payload = Frame_getPayload(frame, &len);
+  error = Local_receive(payload, len);
+  Frame_free(frame);
+  return error;
+} /* End Transfer_pull() */
+
+/* Poll the primary every refresh seconds, pulling until caught up */
+static int Transfer_work(Socket_T socket, void* arg) {
+  const char* primary;
+  int refresh, error;
+
+  (void)arg;
+  primary = Local_getPrimary(&refresh);
+
+  error = Transfer_pull(socket, primary);
+  if (error > 0) return 0;
+  if (error < 0) fprintf(stderr, "%s: Transfer: Could not pull from primary %s\n", programName, primary);
+
+  return refresh;
+}
+
+/**
+ * int Transfer_start(void)
+ * Starts the transfer thread if the local config names a primary.
+ * @return 0 on success or if this server is not a secondary, negative on failure
+ **/
+int Transfer_start(void) {
+  const char* primary = Local_getPrimary(NULL);
+
+  if (primary == NULL) return 0;
+
+  worker = Periodic_start(Transfer_work, NULL);
+  if (worker == NULL) return -1;
+
+  printf("%s: Transfer_start: Replicating from primary %s...\n", programName, primary);
+  return 0;
+}
+
+/**
+ * void Transfer_stop(void)
+ * Waits for the transfer thread to notice shutdown and exit.
+ **/
+void Transfer_stop(void) {
+  Periodic_stop(worker);
+  worker = NULL;
+}
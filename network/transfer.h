@@ -0,0 +1,24 @@
+/**
+ * File: transfer.h
+ * Author: Ethan Gordon
+ * Keeps a secondary server's local table in sync with its primary: one full
+ * snapshot, then incremental changes keyed by the primary's zone serial.
+ **/
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+/**
+ * int Transfer_start(void)
+ * Starts the transfer thread if the local config names a primary.
+ * @return 0 on success or if this server is not a secondary, negative on failure
+ **/
+int Transfer_start(void);
+
+/**
+ * void Transfer_stop(void)
+ * Waits for the transfer thread to notice shutdown and exit.
+ **/
+void Transfer_stop(void);
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * File: verify.c
+ * Author: Ethan Gordon
+ * Verifies signed recursive answers against each host's public key, and
+ * remembers answers already verified so repeats skip the curve math. (Abstract Object)
+ *
+ * Keys come from a local file standing in for the hosts' "marp:" DNS TXT
+ * records. A verified answer is remembered by the hash of its host and the
+ * digest of the whole answer, signature included, so a repeat costs one
+ * SHA256 instead of an ECDSA verify.
+ **/
+#define _GNU_SOURCE
+#define SHA256_SIZE 32
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <oaes_base64.h>
+
+#include "verify.h"
+#include "../uthash.h"
+#include "../libsha2/sha256.h"
+
+extern char* programName;
+
+#define KEY_SIZE 32
+#define PUB_SIZE (2 * KEY_SIZE + 1)
+#define PUB_BASE64 89
+#define PREFIX "marp:"
+#define MAX_LINE 320
+/* Verified answers remembered, the oldest is forgotten first */
+#define VERIFIED_MAX 4096
+
+/* Host -> Raw 64-byte Public Key, Read-Only After Verify_init() */
+typedef struct hostkey {
+  char* host;
+  uint8_t pubkey[PUB_SIZE - 1];
+  UT_hash_handle hh;
+} hostkey;
+
+/* An Answer Already Verified, Keyed by SHA256(host) || Response_digest() */
+typedef struct verified {
+  char id[2 * SHA256_SIZE];
+  UT_hash_handle hh;
+} verified;
+
+static struct {
+  hostkey* keys;
+  bool enabled;
+  /* Insertion ordered, so the head is the oldest */
+  verified* seen;
+  size_t count;
+  unsigned long hits, misses;
+  pthread_mutex_t lock;
+} store = { NULL, false, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+/* Decode a base64 "marp:" key into @param pubkey, @return 0 on success */
+static int Verify_decode(const char* text, uint8_t pubkey[PUB_SIZE - 1]) {
+  uint8_t raw[PUB_SIZE + 2];
+  size_t len = sizeof(raw);
+
+  if (strlen(text) < PUB_BASE64) return -1;
+  if (oaes_base64_decode(text, PUB_BASE64, raw, &len) || len < PUB_SIZE || raw[0] != 0x04) return -1;
+  memcpy(pubkey, &(raw[1]), PUB_SIZE - 1);
+  return 0;
+}
+
+/**
+ * int Verify_init(const char*, int)
+ * @param file: Host keys, one "<host> [IN TXT] marp:<base64 public key>" per line,
+ *              as the host's DNS TXT record would publish it
+ * @param enabled: 0 disables verification, every answer is then unchecked
+ * @return number of keys read on success, 0 if disabled, negative on failure
+ **/
+int Verify_init(const char* file, int enabled) {
+  FILE* in;
+  char* line;
+  int count = 0;
+
+  if (!enabled) return 0;
+
+  in = fopen(file, "r");
+  if (in == NULL) {
+    perror(programName);
+    return -1;
+  }
+
+  line = calloc(MAX_LINE, sizeof(char));
+  if (line == NULL) {
+    fclose(in);
+    return -1;
+  }
+
+  while (fgets(line, MAX_LINE, in) != NULL) {
+    char *host, *token, *key = NULL, *save;
+    hostkey *add, *replaced;
+
+    host = strtok_r(line, " \t\r\n", &save);
+    if (host == NULL || host[0] == '#' || host[0] == ';') continue;
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+      if (strncmp(token, PREFIX, strlen(PREFIX)) == 0) key = token + strlen(PREFIX);
+    }
+
+    add = calloc(1, sizeof(hostkey));
+    if (add == NULL) break;
+    if (key == NULL || Verify_decode(key, add->pubkey) < 0) {
+      fprintf(stderr, "%s: Verify_init: Skipping malformed key for %s\n", programName, host);
+      free(add);
+      continue;
+    }
+    add->host = strdup(host);
+    if (add->host == NULL) {
+      free(add);
+      break;
+    }
+
+    /* Later Lines Win, Like a Re-Published Record */
+    HASH_REPLACE_STR(store.keys, host, add, replaced);
+    if (replaced != NULL) {
+      free(replaced->host);
+      free(replaced);
+    } else count++;
+  }
+
+  free(line);
+  fclose(in);
+  store.enabled = true;
+  return count;
+} /* End Verify_init() */
+
+/**
+ * int Verify_response(const char*, Response_T)
+ * Checks the signature on an answer for @param host against the host's key.
+ * Note: Safe to call from any thread.
+ * @param host: Host part of the query, NULL for reverse queries
+ * @return 1 if verified, 0 if it could not be checked (no key for @param host,
+ *         or verification off), negative if unsigned or the signature is bad
+ **/
+int Verify_response(const char* host, Response_T response) {
+  hostkey* key;
+  verified *found, *add;
+  char id[2 * SHA256_SIZE];
+
+  if (!store.enabled || host == NULL) return 0;
+  HASH_FIND_STR(store.keys, host, key);
+  if (key == NULL) return 0;
+
+  /* The Host Signs Everything it Serves, so a Missing Signature is a Stripped One */
+  if (!Response_isSigned(response)) return -1;
+
+  sha256_simple((const uint8_t*)host, strlen(host), (uint8_t*)id);
+  if (Response_digest(response, (uint8_t*)&(id[SHA256_SIZE])) < 0) return -1;
+
+  pthread_mutex_lock(&(store.lock));
+  HASH_FIND(hh, store.seen, id, sizeof(id), found);
+  if (found != NULL) store.hits++;
+  else store.misses++;
+  pthread_mutex_unlock(&(store.lock));
+  if (found != NULL) return 1;
+
+  /* Only Now Pay for the Curve Math, Outside the Lock */
+  if (Response_verify(response, key->pubkey) < 0) return -1;
+
+  add = calloc(1, sizeof(verified));
+  if (add == NULL) return 1;
+  memcpy(add->id, id, sizeof(id));
+
+  pthread_mutex_lock(&(store.lock));
+  HASH_FIND(hh, store.seen, id, sizeof(id), found);
+  if (found == NULL) {
+    /* Full, Forget the Oldest */
+    if (store.count >= VERIFIED_MAX) {
+      verified* oldest = store.seen;
+      HASH_DEL(store.seen, oldest);
+      free(oldest);
+      store.count--;
+    }
+    HASH_ADD(hh, store.seen, id, sizeof(id), add);
+    store.count++;
+    add = NULL;
+  }
+  pthread_mutex_unlock(&(store.lock));
+  free(add);
+
+  return 1;
+} /* End Verify_response() */
+
+/**
+ * void Verify_destroy(void)
+ * De-allocates the key store and the verified answers.
+ **/
+void Verify_destroy(void) {
+  hostkey *key, *keyTmp;
+  verified *current, *tmp;
+
+  if (store.enabled)
+    printf("%s: Verify_destroy: %lu signed answers were repeats, %lu had their signature checked\n",
+           programName, store.hits, store.misses);
+
+  HASH_ITER(hh, store.keys, key, keyTmp) {
+    HASH_DEL(store.keys, key);
+    free(key->host);
+    free(key);
+  }
+
+  pthread_mutex_lock(&(store.lock));
+  HASH_ITER(hh, store.seen, current, tmp) {
+    HASH_DEL(store.seen, current);
+    free(current);
+  }
+  store.count = 0;
+  pthread_mutex_unlock(&(store.lock));
+  store.enabled = false;
+}
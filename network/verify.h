@@ -0,0 +1,38 @@
+/**
+ * File: verify.h
+ * Author: Ethan Gordon
+ * Verifies signed recursive answers against each host's public key, and
+ * remembers answers already verified so repeats skip the curve math.
+ **/
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "../object/response.h"
+
+/**
+ * int Verify_init(const char*, int)
+ * @param file: Host keys, one "<host> [IN TXT] marp:<base64 public key>" per line,
+ *              as the host's DNS TXT record would publish it
+ * @param enabled: 0 disables verification, every answer is then unchecked
+ * @return number of keys read on success, 0 if disabled, negative on failure
+ **/
+int Verify_init(const char* file, int enabled);
+
+/**
+ * int Verify_response(const char*, Response_T)
+ * Checks the signature on an answer for @param host against the host's key.
+ * Note: Safe to call from any thread.
+ * @param host: Host part of the query, NULL for reverse queries
+ * @return 1 if verified, 0 if it could not be checked (no key for @param host,
+ *         or verification off), negative if unsigned or the signature is bad
+ **/
+int Verify_response(const char* host, Response_T response);
+
+/**
+ * void Verify_destroy(void)
+ * De-allocates the key store and the verified answers.
+ **/
+void Verify_destroy(void);
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * File: warm.c
+ * Author: Ethan Gordon
+ * Cache warm-up: a starting node pulls the hottest cached records of a few
+ * healthy peers, so it doesn't recurse for everything while its cache is cold.
+ *
+ * Each PER_WARM request names the rank to start from; the answer is the rank
+ * to ask for next (0 when done) and as many entries as fit one frame, so a
+ * peer only ever sends the next chunk once the last one has arrived. With a
+ * peerkey set, requests are sealed like pushes and each chunk carries a MAC
+ * bound to the request it answers.
+ **/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#include "socket.h"
+#include "periodic.h"
+#include "peers.h"
+#include "cluster.h"
+#include "warm.h"
+#include "../frame.h"
+#include "../data/cache.h"
+
+extern char* programName;
+extern volatile bool isRunning;
+
+/* Seconds to wait for each chunk */
+#define TIMEOUT 1
+/* Peers asked, and how deep into each one's ranking we go (the top-K) */
+#define WARM_PEERS 2
+#define WARM_TOP 512
+/* Peers only serve nodes they know, and discovery introduces us within seconds; rounds tried, and seconds between */
+#define WARM_TRIES 5
+#define WARM_RETRY 2
+
+static Periodic_T worker = NULL;
+/* Rounds tried so far, none of which reached a peer */
+static int tries = 0;
+
+/* Cache_warm() filter: in a cluster only keep records this node owns */
+static int Warm_keep(void* user, const char hash[SHA256_SIZE]) {
+  struct sockaddr_in owner;
+
+  (void)user;
+  return Cluster_owner(hash, &owner) == 0;
+}
+
+/**
+ * int Warm_from(Socket_T, const struct sockaddr_in*)
+ * Pulls the hottest WARM_TOP entries of the peer at @param peer, a chunk at a time.
+ * @return Number of entries added, negative if the peer never answered
+ **/
+static int Warm_from(Socket_T socket, const struct sockaddr_in* peer) {
+  uint8_t request[1 + sizeof(uint16_t)];
+  char ip[INET_ADDRSTRLEN];
+  uint16_t rank = 0, next;
+  int added = 0, chunks = 0, error;
+
+  if (inet_ntop(AF_INET, &(peer->sin_addr), ip, INET_ADDRSTRLEN) == NULL) return -1;
+  request[0] = PER_WARM;
+
+  while (isRunning) {
+    const uint8_t* payload;
+    Frame_T frame;
+    uint32_t qid;
+    uint16_t len;
+
+    next = htons(rank);
+    memcpy(request + 1, &next, sizeof(uint16_t));
+    frame = Frame_buildPush(request, sizeof(request));
+    if (frame == NULL) break;
+    qid = Frame_getQID(frame);
+    error = Frame_send(frame, socket, ip, ntohs(peer->sin_port));
+    Frame_free(frame);
+    if (error < 0) break;
+
+    /* Wait for this Chunk, Skipping Strays From Earlier Ones */
+    frame = Frame_init();
+    if (frame == NULL) break;
+    do {
+      error = Frame_listen(frame, socket, TIMEOUT);
+    } while (error >= 0 && Frame_getQID(frame) != qid);
+    Socket_clearQID(socket, qid);
+
+    payload = error >= 0 ? Frame_getPayload(frame, &len) : NULL;
+    if (payload == NULL || len < 1 + sizeof(uint16_t) || payload[0] != PER_WARM) {
+      Frame_free(frame);
+      break;
+    }
+
+    /* With a Peerkey, Only Chunks Sealed Against This Request Are Trusted */
+    payload = Frame_getSealedPayload(frame, request, sizeof(request), &len);
+    if (payload == NULL || len < 1 + sizeof(uint16_t)) {
+      fprintf(stderr, "%s: Warm: Dropped chunk from %s with a bad MAC\n", programName, ip);
+      Frame_free(frame);
+      break;
+    }
+    chunks++;
+
+    error = Cache_warm(payload + 1 + sizeof(uint16_t), len - 1 - sizeof(uint16_t), Warm_keep, NULL);
+    if (error > 0) added += error;
+    memcpy(&next, payload + 1, sizeof(uint16_t));
+    Frame_free(frame);
+
+    /* Done When the Peer Has No More, or We Have its Top WARM_TOP */
+    next = ntohs(next);
+    if (error < 0 || next == 0 || next <= rank || next >= WARM_TOP) break;
+    rank = next;
+  }
+
+  return chunks > 0 ? added : -1;
+} /* End Warm_from() */
+
+/* Warm the cache from WARM_PEERS peers, retrying until one answers, then finish */
+static int Warm_work(Socket_T socket, void* arg) {
+  struct sockaddr_in peers[WARM_PEERS];
+  int count, added = 0, answered = 0, error, i;
+
+  (void)arg;
+  count = Peers_select(peers, WARM_PEERS, NULL, 0, 0, NULL);
+  for (i = 0; i < count && isRunning; i++) {
+    error = Warm_from(socket, &(peers[i]));
+    if (error < 0) continue;
+    added += error;
+    answered++;
+  }
+
+  if (answered > 0) {
+    printf("%s: Warm: Added %d cache entries from %d peers\n", programName, added, answered);
+    return -1;
+  }
+  return ++tries < WARM_TRIES ? WARM_RETRY : -1;
+}
+
+/**
+ * int Warm_start(void)
+ * Starts the thread that warms the cache from peers, once, while we serve.
+ * @return 0 on success, negative on failure
+ **/
+int Warm_start(void) {
+  tries = 0;
+  worker = Periodic_start(Warm_work, NULL);
+  return worker == NULL ? -1 : 0;
+}
+
+/**
+ * void Warm_stop(void)
+ * Waits for the warm-up thread to finish or notice shutdown.
+ **/
+void Warm_stop(void) {
+  Periodic_stop(worker);
+  worker = NULL;
+}
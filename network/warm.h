@@ -0,0 +1,24 @@
+/**
+ * File: warm.h
+ * Author: Ethan Gordon
+ * Cache warm-up: a starting node pulls the hottest cached records of a few
+ * healthy peers, so it doesn't recurse for everything while its cache is cold.
+ **/
+
+#ifndef WARM_H
+#define WARM_H
+
+/**
+ * int Warm_start(void)
+ * Starts the thread that warms the cache from peers, once, while we serve.
+ * @return 0 on success, negative on failure
+ **/
+int Warm_start(void);
+
+/**
+ * void Warm_stop(void)
+ * Waits for the warm-up thread to finish or notice shutdown.
+ **/
+void Warm_stop(void);
+
+#endif
@@ -68,7 +68,8 @@ Query_T Query_init(void* buf, size_t bufLen) {
   readBuf++;
   bufLen -= 2;
 
-  ret->host = calloc(bufLen, sizeof(char));
+  /* Always NUL-Terminate the Host */
+  ret->host = calloc(bufLen + 1, sizeof(char));
   if (ret->host == NULL) {
     free(ret);
     return NULL;
@@ -124,8 +125,8 @@ Query_T Query_build(const char* handleAtHost) {
   }
   strcpy(query->host, host);
 
-  /* Set size */
-  query->size = SHA256_SIZE + strlen(query->host) + 1;
+  /* Set size: hash, protocol list terminator, and host */
+  query->size = SHA256_SIZE + sizeof(uint16_t) + strlen(query->host) + 1;
   
   return query;
 }
@@ -6,7 +6,11 @@
 #define SHA256_SIZE 32
 #define SIGNATURE 65
 
+/* ECC Config */
+#define uECC_CURVE 3 /* P256 */
+
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <string.h>
@@ -15,6 +19,8 @@
 #include <stdio.h>
 #include <oaes_lib.h>
 
+#include "../libsha2/sha256.h"
+#include "../micro-ecc/uECC.h"
 #include "response.h"
 
 extern char* programName;
@@ -57,6 +63,13 @@ struct response {
   char* signature;
 };
 
+/* Serialized signature: a tag, SIG_ECDSA once signed, then the raw uECC signature r || s.
+ * Unsigned responses carry SIGNATURE zero bytes instead. */
+#define SIG_ECDSA 0x01
+
+/* Serialized record: protocol, length, encrypted data, ttl, timestamp */
+#define RECORD_FIXED (3 * sizeof(uint16_t) + sizeof(uint64_t))
+
 /* Free records in @param list of length @param length. */
 static void freeList(struct record* list, int length) {
   int i;
@@ -147,7 +160,7 @@ Response_T Response_init(void* buf, size_t bufLen) {
     bufLen -= sizeof(uint64_t);
   } /* End for */
 
-  if (bufLen > SIGNATURE) {
+  if (bufLen >= SIGNATURE && *byteBuf == SIG_ECDSA) {
     ret->signature = calloc(SIGNATURE, sizeof(char));
     if (ret->signature == NULL) {
       Response_free(ret);
@@ -178,6 +191,127 @@ int Response_recordCount(Response_T response) {
   return response->recordCount;
 } /* End Response_recordCount() */
 
+/**
+ * int Response_hasProtocol(Response_T, uint16_t)
+ * @param protocol: in Host Byte Order
+ * @return 1 if @param response holds a record for @param protocol, 0 otherwise
+ **/
+int Response_hasProtocol(Response_T response, uint16_t protocol) {
+  int i;
+  if (response == NULL) return 0;
+
+  for (i = 0; i < response->recordCount; i++) {
+    if (response->records[i].protocol == protocol) return 1;
+  }
+  return 0;
+} /* End Response_hasProtocol() */
+
+/**
+ * int Response_isSigned(Response_T)
+ * @return 1 if @param response carries a signature, and so is final, 0 otherwise
+ **/
+int Response_isSigned(Response_T response) {
+  if (response == NULL) return 0;
+  return response->signature != NULL;
+} /* End Response_isSigned() */
+
+/* SHA256 of @param response serialized, over the signature too if @param withSignature */
+static int Response_hash(Response_T response, bool withSignature, uint8_t digest[SHA256_SIZE]) {
+  uint8_t* buf;
+  size_t len;
+
+  buf = calloc(Response_size(response), sizeof(uint8_t));
+  if (buf == NULL) return -1;
+
+  len = Response_serialize(response, buf);
+  if (!withSignature) len -= SIGNATURE;
+  sha256_simple(buf, len, digest);
+  free(buf);
+  return 0;
+}
+
+/**
+ * int Response_digest(Response_T, uint8_t[32])
+ * @param digest: Overwritten with the SHA256 of the serialized response, signature included
+ * @return 0 on success, negative on failure
+ **/
+int Response_digest(Response_T response, uint8_t digest[SHA256_SIZE]) {
+  assert(response != NULL);
+  return Response_hash(response, true, digest);
+} /* End Response_digest() */
+
+/**
+ * int Response_signBuffer(uint8_t*, size_t, const uint8_t*)
+ * Signs a response already serialized by Response_serialize(), in place.
+ * @param buf: Serialized response, its trailing 65 signature bytes are overwritten
+ * @param len: Length of @param buf, as returned by Response_serialize()
+ * @param privkey: Raw 32-byte ECC private key
+ * @return 0 on success, negative on failure
+ **/
+int Response_signBuffer(uint8_t* buf, size_t len, const uint8_t* privkey) {
+  uint8_t digest[SHA256_SIZE];
+
+  assert(buf != NULL);
+  assert(privkey != NULL);
+  if (len < SHA256_SIZE + sizeof(uint8_t) + SIGNATURE) return -1;
+
+  /* The Signature Covers Everything Before It */
+  sha256_simple(buf, len - SIGNATURE, digest);
+  buf[len - SIGNATURE] = SIG_ECDSA;
+  if (uECC_sign(privkey, digest, &(buf[len - SIGNATURE + 1])) == 0) return -1;
+
+  return 0;
+} /* End Response_signBuffer() */
+
+/**
+ * int Response_sign(Response_T, const uint8_t*)
+ * Signs the hash and every record, so @param response becomes final.
+ * @param privkey: Raw 32-byte ECC private key
+ * @return 0 on success, negative on failure
+ **/
+int Response_sign(Response_T response, const uint8_t* privkey) {
+  uint8_t* buf;
+  size_t len;
+  int error;
+
+  assert(response != NULL);
+  assert(privkey != NULL);
+
+  free(response->signature);
+  response->signature = NULL;
+
+  buf = calloc(Response_size(response), sizeof(uint8_t));
+  if (buf == NULL) return -1;
+  len = Response_serialize(response, buf);
+
+  error = Response_signBuffer(buf, len, privkey);
+  if (error == 0) {
+    response->signature = calloc(SIGNATURE, sizeof(char));
+    if (response->signature == NULL) error = -1;
+    else memcpy(response->signature, &(buf[len - SIGNATURE]), SIGNATURE);
+  }
+
+  free(buf);
+  return error;
+} /* End Response_sign() */
+
+/**
+ * int Response_verify(Response_T, const uint8_t*)
+ * @param pubkey: Raw 64-byte ECC public key of the host's server
+ * @return 0 if the signature is valid, negative otherwise
+ **/
+int Response_verify(Response_T response, const uint8_t* pubkey) {
+  uint8_t digest[SHA256_SIZE];
+
+  assert(response != NULL);
+  if (pubkey == NULL || response->signature == NULL) return -1;
+
+  if (Response_hash(response, false, digest) < 0) return -1;
+  if (uECC_verify(pubkey, digest, (const uint8_t*)&(response->signature[1])) == 0) return -1;
+
+  return 0;
+} /* End Response_verify() */
+
 /**
  * int Response_merge(Response_T, Response_T)
  * Add all records from @param src to @param dest, re-writing records if
@@ -310,7 +444,7 @@ const void* Response_getRecord(Response_T response, uint16_t protocol, size_t* l
   for (i = 0; i < response->recordCount; i++) {
     if (response->records[i].protocol == protocol) {
       /* Serialize and Return */
-      *length = sizeof(struct record) + response->records[i].length;
+      *length = RECORD_FIXED + response->records[i].length;
       ret = calloc(*length, sizeof(char));
       if (ret == NULL) return NULL;
 
@@ -320,7 +454,7 @@ const void* Response_getRecord(Response_T response, uint16_t protocol, size_t* l
       placeholder = htons(response->records[i].length);
       memcpy(&(ret[sizeof(uint16_t)]), &placeholder,sizeof(uint16_t));
       
-      memcpy(&(ret[2*sizeof(uint16_t)]), &response->records[i].encrypted, response->records[i].length);
+      memcpy(&(ret[2*sizeof(uint16_t)]), response->records[i].encrypted, response->records[i].length);
       
       placeholder = htons(response->records[i].ttl);
       memcpy(&(ret[2*sizeof(uint16_t) + response->records[i].length]), &placeholder,sizeof(uint16_t));
@@ -367,6 +501,22 @@ int Response_buildRecord(Response_T response, uint16_t protocol, const char* enc
   return 0;
 }
 
+/**
+ * int64_t Response_expires(Response_T, uint16_t)
+ * @param protocol: identifies the record, in Host Byte Order
+ * @return Unix time at which the record's TTL runs out, 0 if there is no such record
+ **/
+int64_t Response_expires(Response_T response, uint16_t protocol) {
+  int i;
+  assert(response != NULL);
+
+  for (i = 0; i < response->recordCount; i++) {
+    if (response->records[i].protocol == protocol)
+      return response->records[i].timestamp + response->records[i].ttl;
+  }
+  return 0;
+}
+
 /**
  * int Response_addRecord(uint16_t, const void*, size_t)
  * @param protocol: Identifier for the record in Host Byte Order
@@ -387,7 +537,7 @@ int Response_addRecord(Response_T response, uint16_t protocol, const void* recor
     if (response->records[i].protocol == protocol) return -1;
   }
 
-  tmp = realloc(response->records, response->recordCount * sizeof(struct record));
+  tmp = realloc(response->records, (response->recordCount + 1) * sizeof(struct record));
   if (tmp == NULL) return -1;
 
   response->records = tmp;
@@ -397,12 +547,15 @@ int Response_addRecord(Response_T response, uint16_t protocol, const void* recor
   buf++;
   tmp->length = ntohs(*buf);
   buf++;
+  tmp->encrypted = calloc(tmp->length ? tmp->length : 1, sizeof(char));
+  if (tmp->encrypted == NULL) return -1;
   memcpy(tmp->encrypted, buf, tmp->length);
   buf = (const uint16_t*)((uint8_t*)buf + tmp->length);
   tmp->ttl = ntohs(*buf);
   buf++;
   tmp->timestamp = (int64_t)ntohll(*(uint64_t*)buf);
 
+  response->recordCount++;
   return 0;
 }
 
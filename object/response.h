@@ -7,6 +7,9 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define SHA256_SIZE 32
 
 /* Query Payload Object */
@@ -32,6 +35,51 @@ char* Response_id(Response_T response);
 **/
 int Response_recordCount(Response_T response);
 
+/**
+ * int Response_hasProtocol(Response_T, uint16_t)
+ * @param protocol: in Host Byte Order
+ * @return 1 if @param response holds a record for @param protocol, 0 otherwise
+ **/
+int Response_hasProtocol(Response_T response, uint16_t protocol);
+
+/**
+ * int Response_isSigned(Response_T)
+ * @return 1 if @param response carries a signature, and so is final, 0 otherwise
+ **/
+int Response_isSigned(Response_T response);
+
+/**
+ * int Response_digest(Response_T, uint8_t[32])
+ * @param digest: Overwritten with the SHA256 of the serialized response, signature included
+ * @return 0 on success, negative on failure
+ **/
+int Response_digest(Response_T response, uint8_t digest[SHA256_SIZE]);
+
+/**
+ * int Response_signBuffer(uint8_t*, size_t, const uint8_t*)
+ * Signs a response already serialized by Response_serialize(), in place.
+ * @param buf: Serialized response, its trailing 65 signature bytes are overwritten
+ * @param len: Length of @param buf, as returned by Response_serialize()
+ * @param privkey: Raw 32-byte ECC private key
+ * @return 0 on success, negative on failure
+ **/
+int Response_signBuffer(uint8_t* buf, size_t len, const uint8_t* privkey);
+
+/**
+ * int Response_sign(Response_T, const uint8_t*)
+ * Signs the hash and every record, so @param response becomes final.
+ * @param privkey: Raw 32-byte ECC private key
+ * @return 0 on success, negative on failure
+ **/
+int Response_sign(Response_T response, const uint8_t* privkey);
+
+/**
+ * int Response_verify(Response_T, const uint8_t*)
+ * @param pubkey: Raw 64-byte ECC public key of the host's server
+ * @return 0 if the signature is valid, negative otherwise
+ **/
+int Response_verify(Response_T response, const uint8_t* pubkey);
+
 /**
  * int Response_merge(Response_T, Response_T)
  * Add all records from @param src to @param dest, re-writing records if
@@ -47,10 +95,17 @@ int Response_merge(Response_T dest, Response_T src);
  * const void* Response_getRecord(uint16_t, size_t)
  * @param protocol: identifies the record, in Host Byte Order
  * @param length: overwritten with the return buffer's length
- * @return a constant buffer for the record
+ * @return a constant buffer for the record, that MUST BE FREED!
  **/
 const void* Response_getRecord(Response_T response, uint16_t protocol, size_t* length);
 
+/**
+ * int64_t Response_expires(Response_T, uint16_t)
+ * @param protocol: identifies the record, in Host Byte Order
+ * @return Unix time at which the record's TTL runs out, 0 if there is no such record
+ **/
+int64_t Response_expires(Response_T response, uint16_t protocol);
+
 /**
  * int Response_addRecord(uint16_t, const void*, size_t)
  * @param protocol: Identifier for the record in Host Byte Order
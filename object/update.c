@@ -0,0 +1,316 @@
+/**
+ * File: update.c
+ * Author: Ethan Gordon
+ * A MARP Record Update data group: a signed add/update or delete of a
+ * single local <handle, protocol> record.
+ **/
+#define SHA256_SIZE 32
+
+/* ECC Config */
+#define uECC_CURVE 3 /* P256 */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../libsha2/sha256.h"
+#include "../micro-ecc/uECC.h"
+#include "update.h"
+
+/* Raw uECC signature, r || s */
+#define UPDATE_SIGNATURE 64
+
+/* action, protocol, ttl, sequence, value length */
+#define FIXED_SIZE (sizeof(uint8_t) + 2 * sizeof(uint16_t) + sizeof(uint64_t) + sizeof(uint16_t))
+
+/* Update Payload Object */
+struct update {
+  uint8_t action;
+  uint16_t protocol;
+  uint16_t ttl;
+  uint64_t sequence;
+  char* value;
+  uint16_t valueLen;
+  char* handleAtHost;
+  uint8_t signature[UPDATE_SIGNATURE];
+  bool isSigned;
+};
+
+/* Big-Endian Helpers */
+static void putInt(uint8_t* buf, uint64_t value, size_t bytes) {
+  size_t i;
+  for (i = 0; i < bytes; i++)
+    buf[i] = (uint8_t)(value >> (8 * (bytes - i - 1)));
+}
+
+static uint64_t getInt(const uint8_t* buf, size_t bytes) {
+  uint64_t ret = 0;
+  size_t i;
+  for (i = 0; i < bytes; i++)
+    ret = (ret << 8) | buf[i];
+  return ret;
+}
+
+/* Serialize everything covered by the signature into @param buffer, returns bytes written */
+static size_t Update_serializeBody(Update_T update, uint8_t* buffer) {
+  size_t hostLen = strlen(update->handleAtHost) + 1;
+
+  buffer[0] = update->action;
+  putInt(&(buffer[1]), update->protocol, sizeof(uint16_t));
+  putInt(&(buffer[3]), update->ttl, sizeof(uint16_t));
+  putInt(&(buffer[5]), update->sequence, sizeof(uint64_t));
+  putInt(&(buffer[13]), update->valueLen, sizeof(uint16_t));
+  memcpy(&(buffer[FIXED_SIZE]), update->value, update->valueLen);
+  memcpy(&(buffer[FIXED_SIZE + update->valueLen]), update->handleAtHost, hostLen);
+
+  return FIXED_SIZE + update->valueLen + hostLen;
+}
+
+/* SHA256 of the signed portion of the update */
+static int Update_digest(Update_T update, uint8_t digest[SHA256_SIZE]) {
+  uint8_t* buf;
+  size_t len;
+
+  buf = calloc(Update_size(update), sizeof(uint8_t));
+  if (buf == NULL) return -1;
+
+  len = Update_serializeBody(update, buf);
+  sha256_simple(buf, len, digest);
+  free(buf);
+  return 0;
+}
+
+/**
+ * Update_T Update_init(const void*, size_t)
+ * @param buf: Serialized update to parse, cannot be NULL
+ * @param bufLen: Length of buf
+ * @return New Update, or NULL if malformed or out of memory
+ **/
+Update_T Update_init(const void* buf, size_t bufLen) {
+  Update_T ret;
+  const uint8_t* byteBuf = buf;
+  const uint8_t* terminator;
+  size_t hostLen;
+
+  assert(buf != NULL);
+  if (bufLen < FIXED_SIZE + UPDATE_SIGNATURE) return NULL;
+
+  ret = calloc(1, sizeof(struct update));
+  if (ret == NULL) return NULL;
+
+  ret->action = byteBuf[0];
+  ret->protocol = (uint16_t)getInt(&(byteBuf[1]), sizeof(uint16_t));
+  ret->ttl = (uint16_t)getInt(&(byteBuf[3]), sizeof(uint16_t));
+  ret->sequence = getInt(&(byteBuf[5]), sizeof(uint64_t));
+  ret->valueLen = (uint16_t)getInt(&(byteBuf[13]), sizeof(uint16_t));
+  byteBuf += FIXED_SIZE;
+  bufLen -= FIXED_SIZE + UPDATE_SIGNATURE;
+
+  if (ret->action != UPDATE_SET && ret->action != UPDATE_DELETE) {
+    free(ret); return NULL;
+  }
+
+  /* Value */
+  if (bufLen < ret->valueLen) {
+    free(ret); return NULL;
+  }
+  ret->value = calloc(ret->valueLen + 1, sizeof(char));
+  if (ret->value == NULL) {
+    free(ret); return NULL;
+  }
+  memcpy(ret->value, byteBuf, ret->valueLen);
+  byteBuf += ret->valueLen;
+  bufLen -= ret->valueLen;
+
+  /* handle@host, Must be Terminated */
+  terminator = memchr(byteBuf, '\0', bufLen);
+  if (terminator == NULL || strchr((const char*)byteBuf, '@') == NULL) {
+    Update_free(ret); return NULL;
+  }
+  hostLen = terminator - byteBuf + 1;
+  ret->handleAtHost = calloc(hostLen, sizeof(char));
+  if (ret->handleAtHost == NULL) {
+    Update_free(ret); return NULL;
+  }
+  memcpy(ret->handleAtHost, byteBuf, hostLen);
+  byteBuf += hostLen;
+
+  /* Signature */
+  memcpy(ret->signature, byteBuf, UPDATE_SIGNATURE);
+  ret->isSigned = true;
+
+  return ret;
+} /* End Update_init() */
+
+/**
+ * Update_T Update_build(int, const char*, uint16_t, const char*, uint16_t, uint64_t)
+ * @param action: UPDATE_SET or UPDATE_DELETE
+ * @param handleAtHost: string "handle@host" without quotes
+ * @param protocol: Record protocol identifier
+ * @param value: Plaintext address, ignored (may be NULL) for UPDATE_DELETE
+ * @param ttl: Record TTL in seconds, 0 for the host default
+ * @param sequence: Must increase with every update signed by the same key
+ * @return New unsigned Update, or NULL on failure
+ **/
+Update_T Update_build(int action, const char* handleAtHost, uint16_t protocol,
+                      const char* value, uint16_t ttl, uint64_t sequence) {
+  Update_T ret;
+
+  if (handleAtHost == NULL || strchr(handleAtHost, '@') == NULL) return NULL;
+  if (action != UPDATE_SET && action != UPDATE_DELETE) return NULL;
+  if (action == UPDATE_SET && value == NULL) return NULL;
+  if (action == UPDATE_DELETE) value = "";
+
+  ret = calloc(1, sizeof(struct update));
+  if (ret == NULL) return NULL;
+
+  ret->action = (uint8_t)action;
+  ret->protocol = protocol;
+  ret->ttl = ttl;
+  ret->sequence = sequence;
+  ret->valueLen = (uint16_t)strlen(value);
+
+  ret->value = calloc(ret->valueLen + 1, sizeof(char));
+  ret->handleAtHost = calloc(strlen(handleAtHost) + 1, sizeof(char));
+  if (ret->value == NULL || ret->handleAtHost == NULL) {
+    Update_free(ret); return NULL;
+  }
+  memcpy(ret->value, value, ret->valueLen);
+  strcpy(ret->handleAtHost, handleAtHost);
+
+  return ret;
+} /* End Update_build() */
+
+/**
+ * int Update_sign(Update_T, const uint8_t*)
+ * @param privkey: Raw 32-byte ECC private key
+ * @return 0 on success, negative on failure
+ **/
+int Update_sign(Update_T update, const uint8_t* privkey) {
+  uint8_t digest[SHA256_SIZE];
+
+  assert(update != NULL);
+  assert(privkey != NULL);
+
+  if (Update_digest(update, digest) < 0) return -1;
+  if (uECC_sign(privkey, digest, update->signature) == 0) return -1;
+
+  update->isSigned = true;
+  return 0;
+}
+
+/**
+ * int Update_verify(Update_T, const uint8_t*)
+ * @param pubkey: Raw 64-byte ECC public key
+ * @return 0 if the signature is valid, negative otherwise
+ **/
+int Update_verify(Update_T update, const uint8_t* pubkey) {
+  uint8_t digest[SHA256_SIZE];
+
+  assert(update != NULL);
+  if (pubkey == NULL || !update->isSigned) return -1;
+
+  if (Update_digest(update, digest) < 0) return -1;
+  if (uECC_verify(pubkey, digest, update->signature) == 0) return -1;
+
+  return 0;
+}
+
+/**
+ * int Update_action(Update_T)
+ * @return UPDATE_SET or UPDATE_DELETE
+ **/
+int Update_action(Update_T update) {
+  assert(update != NULL);
+  return update->action;
+}
+
+/**
+ * uint16_t Update_protocol(Update_T)
+ * @return Protocol of the record, in Host Byte Order
+ **/
+uint16_t Update_protocol(Update_T update) {
+  assert(update != NULL);
+  return update->protocol;
+}
+
+/**
+ * uint16_t Update_ttl(Update_T)
+ * @return TTL of the record in seconds, 0 for the host default
+ **/
+uint16_t Update_ttl(Update_T update) {
+  assert(update != NULL);
+  return update->ttl;
+}
+
+/**
+ * uint64_t Update_sequence(Update_T)
+ * @return Sequence number used for replay protection
+ **/
+uint64_t Update_sequence(Update_T update) {
+  assert(update != NULL);
+  return update->sequence;
+}
+
+/**
+ * const char* Update_handleAtHost(Update_T)
+ * @return The "handle@host" the record belongs to
+ **/
+const char* Update_handleAtHost(Update_T update) {
+  assert(update != NULL);
+  return update->handleAtHost;
+}
+
+/**
+ * const char* Update_value(Update_T, size_t*)
+ * @param valueLen: Overwritten with the length of the value (not NUL-terminated)
+ * @return Plaintext address of an UPDATE_SET
+ **/
+const char* Update_value(Update_T update, size_t* valueLen) {
+  assert(update != NULL);
+  assert(valueLen != NULL);
+  *valueLen = update->valueLen;
+  return update->value;
+}
+
+/**
+ * void Update_free(Update_T)
+ * De-allocates all resources for this update.
+ **/
+void Update_free(Update_T update) {
+  if (update == NULL) return;
+
+  if (update->value) free(update->value);
+  if (update->handleAtHost) free(update->handleAtHost);
+  free(update);
+}
+
+/* Serialize Functions */
+
+/**
+ * size_t Update_size(Update_T)
+ * @return the size of the serialized buffer from Update_serialize()
+ **/
+size_t Update_size(Update_T update) {
+  if (update == NULL) return 0;
+  return FIXED_SIZE + update->valueLen + strlen(update->handleAtHost) + 1 + UPDATE_SIGNATURE;
+}
+
+/**
+ * size_t Update_serialize(Update_T, void*)
+ * @param buffer: Filled with the serialized update, must be at least Update_size() big
+ * @return Actual number of bytes written
+ **/
+size_t Update_serialize(Update_T update, void* buffer) {
+  size_t len;
+
+  assert(update != NULL);
+  assert(buffer != NULL);
+
+  len = Update_serializeBody(update, buffer);
+  memcpy((uint8_t*)buffer + len, update->signature, UPDATE_SIGNATURE);
+
+  return len + UPDATE_SIGNATURE;
+} /* End Update_serialize() */
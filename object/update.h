@@ -0,0 +1,116 @@
+/**
+ * File: update.h
+ * Author: Ethan Gordon
+ * A MARP Record Update data group: a signed add/update or delete of a
+ * single local <handle, protocol> record.
+ **/
+
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_SIZE 32
+
+/* Update Actions */
+#define UPDATE_SET 1
+#define UPDATE_DELETE 2
+
+/* Update Payload Object */
+typedef struct update *Update_T;
+
+/**
+ * Update_T Update_init(const void*, size_t)
+ * @param buf: Serialized update to parse, cannot be NULL
+ * @param bufLen: Length of buf
+ * @return New Update, or NULL if malformed or out of memory
+ **/
+Update_T Update_init(const void* buf, size_t bufLen);
+
+/**
+ * Update_T Update_build(int, const char*, uint16_t, const char*, uint16_t, uint64_t)
+ * @param action: UPDATE_SET or UPDATE_DELETE
+ * @param handleAtHost: string "handle@host" without quotes
+ * @param protocol: Record protocol identifier
+ * @param value: Plaintext address, ignored (may be NULL) for UPDATE_DELETE
+ * @param ttl: Record TTL in seconds, 0 for the host default
+ * @param sequence: Must increase with every update signed by the same key
+ * @return New unsigned Update, or NULL on failure
+ **/
+Update_T Update_build(int action, const char* handleAtHost, uint16_t protocol,
+                      const char* value, uint16_t ttl, uint64_t sequence);
+
+/**
+ * int Update_sign(Update_T, const uint8_t*)
+ * @param privkey: Raw 32-byte ECC private key
+ * @return 0 on success, negative on failure
+ **/
+int Update_sign(Update_T update, const uint8_t* privkey);
+
+/**
+ * int Update_verify(Update_T, const uint8_t*)
+ * @param pubkey: Raw 64-byte ECC public key
+ * @return 0 if the signature is valid, negative otherwise
+ **/
+int Update_verify(Update_T update, const uint8_t* pubkey);
+
+/**
+ * int Update_action(Update_T)
+ * @return UPDATE_SET or UPDATE_DELETE
+ **/
+int Update_action(Update_T update);
+
+/**
+ * uint16_t Update_protocol(Update_T)
+ * @return Protocol of the record, in Host Byte Order
+ **/
+uint16_t Update_protocol(Update_T update);
+
+/**
+ * uint16_t Update_ttl(Update_T)
+ * @return TTL of the record in seconds, 0 for the host default
+ **/
+uint16_t Update_ttl(Update_T update);
+
+/**
+ * uint64_t Update_sequence(Update_T)
+ * @return Sequence number used for replay protection
+ **/
+uint64_t Update_sequence(Update_T update);
+
+/**
+ * const char* Update_handleAtHost(Update_T)
+ * @return The "handle@host" the record belongs to
+ **/
+const char* Update_handleAtHost(Update_T update);
+
+/**
+ * const char* Update_value(Update_T, size_t*)
+ * @param valueLen: Overwritten with the length of the value (not NUL-terminated)
+ * @return Plaintext address of an UPDATE_SET
+ **/
+const char* Update_value(Update_T update, size_t* valueLen);
+
+/**
+ * void Update_free(Update_T)
+ * De-allocates all resources for this update.
+ **/
+void Update_free(Update_T update);
+
+/* Serialize Functions */
+
+/**
+ * size_t Update_size(Update_T)
+ * @return the size of the serialized buffer from Update_serialize()
+ **/
+size_t Update_size(Update_T update);
+
+/**
+ * size_t Update_serialize(Update_T, void*)
+ * @param buffer: Filled with the serialized update, must be at least Update_size() big
+ * @return Actual number of bytes written
+ **/
+size_t Update_serialize(Update_T update, void* buffer);
+
+#endif
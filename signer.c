@@ -0,0 +1,168 @@
+/**
+ * File: signer.c
+ * Author: Ethan Gordon
+ * Signing threads: response threads queue serialized answers, dedicated
+ * threads sign them in batches and hand each back through a callback.
+ *
+ * An ECDSA signature costs far more CPU than the rest of an answer, so doing
+ * it on the response threads makes their latency swing with bursts. Signers
+ * take every job queued, up to SIGN_BATCH, per wakeup, so a burst costs one
+ * lock round-trip and one wakeup per batch rather than per answer.
+ **/
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "signer.h"
+#include "object/response.h"
+
+extern char* programName;
+
+#define KEY_SIZE 32
+/* Most jobs a signer takes per wakeup */
+#define SIGN_BATCH 32
+/* Jobs queued beyond this are signed inline by their response thread instead */
+#define QUEUE_MAX 1024
+#define MAX_SIGNERS 16
+
+struct job {
+  uint8_t* buf;
+  size_t len;
+  void (*done)(void* user, int error);
+  void* user;
+  struct job* next;
+};
+
+static struct {
+  uint8_t privkey[KEY_SIZE];
+  /* FIFO of jobs */
+  struct job* head;
+  struct job* tail;
+  size_t queued;
+  bool running;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_t threads[MAX_SIGNERS];
+  int count;
+  /* Guarded by lock */
+  unsigned long signedCount, batches;
+} signer = { .head = NULL, .tail = NULL, .queued = 0, .running = false,
+             .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .count = 0 };
+
+/* Sign batches until stopped and the queue is empty */
+static void* Signer_thread(void* arg) {
+  struct job *batch, *job;
+  size_t taken;
+
+  (void)arg;
+  while (true) {
+    pthread_mutex_lock(&(signer.lock));
+    while (signer.head == NULL && signer.running) pthread_cond_wait(&(signer.ready), &(signer.lock));
+    if (signer.head == NULL) {
+      pthread_mutex_unlock(&(signer.lock));
+      break;
+    }
+
+    /* Detach Up to SIGN_BATCH Jobs at Once */
+    batch = job = signer.head;
+    for (taken = 1; taken < SIGN_BATCH && job->next != NULL; taken++) job = job->next;
+    signer.head = job->next;
+    if (signer.head == NULL) signer.tail = NULL;
+    job->next = NULL;
+    signer.queued -= taken;
+    signer.signedCount += taken;
+    signer.batches++;
+    pthread_mutex_unlock(&(signer.lock));
+
+    while (batch != NULL) {
+      job = batch;
+      batch = batch->next;
+      job->done(job->user, Response_signBuffer(job->buf, job->len, signer.privkey));
+      free(job);
+    }
+  }
+
+  return NULL;
+} /* End Signer_thread() */
+
+/**
+ * int Signer_start(const uint8_t*, int)
+ * @param privkey: Raw 32-byte ECC private key, a copy is made
+ * @param threads: Signing threads to start
+ * @return 0 on success, negative on failure
+ **/
+int Signer_start(const uint8_t* privkey, int threads) {
+  if (privkey == NULL || threads <= 0) return -1;
+  if (threads > MAX_SIGNERS) threads = MAX_SIGNERS;
+
+  memcpy(signer.privkey, privkey, KEY_SIZE);
+  signer.running = true;
+  for (signer.count = 0; signer.count < threads; signer.count++) {
+    if (pthread_create(&(signer.threads[signer.count]), NULL, Signer_thread, NULL) != 0) {
+      Signer_stop();
+      return -1;
+    }
+  }
+
+  return 0;
+} /* End Signer_start() */
+
+/**
+ * int Signer_submit(uint8_t*, size_t, void (*)(void*, int), void*)
+ * Queues a serialized response to be signed in place.
+ * Note: Safe to call from any thread.
+ * @param buf: From Response_serialize(), must stay valid until @param done runs
+ * @param len: Length of @param buf
+ * @param done: Called on a signing thread once signed, with 0 or negative on failure
+ * @param user: Passed through to @param done
+ * @return 0 if queued, negative if the queue is full or not running; sign inline then
+ **/
+int Signer_submit(uint8_t* buf, size_t len, void (*done)(void* user, int error), void* user) {
+  struct job* job;
+
+  job = calloc(1, sizeof(struct job));
+  if (job == NULL) return -1;
+  job->buf = buf;
+  job->len = len;
+  job->done = done;
+  job->user = user;
+
+  pthread_mutex_lock(&(signer.lock));
+  if (!signer.running || signer.queued >= QUEUE_MAX) {
+    pthread_mutex_unlock(&(signer.lock));
+    free(job);
+    return -1;
+  }
+  if (signer.tail != NULL) signer.tail->next = job;
+  else signer.head = job;
+  signer.tail = job;
+  signer.queued++;
+  pthread_cond_signal(&(signer.ready));
+  pthread_mutex_unlock(&(signer.lock));
+
+  return 0;
+} /* End Signer_submit() */
+
+/**
+ * void Signer_stop(void)
+ * Signs whatever is still queued, then stops the signing threads.
+ **/
+void Signer_stop(void) {
+  int i;
+
+  pthread_mutex_lock(&(signer.lock));
+  signer.running = false;
+  pthread_cond_broadcast(&(signer.ready));
+  pthread_mutex_unlock(&(signer.lock));
+
+  for (i = 0; i < signer.count; i++) pthread_join(signer.threads[i], NULL);
+  if (signer.count > 0)
+    printf("%s: Signer_stop: Signed %lu answers in %lu batches\n", programName, signer.signedCount, signer.batches);
+  signer.count = 0;
+  memset(signer.privkey, 0, KEY_SIZE);
+}
@@ -0,0 +1,40 @@
+/**
+ * File: signer.h
+ * Author: Ethan Gordon
+ * Signing threads: response threads queue serialized answers, dedicated
+ * threads sign them in batches and hand each back through a callback.
+ **/
+
+#ifndef SIGNER_H
+#define SIGNER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * int Signer_start(const uint8_t*, int)
+ * @param privkey: Raw 32-byte ECC private key, a copy is made
+ * @param threads: Signing threads to start
+ * @return 0 on success, negative on failure
+ **/
+int Signer_start(const uint8_t* privkey, int threads);
+
+/**
+ * int Signer_submit(uint8_t*, size_t, void (*)(void*, int), void*)
+ * Queues a serialized response to be signed in place.
+ * Note: Safe to call from any thread.
+ * @param buf: From Response_serialize(), must stay valid until @param done runs
+ * @param len: Length of @param buf
+ * @param done: Called on a signing thread once signed, with 0 or negative on failure
+ * @param user: Passed through to @param done
+ * @return 0 if queued, negative if the queue is full or not running; sign inline then
+ **/
+int Signer_submit(uint8_t* buf, size_t len, void (*done)(void* user, int error), void* user);
+
+/**
+ * void Signer_stop(void)
+ * Signs whatever is still queued, then stops the signing threads.
+ **/
+void Signer_stop(void);
+
+#endif